@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "arena.h"
+
+/*
+ * The chunks double in size up to ARENA_MAX_CHUNK_SIZE so the snapshots
+ * with few copies stay small.
+ */
+#define ARENA_MIN_CHUNK_SIZE	(4 * 1024)
+#define ARENA_MAX_CHUNK_SIZE	(64 * 1024)
+#define ARENA_ALIGN		16
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	/* keep the data aligned */
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+struct arena {
+	int refcount;
+	struct arena_chunk *chunks;	/* current chunk first */
+	size_t mem_size;
+};
+
+static struct arena_chunk *new_chunk(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk;
+
+	chunk = g_malloc(sizeof(struct arena_chunk) + size);
+	chunk->size = size;
+	chunk->used = 0;
+	arena->mem_size += sizeof(struct arena_chunk) + size;
+
+	return chunk;
+}
+
+struct arena *arena_new(void)
+{
+	struct arena *arena;
+
+	arena = g_new0(struct arena, 1);
+	arena->refcount = 1;
+	arena->chunks = new_chunk(arena, ARENA_MIN_CHUNK_SIZE);
+	arena->chunks->next = NULL;
+
+	return arena;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk = arena->chunks;
+	size_t chunk_size;
+	void *ptr;
+
+	size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+	if (chunk->used + size > chunk->size) {
+		chunk_size = MIN(chunk->size * 2, ARENA_MAX_CHUNK_SIZE);
+		if (size > chunk_size / 4) {
+			/* big objects get their own chunk, behind the current one */
+			chunk = new_chunk(arena, size);
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		} else {
+			chunk = new_chunk(arena, chunk_size);
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+		}
+	}
+	ptr = chunk->data + chunk->used;
+	chunk->used += size;
+	memset(ptr, 0, size);
+
+	return ptr;
+}
+
+void arena_get(struct arena *arena)
+{
+	g_atomic_int_inc(&arena->refcount);
+}
+
+void arena_put(struct arena *arena)
+{
+	struct arena_chunk *chunk, *next;
+
+	if (!arena || !g_atomic_int_dec_and_test(&arena->refcount))
+		return;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		g_free(chunk);
+	}
+	g_free(arena);
+}
+
+size_t arena_mem_size(struct arena *arena)
+{
+	return arena->mem_size;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump allocator for the objects of a snapshot: the objects are never
+ * freed individually, all the memory is released at once when the last
+ * reference on the arena is dropped. Allocations are not thread-safe,
+ * references are.
+ */
+struct arena;
+
+struct arena *arena_new(void);
+/* zeroed memory, aligned for any type */
+void *arena_alloc(struct arena *arena, size_t size);
+void arena_get(struct arena *arena);
+void arena_put(struct arena *arena);
+/* bytes reserved by the arena */
+size_t arena_mem_size(struct arena *arena);
+
+#define arena_new0(arena, type) \
+	((type *) arena_alloc(arena, sizeof(type)))
+
+#endif /* _ARENA_H */
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <glib.h>
+
+#include "common.h"
+#include "batch.h"
+
+enum batch_sort {
+	SORT_CPU,
+	SORT_IO,
+	SORT_PERF,
+};
+
+struct batch_sort_key {
+	enum batch_sort sort;
+	unsigned int slot;
+};
+
+struct batch_perf {
+	const char *name;
+	unsigned int slot;
+};
+
+static int csv_header_done;
+
+int parse_batch_format(const char *name, enum batch_format *format)
+{
+	if (strcmp(name, "json") == 0)
+		*format = BATCH_FORMAT_JSON;
+	else if (strcmp(name, "csv") == 0)
+		*format = BATCH_FORMAT_CSV;
+	else
+		return -1;
+
+	return 0;
+}
+
+static uint64_t sort_value(struct processtop *proc, struct batch_sort_key *key)
+{
+	switch (key->sort) {
+	case SORT_CPU:
+		return proc->totalcpunsec;
+	case SORT_IO:
+		return proc->fileread + proc->filewrite;
+	case SORT_PERF:
+		return get_perf_value(&proc->perf, key->slot);
+	}
+
+	return 0;
+}
+
+static gint compare_processes(gconstpointer a, gconstpointer b,
+		gpointer user_data)
+{
+	struct processtop *p1 = *(struct processtop **) a;
+	struct processtop *p2 = *(struct processtop **) b;
+	uint64_t v1, v2;
+
+	v1 = sort_value(p1, user_data);
+	v2 = sort_value(p2, user_data);
+	if (v1 != v2)
+		return v1 < v2 ? 1 : -1;
+
+	return p1->tid - p2->tid;
+}
+
+/* the processes with a non-zero value, highest first, at most top */
+static GPtrArray *top_processes(struct lttngtop *snapshot,
+		struct batch_sort_key *key, unsigned int top)
+{
+	struct processtop *proc;
+	GPtrArray *procs;
+	unsigned int i;
+
+	procs = g_ptr_array_new();
+	for (i = 0; i < snapshot->process_table->len; i++) {
+		proc = g_ptr_array_index(snapshot->process_table, i);
+		if (sort_value(proc, key))
+			g_ptr_array_add(procs, proc);
+	}
+	g_ptr_array_sort_with_data(procs, compare_processes, key);
+	if (procs->len > top)
+		g_ptr_array_set_size(procs, top);
+
+	return procs;
+}
+
+static gint compare_perf(gconstpointer a, gconstpointer b)
+{
+	const struct batch_perf *p1 = a, *p2 = b;
+
+	return p1->slot - p2->slot;
+}
+
+/* the perf counters of the trace, in the order they were found */
+static GArray *perf_counters(void)
+{
+	struct perfcounter *counter;
+	struct batch_perf perf;
+	GHashTableIter iter;
+	gpointer key, value;
+	GArray *counters;
+
+	counters = g_array_new(FALSE, FALSE, sizeof(struct batch_perf));
+	g_hash_table_iter_init(&iter, global_perf_liszt);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		counter = value;
+		perf.name = key;
+		perf.slot = counter->slot;
+		g_array_append_val(counters, perf);
+	}
+	g_array_sort(counters, compare_perf);
+
+	return counters;
+}
+
+static void print_json_string(FILE *fp, const char *str)
+{
+	const unsigned char *c;
+
+	fputc('"', fp);
+	for (c = (const unsigned char *) (str ? str : ""); *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(fp, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(fp, "\\u%04x", *c);
+		else
+			fputc(*c, fp);
+	}
+	fputc('"', fp);
+}
+
+static void print_csv_string(FILE *fp, const char *str)
+{
+	const char *c;
+
+	if (!str)
+		return;
+	if (!strpbrk(str, ",\"\r\n")) {
+		fputs(str, fp);
+		return;
+	}
+	fputc('"', fp);
+	for (c = str; *c; c++) {
+		if (*c == '"')
+			fputc('"', fp);
+		fputc(*c, fp);
+	}
+	fputc('"', fp);
+}
+
+static void print_json_process(FILE *fp, struct processtop *proc)
+{
+	fprintf(fp, "{\"tid\":%d,\"pid\":%d,\"comm\":", proc->tid, proc->pid);
+	print_json_string(fp, proc->comm);
+}
+
+static void print_csv_row(FILE *fp, struct lttngtop *snapshot,
+		const char *kind, const char *counter, int id,
+		struct processtop *proc)
+{
+	fprintf(fp, "%lu,%lu,%s,", snapshot->start, snapshot->end, kind);
+	print_csv_string(fp, counter);
+	fprintf(fp, ",%d,", id);
+	if (proc) {
+		fprintf(fp, "%d,", proc->pid);
+		print_csv_string(fp, proc->comm);
+	} else {
+		fputc(',', fp);
+	}
+}
+
+static void print_json(FILE *fp, struct lttngtop *snapshot, unsigned int top,
+		double elapsed, GArray *counters)
+{
+	struct batch_sort_key key = { 0 };
+	struct processtop *proc;
+	struct cputime *cpu;
+	struct batch_perf *perf;
+	GPtrArray *procs;
+	unsigned int i, j;
+
+	fprintf(fp, "{\"begin\":%lu,\"end\":%lu,\"nbproc\":%u,"
+			"\"nbthreads\":%u,\"nbfiles\":%u,\"cpus\":[",
+			snapshot->start, snapshot->end, snapshot->nbproc,
+			snapshot->nbthreads, snapshot->nbfiles);
+	for (i = 0; i < snapshot->cpu_table->len; i++) {
+		cpu = g_ptr_array_index(snapshot->cpu_table, i);
+		fprintf(fp, "%s{\"id\":%d,\"usage\":%.2f}", i ? "," : "",
+				cpu->id, cpu->busy_nsec * 100.0 / elapsed);
+	}
+
+	key.sort = SORT_CPU;
+	procs = top_processes(snapshot, &key, top);
+	fprintf(fp, "],\"cpu\":[");
+	for (i = 0; i < procs->len; i++) {
+		proc = g_ptr_array_index(procs, i);
+		fprintf(fp, "%s", i ? "," : "");
+		print_json_process(fp, proc);
+		fprintf(fp, ",\"usage\":%.2f}", proc->totalcpunsec * 100.0 /
+				(elapsed * MAX(snapshot->cpu_table->len, 1)));
+	}
+	g_ptr_array_free(procs, TRUE);
+
+	key.sort = SORT_IO;
+	procs = top_processes(snapshot, &key, top);
+	fprintf(fp, "],\"io\":[");
+	for (i = 0; i < procs->len; i++) {
+		proc = g_ptr_array_index(procs, i);
+		fprintf(fp, "%s", i ? "," : "");
+		print_json_process(fp, proc);
+		fprintf(fp, ",\"read\":%lu,\"write\":%lu}", proc->fileread,
+				proc->filewrite);
+	}
+	g_ptr_array_free(procs, TRUE);
+
+	fprintf(fp, "],\"perf\":{");
+	key.sort = SORT_PERF;
+	for (i = 0; i < counters->len; i++) {
+		perf = &g_array_index(counters, struct batch_perf, i);
+		key.slot = perf->slot;
+		procs = top_processes(snapshot, &key, top);
+		fprintf(fp, "%s", i ? "," : "");
+		print_json_string(fp, perf->name);
+		fprintf(fp, ":[");
+		for (j = 0; j < procs->len; j++) {
+			proc = g_ptr_array_index(procs, j);
+			fprintf(fp, "%s", j ? "," : "");
+			print_json_process(fp, proc);
+			fprintf(fp, ",\"value\":%" PRIu64 "}",
+					get_perf_value(&proc->perf, perf->slot));
+		}
+		fprintf(fp, "]");
+		g_ptr_array_free(procs, TRUE);
+	}
+	fprintf(fp, "}}\n");
+}
+
+static void print_csv(FILE *fp, struct lttngtop *snapshot, unsigned int top,
+		double elapsed, GArray *counters)
+{
+	struct batch_sort_key key = { 0 };
+	struct processtop *proc;
+	struct cputime *cpu;
+	struct batch_perf *perf;
+	GPtrArray *procs;
+	unsigned int i, j;
+
+	if (!csv_header_done) {
+		fprintf(fp, "begin,end,kind,counter,id,pid,comm,value,value2\n");
+		csv_header_done = 1;
+	}
+
+	for (i = 0; i < snapshot->cpu_table->len; i++) {
+		cpu = g_ptr_array_index(snapshot->cpu_table, i);
+		print_csv_row(fp, snapshot, "cpu", NULL, cpu->id, NULL);
+		fprintf(fp, ",%.2f,\n", cpu->busy_nsec * 100.0 / elapsed);
+	}
+
+	key.sort = SORT_CPU;
+	procs = top_processes(snapshot, &key, top);
+	for (i = 0; i < procs->len; i++) {
+		proc = g_ptr_array_index(procs, i);
+		print_csv_row(fp, snapshot, "process_cpu", NULL, proc->tid,
+				proc);
+		fprintf(fp, ",%.2f,\n", proc->totalcpunsec * 100.0 /
+				(elapsed * MAX(snapshot->cpu_table->len, 1)));
+	}
+	g_ptr_array_free(procs, TRUE);
+
+	key.sort = SORT_IO;
+	procs = top_processes(snapshot, &key, top);
+	for (i = 0; i < procs->len; i++) {
+		proc = g_ptr_array_index(procs, i);
+		print_csv_row(fp, snapshot, "process_io", NULL, proc->tid,
+				proc);
+		fprintf(fp, ",%lu,%lu\n", proc->fileread, proc->filewrite);
+	}
+	g_ptr_array_free(procs, TRUE);
+
+	key.sort = SORT_PERF;
+	for (i = 0; i < counters->len; i++) {
+		perf = &g_array_index(counters, struct batch_perf, i);
+		key.slot = perf->slot;
+		procs = top_processes(snapshot, &key, top);
+		for (j = 0; j < procs->len; j++) {
+			proc = g_ptr_array_index(procs, j);
+			print_csv_row(fp, snapshot, "process_perf", perf->name,
+					proc->tid, proc);
+			fprintf(fp, ",%" PRIu64 ",\n",
+					get_perf_value(&proc->perf, perf->slot));
+		}
+		g_ptr_array_free(procs, TRUE);
+	}
+}
+
+void batch_print_snapshot(FILE *fp, struct lttngtop *snapshot,
+		enum batch_format format, unsigned int top)
+{
+	GArray *counters;
+	double elapsed;
+
+	/* an empty interval at the end of the trace */
+	if (snapshot->end <= snapshot->start)
+		return;
+
+	elapsed = snapshot->end - snapshot->start;
+	counters = perf_counters();
+	switch (format) {
+	case BATCH_FORMAT_JSON:
+		print_json(fp, snapshot, top, elapsed, counters);
+		break;
+	case BATCH_FORMAT_CSV:
+		print_csv(fp, snapshot, top, elapsed, counters);
+		break;
+	}
+	g_array_free(counters, TRUE);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <stdio.h>
+
+#include "lttngtoptypes.h"
+
+#define DEFAULT_BATCH_TOP	10
+
+enum batch_format {
+	BATCH_FORMAT_JSON,
+	BATCH_FORMAT_CSV,
+};
+
+/* returns -1 if the format name is unknown */
+int parse_batch_format(const char *name, enum batch_format *format);
+
+/*
+ * Write the summary of a snapshot to fp: the usage of each cpu and the
+ * top processes by cpu, by IO and for each perf counter. In JSON, one
+ * object per line. In CSV, one row per value, the header is written
+ * before the first snapshot.
+ */
+void batch_print_snapshot(FILE *fp, struct lttngtop *snapshot,
+		enum batch_format format, unsigned int top);
+
+#endif /* _BATCH_H */
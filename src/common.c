@@ -15,157 +15,222 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <babeltrace/babeltrace-internal.h>
 #include <babeltrace/ctf/events.h>
+#include <babeltrace/ctf/events-internal.h>
+#include <babeltrace/ctf/metadata.h>
+#include <babeltrace/ctf/types.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <linux/unistd.h>
 #include <string.h>
+#include <pthread.h>
 #include "common.h"
+#include "field-cache.h"
+#include "arena.h"
+#include "pool.h"
+#include "iostreamtop.h"
+
+static struct pool processtop_pool = POOL_INIT(struct processtop);
+
+/*
+ * A reused process keeps its emptied containers instead of allocating
+ * new ones.
+ */
+static struct processtop *new_processtop(void)
+{
+	struct processtop *proc;
+	GPtrArray *files, *threads;
+	struct perf_values perf;
+
+	proc = pool_alloc(&processtop_pool);
+	files = proc->process_files_table;
+	threads = proc->threads;
+	perf = proc->perf;
+	memset(proc, 0, sizeof(struct processtop));
+	proc->process_files_table = files ? files : g_ptr_array_new();
+	proc->threads = threads ? threads : g_ptr_array_new();
+	proc->perf = perf;
+	if (perf.len)
+		memset(perf.count, 0, perf.len * sizeof(uint64_t));
+
+	return proc;
+}
+
+/*
+ * Context of the event being processed, decoded once and shared by all
+ * the callbacks of this event.
+ */
+static struct event_context current_event_context;
+
+static uint64_t decode_context_int(const struct bt_ctf_event *event,
+		enum lttngtop_field field)
+{
+	int64_t value;
+
+	value = get_field_int64(event, field);
+	if (get_field_error())
+		return -1ULL;
+
+	return value;
+}
+
+static char *decode_context_char_array(const struct bt_ctf_event *event,
+		enum lttngtop_field field)
+{
+	char *value;
+
+	value = get_field_char_array(event, field);
+	if (get_field_error())
+		return NULL;
+
+	return value;
+}
+
+/*
+ * The events of a stream are told apart by their packet and their offset
+ * in it, several events can have the same timestamp. The merged events
+ * of the decoders have no stream, they are numbered.
+ */
+static void get_event_position(const struct bt_ctf_event *event,
+		struct event_position *position)
+{
+	struct ctf_file_stream *file_stream;
+	struct event_record *record;
+
+	record = get_event_record(event);
+	if (record) {
+		memset(position, 0, sizeof(*position));
+		position->packet = record->seq;
+		return;
+	}
+
+	file_stream = container_of(event->parent->stream,
+			struct ctf_file_stream, parent);
+	position->stream = event->parent->stream;
+	position->packet = file_stream->pos.cur_index;
+	position->mmap_offset = file_stream->pos.mmap_offset;
+	position->base = file_stream->pos.base_mma;
+	position->offset = file_stream->pos.last_offset;
+}
+
+/*
+ * Read all the context fields of the event in one pass. Called by the
+ * first callback of every event (fix_process_table), the pointers are
+ * only valid until the next event is read.
+ */
+const struct event_context *decode_event_context(
+		const struct bt_ctf_event *event)
+{
+	struct event_context *ctx = &current_event_context;
+
+	get_event_position(event, &ctx->position);
+	ctx->timestamp = get_event_timestamp(event);
+
+	ctx->cpu_id = get_field_uint64(event, FIELD_CPU_ID);
+	if (get_field_error())
+		ctx->cpu_id = -1ULL;
+	/* the field cache falls back on _vtid/_vpid without _tid/_pid (UST) */
+	ctx->pid = decode_context_int(event, FIELD_CTX_PID);
+	ctx->tid = decode_context_int(event, FIELD_CTX_TID);
+	ctx->ppid = decode_context_int(event, FIELD_CTX_PPID);
+	ctx->vpid = decode_context_int(event, FIELD_CTX_VPID);
+	ctx->vtid = decode_context_int(event, FIELD_CTX_VTID);
+	ctx->vppid = decode_context_int(event, FIELD_CTX_VPPID);
+	ctx->comm = decode_context_char_array(event, FIELD_CTX_PROCNAME);
+	ctx->hostname = decode_context_char_array(event, FIELD_CTX_HOSTNAME);
+
+	return ctx;
+}
+
+/*
+ * Return the decoded context of the event, decoding it if the event is
+ * not the one currently cached.
+ */
+const struct event_context *get_event_context(
+		const struct bt_ctf_event *event)
+{
+	struct event_context *ctx = &current_event_context;
+	struct event_position position;
+
+	get_event_position(event, &position);
+	if (position.stream == ctx->position.stream &&
+			position.packet == ctx->position.packet &&
+			position.mmap_offset == ctx->position.mmap_offset &&
+			position.base == ctx->position.base &&
+			position.offset == ctx->position.offset)
+		return ctx;
+
+	return decode_event_context(event);
+}
 
 uint64_t get_cpu_id(const struct bt_ctf_event *event)
 {
-	const struct bt_definition *scope;
 	uint64_t cpu_id;
 
-	scope = bt_ctf_get_top_level_scope(event, BT_STREAM_PACKET_CONTEXT);
-	cpu_id = bt_ctf_get_uint64(bt_ctf_get_field(event, scope, "cpu_id"));
-	if (bt_ctf_field_get_error()) {
+	cpu_id = get_event_context(event)->cpu_id;
+	if (cpu_id == -1ULL)
 		fprintf(stderr, "[error] get cpu_id\n");
-		return -1ULL;
-	}
 
 	return cpu_id;
 }
 
 uint64_t get_context_tid(const struct bt_ctf_event *event)
 {
-	const struct bt_definition *scope;
 	uint64_t tid;
 
-	scope = bt_ctf_get_top_level_scope(event, BT_STREAM_EVENT_CONTEXT);
-	tid = bt_ctf_get_int64(bt_ctf_get_field(event,
-				scope, "_tid"));
-	if (bt_ctf_field_get_error()) {
-		tid = bt_ctf_get_int64(bt_ctf_get_field(event,
-					scope, "_vtid"));
-		if (bt_ctf_field_get_error()) {
-			fprintf(stderr, "Missing tid context info\n");
-			return -1ULL;
-		}
-	}
+	tid = get_event_context(event)->tid;
+	if (tid == -1ULL)
+		fprintf(stderr, "Missing tid context info\n");
 
 	return tid;
 }
 
 uint64_t get_context_pid(const struct bt_ctf_event *event)
 {
-	const struct bt_definition *scope;
 	uint64_t pid;
 
-	scope = bt_ctf_get_top_level_scope(event, BT_STREAM_EVENT_CONTEXT);
-	pid = bt_ctf_get_int64(bt_ctf_get_field(event,
-				scope, "_pid"));
-	if (bt_ctf_field_get_error()) {
-		/* Try UST pid */
-		pid = bt_ctf_get_int64(bt_ctf_get_field(event,
-					scope, "_vpid"));
-		if (bt_ctf_field_get_error()) {
-			fprintf(stderr, "Missing pid context info\n");
-			return -1ULL;
-		}
-	}
+	pid = get_event_context(event)->pid;
+	if (pid == -1ULL)
+		fprintf(stderr, "Missing pid context info\n");
 
 	return pid;
 }
 
 uint64_t get_context_ppid(const struct bt_ctf_event *event)
 {
-	const struct bt_definition *scope;
-	uint64_t ppid;
-
-	scope = bt_ctf_get_top_level_scope(event, BT_STREAM_EVENT_CONTEXT);
-	ppid = bt_ctf_get_int64(bt_ctf_get_field(event,
-				scope, "_ppid"));
-	if (bt_ctf_field_get_error()) {
-		return -1ULL;
-	}
-
-	return ppid;
+	return get_event_context(event)->ppid;
 }
 
 uint64_t get_context_vtid(const struct bt_ctf_event *event)
 {
-	const struct bt_definition *scope;
-	uint64_t vtid;
-
-	scope = bt_ctf_get_top_level_scope(event, BT_STREAM_EVENT_CONTEXT);
-	vtid = bt_ctf_get_int64(bt_ctf_get_field(event,
-				scope, "_vtid"));
-	if (bt_ctf_field_get_error()) {
-		return -1ULL;
-	}
-
-	return vtid;
+	return get_event_context(event)->vtid;
 }
 
 uint64_t get_context_vpid(const struct bt_ctf_event *event)
 {
-	const struct bt_definition *scope;
-	uint64_t vpid;
-
-	scope = bt_ctf_get_top_level_scope(event, BT_STREAM_EVENT_CONTEXT);
-	vpid = bt_ctf_get_int64(bt_ctf_get_field(event,
-				scope, "_vpid"));
-	if (bt_ctf_field_get_error()) {
-		return -1ULL;
-	}
-
-	return vpid;
+	return get_event_context(event)->vpid;
 }
 
 uint64_t get_context_vppid(const struct bt_ctf_event *event)
 {
-	const struct bt_definition *scope;
-	uint64_t vppid;
-
-	scope = bt_ctf_get_top_level_scope(event, BT_STREAM_EVENT_CONTEXT);
-	vppid = bt_ctf_get_int64(bt_ctf_get_field(event,
-				scope, "_vppid"));
-	if (bt_ctf_field_get_error()) {
-		return -1ULL;
-	}
-
-	return vppid;
+	return get_event_context(event)->vppid;
 }
 
 char *get_context_comm(const struct bt_ctf_event *event)
 {
-	const struct bt_definition *scope;
 	char *comm;
 
-	scope = bt_ctf_get_top_level_scope(event, BT_STREAM_EVENT_CONTEXT);
-	comm = bt_ctf_get_char_array(bt_ctf_get_field(event,
-				scope, "_procname"));
-	if (bt_ctf_field_get_error()) {
+	comm = get_event_context(event)->comm;
+	if (!comm)
 		fprintf(stderr, "Missing comm context info\n");
-		return NULL;
-	}
 
 	return comm;
 }
 
 char *get_context_hostname(const struct bt_ctf_event *event)
 {
-	const struct bt_definition *scope;
-	char *hostname;
-
-	scope = bt_ctf_get_top_level_scope(event, BT_STREAM_EVENT_CONTEXT);
-	hostname = bt_ctf_get_char_array(bt_ctf_get_field(event,
-				scope, "_hostname"));
-	if (bt_ctf_field_get_error()) {
-		return NULL;
-	}
-
-	return hostname;
+	return get_event_context(event)->hostname;
 }
 
 /*
@@ -182,6 +247,89 @@ struct processtop *find_process_tid(struct lttngtop *ctx, int tid, const char *c
 	return tmp;
 }
 
+/*
+ * Process and file names are interned so the live state and the
+ * snapshots share the same string. Each pointer to a name holds a
+ * reference, the name is freed with the last one. The snapshots are
+ * released by the display threads, names_lock protects the table.
+ */
+struct interned_name {
+	int refcount;
+	char str[];
+};
+
+static GHashTable *interned_names;	/* string -> struct interned_name */
+static pthread_mutex_t names_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct interned_name *name_of(char *name)
+{
+	return (struct interned_name *) (name -
+			offsetof(struct interned_name, str));
+}
+
+/* return a reference on the interned copy of name */
+char *intern_name(const char *name)
+{
+	struct interned_name *interned;
+
+	if (!name)
+		return NULL;
+	pthread_mutex_lock(&names_lock);
+	if (!interned_names)
+		interned_names = g_hash_table_new(g_str_hash, g_str_equal);
+	interned = g_hash_table_lookup(interned_names, name);
+	if (interned) {
+		interned->refcount++;
+	} else {
+		interned = g_malloc(sizeof(struct interned_name) +
+				strlen(name) + 1);
+		interned->refcount = 1;
+		strcpy(interned->str, name);
+		g_hash_table_insert(interned_names, interned->str, interned);
+	}
+	pthread_mutex_unlock(&names_lock);
+
+	return interned->str;
+}
+
+/* new reference on an interned name */
+char *get_name(char *name)
+{
+	if (!name)
+		return NULL;
+	pthread_mutex_lock(&names_lock);
+	name_of(name)->refcount++;
+	pthread_mutex_unlock(&names_lock);
+
+	return name;
+}
+
+void put_name(char *name)
+{
+	struct interned_name *interned;
+
+	if (!name)
+		return;
+	interned = name_of(name);
+	pthread_mutex_lock(&names_lock);
+	if (--interned->refcount == 0) {
+		g_hash_table_remove(interned_names, interned->str);
+		g_free(interned);
+	}
+	pthread_mutex_unlock(&names_lock);
+}
+
+/* replace the interned name *dst, kept if it does not change */
+void set_name(char **dst, const char *name)
+{
+	char *old = *dst;
+
+	if (old && name && strcmp(old, name) == 0)
+		return;
+	*dst = intern_name(name);
+	put_name(old);
+}
+
 struct processtop* add_proc(struct lttngtop *ctx, int tid, char *comm,
 		unsigned long timestamp, char *hostname)
 {
@@ -193,19 +341,9 @@ struct processtop* add_proc(struct lttngtop *ctx, int tid, char *comm,
 	newproc = find_process_tid(ctx, tid, comm);
 
 	if (!newproc) {
-		newproc = g_new0(struct processtop, 1);
+		newproc = new_processtop();
 		newproc->tid = tid;
 		newproc->birth = timestamp;
-		newproc->process_files_table = g_ptr_array_new();
-		newproc->files_history = NULL;
-		newproc->totalfileread = 0;
-		newproc->totalfilewrite = 0;
-		newproc->fileread = 0;
-		newproc->filewrite = 0;
-		newproc->syscall_info = NULL;
-		newproc->threadparent = NULL;
-		newproc->threads = g_ptr_array_new();
-		newproc->perf = g_hash_table_new(g_str_hash, g_str_equal);
 		g_ptr_array_add(ctx->process_table, newproc);
 		g_hash_table_insert(ctx->process_hash_table,
 				(gpointer) (unsigned long) tid, newproc);
@@ -215,7 +353,8 @@ struct processtop* add_proc(struct lttngtop *ctx, int tid, char *comm,
 		ctx->nbnewthreads++;
 		ctx->nbthreads++;
 	}
-	newproc->comm = strdup(comm);
+	set_name(&newproc->comm, comm);
+	newproc->dirty = 1;
 	if (hostname) {
 		host = lookup_hostname_list(hostname);
 		if (!host)
@@ -242,10 +381,8 @@ struct processtop* update_proc(struct processtop* proc, int pid, int tid,
 		proc->vpid = vpid;
 		proc->vtid = vtid;
 		proc->vppid = vppid;
-		if (strcmp(proc->comm, comm) != 0) {
-			free(proc->comm);
-			proc->comm = strdup(comm);
-		}
+		set_name(&proc->comm, comm);
+		proc->dirty = 1;
 		if (hostname && !proc->host) {
 			host = lookup_hostname_list(hostname);
 			if (!host)
@@ -270,10 +407,15 @@ void death_proc(struct lttngtop *ctx, int tid, char *comm,
 	struct processtop *tmp;
 	tmp = find_process_tid(ctx, tid, comm);
 
+	/* the birth at the death tells the parent it was not seen before */
+	if (!tmp && carried_state)
+		tmp = add_proc(ctx, tid, comm, timestamp, NULL);
+
 	g_hash_table_remove(ctx->process_hash_table,
 			(gpointer) (unsigned long) tid);
 	if (tmp && strcmp(tmp->comm, comm) == 0) {
 		tmp->death = timestamp;
+		tmp->dirty = 1;
 		ctx->nbdeadthreads++;
 		ctx->nbthreads--;
 	}
@@ -286,6 +428,7 @@ struct processtop* get_proc(struct lttngtop *ctx, int tid, char *comm,
 
 	tmp = find_process_tid(ctx, tid, comm);
 	if (tmp && strcmp(tmp->comm, comm) == 0) {
+		tmp->dirty = 1;
 		return tmp;
 	}
 	return add_proc(ctx, tid, comm, timestamp, hostname);
@@ -296,8 +439,10 @@ struct processtop *get_proc_pid(struct lttngtop *ctx, int tid, int pid,
 {
 	struct processtop *tmp;
 	tmp = find_process_tid(ctx, tid, NULL);
-	if (tmp && tmp->pid == pid)
+	if (tmp && tmp->pid == pid) {
+		tmp->dirty = 1;
 		return tmp;
+	}
 	return add_proc(ctx, tid, NULL, timestamp, hostname);
 }
 
@@ -317,24 +462,65 @@ void add_thread(struct processtop *parent, struct processtop *thread)
 	g_ptr_array_add(parent->threads, thread);
 }
 
+/*
+ * The live cpus are indexed by their id, each one on its own cache lines.
+ * lttngtop.cpu_table keeps them in the order they were seen.
+ */
+#define CPU_CACHE_LINE_SIZE	64
+
+static struct cputime **cpu_index;
+static unsigned int cpu_index_len;
+
+static void grow_cpu_index(unsigned int len)
+{
+	cpu_index = g_renew(struct cputime *, cpu_index, len);
+	memset(cpu_index + cpu_index_len, 0,
+			(len - cpu_index_len) * sizeof(struct cputime *));
+	cpu_index_len = len;
+}
+
+void init_cpu_table(unsigned int nr_cpus)
+{
+	lttngtop.cpu_table = g_ptr_array_sized_new(nr_cpus);
+	grow_cpu_index(nr_cpus);
+}
+
 struct cputime* add_cpu(int cpu)
 {
 	struct cputime *newcpu;
+	size_t size;
 
-	newcpu = g_new0(struct cputime, 1);
+	size = (sizeof(struct cputime) + CPU_CACHE_LINE_SIZE - 1) &
+		~((size_t) CPU_CACHE_LINE_SIZE - 1);
+	if (posix_memalign((void **) &newcpu, CPU_CACHE_LINE_SIZE, size))
+		abort();
+	memset(newcpu, 0, size);
 	newcpu->id = cpu;
 	newcpu->current_task = NULL;
-	newcpu->perf = g_hash_table_new(g_str_hash, g_str_equal);
 
 	g_ptr_array_add(lttngtop.cpu_table, newcpu);
+	/* the invalid ids are only in cpu_table */
+	if (cpu >= 0) {
+		if (cpu >= cpu_index_len)
+			grow_cpu_index(MAX((unsigned int) cpu + 1,
+						cpu_index_len * 2));
+		cpu_index[cpu] = newcpu;
+	}
 
 	return newcpu;
 }
+
 struct cputime* get_cpu(int cpu)
 {
 	gint i;
 	struct cputime *tmp;
 
+	if (cpu >= 0) {
+		if (cpu < cpu_index_len && cpu_index[cpu])
+			return cpu_index[cpu];
+		return add_cpu(cpu);
+	}
+
 	for (i = 0; i < lttngtop.cpu_table->len; i++) {
 		tmp = g_ptr_array_index(lttngtop.cpu_table, i);
 		if (tmp->id == cpu)
@@ -358,45 +544,109 @@ void rotate_cputime(unsigned long end)
 		tmp = g_ptr_array_index(lttngtop.cpu_table, i);
 		elapsed = end - tmp->task_start;
 		if (tmp->current_task) {
+			tmp->busy_nsec += elapsed;
 			tmp->current_task->totalcpunsec += elapsed;
 			tmp->current_task->threadstotalcpunsec += elapsed;
+			tmp->current_task->dirty = 1;
 			if (tmp->current_task->pid != tmp->current_task->tid &&
 					tmp->current_task->threadparent) {
 				tmp->current_task->threadparent->threadstotalcpunsec += elapsed;
+				tmp->current_task->threadparent->dirty = 1;
 			}
 		}
 		tmp->task_start = end;
 	}
 }
 
-void reset_perf_counter(gpointer key, gpointer value, gpointer user_data)
+/*
+ * Give the next slot to a perf counter found in the trace, the first one
+ * is the default sort of the perf view.
+ */
+struct perfcounter *register_perf_counter(const char *name)
+{
+	struct perfcounter *global;
+
+	global = g_hash_table_lookup(global_perf_liszt, (gpointer) name);
+	if (global)
+		return global;
+
+	global = g_new0(struct perfcounter, 1);
+	global->slot = g_hash_table_size(global_perf_liszt);
+	if (global->slot == 0)
+		global->sort = 1;
+	global->visible = 1;
+	g_hash_table_insert(global_perf_liszt, intern_name(name), global);
+	/* the event classes already resolved don't know this counter */
+	invalidate_field_cache();
+
+	return global;
+}
+
+int lookup_perf_slot(const char *name)
+{
+	struct perfcounter *global;
+
+	global = g_hash_table_lookup(global_perf_liszt, (gpointer) name);
+	if (!global)
+		return -1;
+
+	return global->slot;
+}
+
+uint64_t get_perf_value(const struct perf_values *perf, unsigned int slot)
 {
-	((struct perfcounter*) value)->count = 0;
+	if (slot >= perf->len)
+		return 0;
+
+	return perf->count[slot];
 }
 
-void copy_perf_counter(gpointer key, gpointer value, gpointer new_table)
+/* the arrays grow to the number of registered counters */
+uint64_t *get_perf_value_ptr(struct perf_values *perf, unsigned int slot)
 {
-	struct perfcounter *newperf;
+	unsigned int len;
+
+	if (slot >= perf->len) {
+		len = MAX(slot + 1, g_hash_table_size(global_perf_liszt));
+		perf->count = g_renew(uint64_t, perf->count, len);
+		memset(perf->count + perf->len, 0,
+				(len - perf->len) * sizeof(uint64_t));
+		perf->len = len;
+	}
 
-	newperf = g_new0(struct perfcounter, 1);
-	newperf->count = ((struct perfcounter *) value)->count;
-	newperf->visible = ((struct perfcounter *) value)->visible;
-	newperf->sort = ((struct perfcounter *) value)->sort;
-	g_hash_table_insert((GHashTable *) new_table, strdup(key), newperf);
+	return &perf->count[slot];
 }
 
-void copy_process_table(gpointer key, gpointer value, gpointer new_table)
+/* the counters are copied in the arena, or on the heap without arena */
+static void copy_perf_values(struct perf_values *dst,
+		const struct perf_values *src, struct arena *arena)
 {
-	g_hash_table_insert((GHashTable *) new_table, key, value);
+	dst->len = src->len;
+	dst->count = NULL;
+	if (!src->len)
+		return;
+	if (arena)
+		dst->count = arena_alloc(arena, src->len * sizeof(uint64_t));
+	else
+		dst->count = g_new(uint64_t, src->len);
+	memcpy(dst->count, src->count, src->len * sizeof(uint64_t));
 }
 
 void rotate_perfcounter() {
 	int i;
+	unsigned int j;
 	struct processtop *tmp;
 
 	for (i = 0; i < lttngtop.process_table->len; i++) {
 		tmp = g_ptr_array_index(lttngtop.process_table, i);
-		g_hash_table_foreach(tmp->perf, reset_perf_counter, NULL);
+		for (j = 0; j < tmp->perf.len; j++) {
+			/* the snapshot copy still has the old value */
+			if (tmp->perf.count[j])
+				tmp->dirty = 1;
+		}
+		if (tmp->perf.len)
+			memset(tmp->perf.count, 0,
+					tmp->perf.len * sizeof(uint64_t));
 	}
 }
 
@@ -408,6 +658,13 @@ void cleanup_processtop()
 
 	for (i = 0; i < lttngtop.process_table->len; i++) {
 		tmp = g_ptr_array_index(lttngtop.process_table, i);
+		/*
+		 * Resetting the counters of the period makes the process
+		 * differ from its snapshot copy.
+		 */
+		if (tmp->totalcpunsec || tmp->threadstotalcpunsec ||
+				tmp->fileread || tmp->filewrite)
+			tmp->dirty = 1;
 		tmp->totalcpunsec = 0;
 		tmp->threadstotalcpunsec = 0;
 		tmp->fileread = 0;
@@ -416,13 +673,18 @@ void cleanup_processtop()
 		for (j = 0; j < tmp->process_files_table->len; j++) {
 			tmpf = g_ptr_array_index(tmp->process_files_table, j);
 			if (tmpf != NULL) {
+				if (tmpf->read || tmpf->write ||
+						tmpf->flag == __NR_close)
+					tmp->dirty = 1;
 				tmpf->read = 0;
 				tmpf->write = 0;
 
-				if (tmpf->flag == __NR_close)
+				if (tmpf->flag == __NR_close) {
 					g_ptr_array_index(
 						tmp->process_files_table, j
 					) = NULL;
+					free_file(tmpf);
+				}
 			}
 		}
 	}
@@ -452,78 +714,382 @@ void copy_global_counters(struct lttngtop *dst)
 	reset_global_counters();
 }
 
+/*
+ * Make the snapshot copy of a process. The copy is shared by the next
+ * snapshots while the process is not modified, so it is allocated on
+ * the heap rather than in the arena of a snapshot it can outlive. The
+ * names are interned so they are shared with the live process. The
+ * thread hierarchy is not kept in the copies, the display only relies
+ * on the pid/tid.
+ */
+static struct processtop *copy_processtop(struct processtop *tmp,
+		unsigned long start, unsigned long end)
+{
+	gint j;
+	unsigned long time;
+	struct processtop *new;
+	struct files *tmpfile, *newfile;
+
+	new = g_new(struct processtop, 1);
+	memcpy(new, tmp, sizeof(struct processtop));
+	get_name(new->comm);
+	new->threads = NULL;
+	new->threadparent = NULL;
+	new->files_history = NULL;
+	new->syscall_pending = 0;
+	new->dirty = 0;
+	new->snapshot = NULL;
+	/* reference held by the live process */
+	new->refcount = 1;
+	new->process_files_table = g_ptr_array_sized_new(
+			tmp->process_files_table->len);
+	copy_perf_values(&new->perf, &tmp->perf, NULL);
+
+	/* compute the stream speed, the last period can be shorter than 1s */
+	if (end - start != 0) {
+		time = end - start;
+		new->fileread = (double) new->fileread * NSEC_PER_SEC / time;
+		new->filewrite = (double) new->filewrite * NSEC_PER_SEC / time;
+	}
+
+	for (j = 0; j < tmp->process_files_table->len; j++) {
+		tmpfile = g_ptr_array_index(tmp->process_files_table, j);
+		if (tmpfile != NULL) {
+			newfile = g_new(struct files, 1);
+			memcpy(newfile, tmpfile, sizeof(struct files));
+			get_name(newfile->name);
+			newfile->ref = new;
+			g_ptr_array_add(new->process_files_table, newfile);
+		} else {
+			g_ptr_array_add(new->process_files_table, NULL);
+		}
+	}
+
+	return new;
+}
+
+/* memory used by a process copy with its files and perf counters */
+unsigned long processtop_copy_mem_size(struct processtop *new)
+{
+	unsigned long size;
+	gint j;
+
+	size = sizeof(struct processtop) + new->perf.len * sizeof(uint64_t) +
+		new->process_files_table->len * sizeof(gpointer);
+	for (j = 0; j < new->process_files_table->len; j++) {
+		if (g_ptr_array_index(new->process_files_table, j))
+			size += sizeof(struct files);
+	}
+
+	return size;
+}
+
+void get_processtop_copy(struct processtop *new)
+{
+	g_atomic_int_inc(&new->refcount);
+}
+
+void put_processtop_copy(struct processtop *new)
+{
+	struct files *file;
+	gint j;
+
+	if (!new || !g_atomic_int_dec_and_test(&new->refcount))
+		return;
+
+	for (j = 0; j < new->process_files_table->len; j++) {
+		file = g_ptr_array_index(new->process_files_table, j);
+		if (file)
+			put_name(file->name);
+		g_free(file);
+	}
+	put_name(new->comm);
+	g_ptr_array_free(new->process_files_table, TRUE);
+	g_free(new->perf.count);
+	g_free(new);
+}
+
+/*
+ * Free a snapshot evicted from the history, the process copies are only
+ * freed when no other snapshot nor live process uses them.
+ */
+void free_lttngtop_snapshot(struct lttngtop *snapshot)
+{
+	struct kprobes *kprobe;
+	gint i;
+
+	for (i = 0; i < snapshot->process_table->len; i++)
+		put_processtop_copy(g_ptr_array_index(snapshot->process_table, i));
+	g_ptr_array_free(snapshot->process_table, TRUE);
+	for (i = 0; i < snapshot->kprobes_table->len; i++) {
+		kprobe = g_ptr_array_index(snapshot->kprobes_table, i);
+		put_name(kprobe->probe_name);
+		put_name(kprobe->symbol_name);
+	}
+	/* the files belong to the process copies */
+	g_ptr_array_free(snapshot->files_table, TRUE);
+	g_ptr_array_free(snapshot->cpu_table, TRUE);
+	g_ptr_array_free(snapshot->kprobes_table, TRUE);
+	g_hash_table_destroy(snapshot->process_hash_table);
+
+	/* the snapshot itself is in the arena */
+	arena_put(snapshot->arena);
+}
+
+/*
+ * Remove a process that died during the last period from the live state,
+ * its last snapshot copy stays valid. The process goes back to the pool,
+ * so nothing in the live state may point to it anymore.
+ */
+static void free_dead_processtop(struct processtop *tmp)
+{
+	gint j;
+	struct files *tmpfile;
+	struct cputime *tmpcpu;
+	struct processtop *thread;
+
+	for (j = 0; j < lttngtop.cpu_table->len; j++) {
+		tmpcpu = g_ptr_array_index(lttngtop.cpu_table, j);
+		if (tmpcpu->current_task == tmp)
+			tmpcpu->current_task = NULL;
+	}
+	if (tmp->threadparent)
+		g_ptr_array_remove_fast(tmp->threadparent->threads, tmp);
+	for (j = 0; j < tmp->threads->len; j++) {
+		thread = g_ptr_array_index(tmp->threads, j);
+		if (thread->threadparent == tmp)
+			thread->threadparent = NULL;
+	}
+	g_ptr_array_set_size(tmp->threads, 0);
+
+	for (j = 0; j < tmp->process_files_table->len; j++) {
+		tmpfile = g_ptr_array_index(tmp->process_files_table, j);
+		/* FIXME : close the files before */
+		free_file(tmpfile);
+	}
+	g_ptr_array_set_size(tmp->process_files_table, 0);
+	free_files_history(tmp);
+	put_processtop_copy(tmp->snapshot);
+	put_name(tmp->comm);
+	pool_free(&processtop_pool, tmp);
+}
+
+/*
+ * Forget the live processes, their files and the counters, to rebuild the
+ * state from another position in the trace. The snapshots keep their
+ * copies.
+ */
+void reset_live_state(void)
+{
+	struct processtop *tmp;
+	struct cputime *tmpcpu;
+	gint i;
+
+	while (lttngtop.process_table->len) {
+		tmp = g_ptr_array_index(lttngtop.process_table,
+				lttngtop.process_table->len - 1);
+		g_ptr_array_remove_index(lttngtop.process_table,
+				lttngtop.process_table->len - 1);
+		free_dead_processtop(tmp);
+	}
+	g_hash_table_remove_all(lttngtop.process_hash_table);
+	for (i = 0; i < lttngtop.cpu_table->len; i++) {
+		tmpcpu = g_ptr_array_index(lttngtop.cpu_table, i);
+		tmpcpu->current_task = NULL;
+		tmpcpu->busy_nsec = 0;
+		/* the last values read would hide the counters until then */
+		if (tmpcpu->perf.len)
+			memset(tmpcpu->perf.count, 0,
+					tmpcpu->perf.len * sizeof(uint64_t));
+	}
+	lttngtop.nbproc = 0;
+	lttngtop.nbthreads = 0;
+	lttngtop.nbfiles = 0;
+	reset_global_counters();
+}
+
+/*
+ * Rebuild the live state from a snapshot, the state at the end of its
+ * period: the processes still alive with their open files and their
+ * totals. The counters of the period restart from 0.
+ */
+void restore_live_state(struct lttngtop *snapshot)
+{
+	struct processtop *proc, *tmp, *parent;
+	struct files *file, *newfile;
+	gint i, j;
+
+	reset_live_state();
+	for (i = 0; i < snapshot->process_table->len; i++) {
+		proc = g_ptr_array_index(snapshot->process_table, i);
+		if (proc->death)
+			continue;
+		tmp = new_processtop();
+		tmp->puuid = proc->puuid;
+		tmp->pid = proc->pid;
+		tmp->comm = get_name(proc->comm);
+		tmp->host = proc->host;
+		tmp->tid = proc->tid;
+		tmp->ppid = proc->ppid;
+		tmp->vpid = proc->vpid;
+		tmp->vtid = proc->vtid;
+		tmp->vppid = proc->vppid;
+		tmp->birth = proc->birth;
+		tmp->totalfileread = proc->totalfileread;
+		tmp->totalfilewrite = proc->totalfilewrite;
+		tmp->dirty = 1;
+		for (j = 0; j < proc->process_files_table->len; j++) {
+			file = g_ptr_array_index(proc->process_files_table, j);
+			newfile = NULL;
+			if (file && file->flag != __NR_close) {
+				newfile = new_file();
+				memcpy(newfile, file, sizeof(struct files));
+				get_name(newfile->name);
+				newfile->ref = tmp;
+				newfile->read = 0;
+				newfile->write = 0;
+			}
+			g_ptr_array_add(tmp->process_files_table, newfile);
+		}
+		g_ptr_array_add(lttngtop.process_table, tmp);
+		g_hash_table_insert(lttngtop.process_hash_table,
+				(gpointer) (unsigned long) tmp->tid, tmp);
+	}
+
+	/* the threads once all the processes are there */
+	for (i = 0; i < lttngtop.process_table->len; i++) {
+		tmp = g_ptr_array_index(lttngtop.process_table, i);
+		if (tmp->pid == tmp->tid)
+			continue;
+		parent = g_hash_table_lookup(lttngtop.process_hash_table,
+				(gpointer) (unsigned long) tmp->pid);
+		if (!parent)
+			continue;
+		tmp->threadparent = parent;
+		add_thread(parent, tmp);
+	}
+	lttngtop.nbproc = snapshot->nbproc;
+	lttngtop.nbthreads = snapshot->nbthreads;
+	lttngtop.nbfiles = snapshot->nbfiles;
+}
+
+static int is_current_task(struct processtop *tmp)
+{
+	struct cputime *tmpcpu;
+	gint i;
+
+	for (i = 0; i < lttngtop.cpu_table->len; i++) {
+		tmpcpu = g_ptr_array_index(lttngtop.cpu_table, i);
+		if (tmpcpu->current_task == tmp)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Start the window of a shard whose state is carried from the previous
+ * one: only the processes running or in a syscall at begin are kept, as
+ * if they were first seen at begin, without their files, and the counters
+ * restart from 0. The parent completes them with the carried state.
+ */
+void restart_live_state(unsigned long begin)
+{
+	struct processtop *tmp;
+	struct files *tmpfile;
+	unsigned int kept = 0;
+	gint i, j;
+
+	for (i = lttngtop.process_table->len - 1; i >= 0; i--) {
+		tmp = g_ptr_array_index(lttngtop.process_table, i);
+		if (g_hash_table_lookup(lttngtop.process_hash_table,
+					(gpointer) (unsigned long) tmp->tid) == tmp &&
+				(tmp->syscall_pending || tmp->files_history ||
+				 is_current_task(tmp))) {
+			for (j = 0; j < tmp->process_files_table->len; j++) {
+				tmpfile = g_ptr_array_index(
+						tmp->process_files_table, j);
+				free_file(tmpfile);
+			}
+			g_ptr_array_set_size(tmp->process_files_table, 0);
+			tmp->birth = begin;
+			tmp->totalfileread = 0;
+			tmp->totalfilewrite = 0;
+			tmp->dirty = 1;
+			kept++;
+			continue;
+		}
+		if (g_hash_table_lookup(lttngtop.process_hash_table,
+					(gpointer) (unsigned long) tmp->tid) == tmp)
+			g_hash_table_remove(lttngtop.process_hash_table,
+					(gpointer) (unsigned long) tmp->tid);
+		g_ptr_array_remove_index(lttngtop.process_table, i);
+		free_dead_processtop(tmp);
+	}
+	reset_global_counters();
+	lttngtop.nbproc = 0;
+	lttngtop.nbfiles = 0;
+	/* the kept processes are counted as new ones, like the parent expects */
+	lttngtop.nbthreads = kept;
+	lttngtop.nbnewthreads = kept;
+}
+
+/*
+ * Processes not modified since their last snapshot copy share it with
+ * the new snapshot instead of being copied again. The snapshot, its cpus
+ * and kprobes are allocated in the arena of the snapshot.
+ */
 struct lttngtop* get_copy_lttngtop(unsigned long start, unsigned long end)
 {
 	gint i, j;
-	unsigned long time;
+	struct arena *arena;
 	struct lttngtop *dst;
-	struct processtop *tmp, *tmp2, *new;
+	struct processtop *tmp, *new;
 	struct cputime *tmpcpu, *newcpu;
-	struct files *tmpfile, *newfile;
 	struct kprobes *tmpprobe, *newprobe;
 
-	dst = g_new0(struct lttngtop, 1);
+	/* reference held by the snapshot */
+	arena = arena_new();
+	dst = arena_new0(arena, struct lttngtop);
+	dst->arena = arena;
 	dst->start = start;
 	dst->end = end;
 	copy_global_counters(dst);
-	dst->process_table = g_ptr_array_new();
+	dst->process_table = g_ptr_array_sized_new(lttngtop.process_table->len);
 	dst->files_table = g_ptr_array_new();
 	dst->cpu_table = g_ptr_array_new();
 	dst->kprobes_table = g_ptr_array_new();
 	dst->process_hash_table = g_hash_table_new(g_direct_hash, g_direct_equal);
-	g_hash_table_foreach(lttngtop.process_hash_table, copy_process_table,
-			dst->process_hash_table);
 
 	rotate_cputime(end);
 
 	for (i = 0; i < lttngtop.process_table->len; i++) {
 		tmp = g_ptr_array_index(lttngtop.process_table, i);
-		new = g_new0(struct processtop, 1);
-
-		memcpy(new, tmp, sizeof(struct processtop));
-		new->threads = g_ptr_array_new();
-		new->comm = strdup(tmp->comm);
-		new->process_files_table = g_ptr_array_new();
-		new->files_history = tmp->files_history;
-		new->perf = g_hash_table_new(g_str_hash, g_str_equal);
-		g_hash_table_foreach(tmp->perf, copy_perf_counter, new->perf);
-
-		/* compute the stream speed */
-		if (end - start != 0) {
-			time = (end - start) / NSEC_PER_SEC;
-			new->fileread = new->fileread/(time);
-			new->filewrite = new->filewrite/(time);
+		if (tmp->dirty || !tmp->snapshot) {
+			put_processtop_copy(tmp->snapshot);
+			tmp->snapshot = copy_processtop(tmp, start, end);
+			tmp->dirty = 0;
 		}
+		new = tmp->snapshot;
+		/*
+		 * A shared copy can outlive the snapshot that made it, it is
+		 * counted in every snapshot using it.
+		 */
+		dst->mem_size += processtop_copy_mem_size(new);
+		/* reference held by the snapshot */
+		get_processtop_copy(new);
 
-		for (j = 0; j < tmp->process_files_table->len; j++) {
-			tmpfile = g_ptr_array_index(tmp->process_files_table, j);
-
-			newfile = malloc(sizeof(struct files));
-
-			if (tmpfile != NULL) {
-				memcpy(newfile, tmpfile, sizeof(struct files));
-				if (tmpfile->name)
-					newfile->name = strdup(tmpfile->name);
-				else
-					newfile->name = NULL;
-				newfile->ref = new;
-				g_ptr_array_add(new->process_files_table,
-						newfile);
-				g_ptr_array_add(dst->files_table, newfile);
-			} else {
-				g_ptr_array_add(new->process_files_table, NULL);
-				g_ptr_array_add(dst->files_table, NULL);
-			}
-			/*
-			 * if the process died during the last period, we remove all
-			 * files associated with if after the copy
-			 */
-			if (tmp->death > 0 && tmp->death < end) {
-				/* FIXME : close the files before */
-				g_ptr_array_remove(tmp->process_files_table, tmpfile);
-				g_free(tmpfile);
-			}
-		}
+		/*
+		 * The snapshot index points to the copies so the snapshot
+		 * stays valid after the live process is freed.
+		 */
+		if (g_hash_table_lookup(lttngtop.process_hash_table,
+					(gpointer) (unsigned long) tmp->tid) == tmp)
+			g_hash_table_insert(dst->process_hash_table,
+					(gpointer) (unsigned long) tmp->tid, new);
+
+		for (j = 0; j < new->process_files_table->len; j++)
+			g_ptr_array_add(dst->files_table,
+					g_ptr_array_index(new->process_files_table, j));
 		g_ptr_array_add(dst->process_table, new);
 
 		/*
@@ -531,24 +1097,19 @@ struct lttngtop* get_copy_lttngtop(unsigned long start, unsigned long end)
 		 * the current process list after the copy
 		 */
 		if (tmp->death > 0 && tmp->death < end) {
-			g_ptr_array_remove(lttngtop.process_table, tmp);
-			/* FIXME : TRUE does not mean clears the object in it */
-			g_ptr_array_free(tmp->threads, TRUE);
-			free(tmp->comm);
-			g_ptr_array_free(tmp->process_files_table, TRUE);
-			/* FIXME : clear elements */
-			g_hash_table_destroy(tmp->perf);
-			g_free(tmp);
+			g_ptr_array_remove_index(lttngtop.process_table, i);
+			free_dead_processtop(tmp);
+			i--;
 		}
 	}
 	rotate_perfcounter();
 
 	for (i = 0; i < lttngtop.cpu_table->len; i++) {
 		tmpcpu = g_ptr_array_index(lttngtop.cpu_table, i);
-		newcpu = g_new0(struct cputime, 1);
+		newcpu = arena_new0(arena, struct cputime);
 		memcpy(newcpu, tmpcpu, sizeof(struct cputime));
-		newcpu->perf = g_hash_table_new(g_str_hash, g_str_equal);
-		g_hash_table_foreach(tmpcpu->perf, copy_perf_counter, newcpu->perf);
+		copy_perf_values(&newcpu->perf, &tmpcpu->perf, arena);
+		tmpcpu->busy_nsec = 0;
 		/*
 		 * note : we don't care about the current process pointer in the copy
 		 * so the reference is invalid after the memcpy
@@ -558,26 +1119,20 @@ struct lttngtop* get_copy_lttngtop(unsigned long start, unsigned long end)
 	if (lttngtop.kprobes_table) {
 		for (i = 0; i < lttngtop.kprobes_table->len; i++) {
 			tmpprobe = g_ptr_array_index(lttngtop.kprobes_table, i);
-			newprobe = g_new0(struct kprobes, 1);
+			newprobe = arena_new0(arena, struct kprobes);
 			memcpy(newprobe, tmpprobe, sizeof(struct kprobes));
+			newprobe->probe_name = intern_name(tmpprobe->probe_name);
+			newprobe->symbol_name = intern_name(tmpprobe->symbol_name);
 			tmpprobe->count = 0;
 			g_ptr_array_add(dst->kprobes_table, newprobe);
 		}
 	}
-	/* FIXME : better algo */
-	/* create the threads index if required */
-	for (i = 0; i < dst->process_table->len; i++) {
-		tmp = g_ptr_array_index(dst->process_table, i);
-		if (tmp->pid == tmp->tid) {
-			for (j = 0; j < dst->process_table->len; j++) {
-				tmp2 = g_ptr_array_index(dst->process_table, j);
-				if (tmp2->pid == tmp->pid) {
-					tmp2->threadparent = tmp;
-					g_ptr_array_add(tmp->threads, tmp2);
-				}
-			}
-		}
-	}
+
+	dst->mem_size += arena_mem_size(arena) +
+		(dst->process_table->len + dst->files_table->len) *
+		sizeof(gpointer) +
+		g_hash_table_size(dst->process_hash_table) *
+		3 * sizeof(gpointer);
 
 	//  update_global_stats(dst);
 	cleanup_processtop();
@@ -589,59 +1144,48 @@ struct lttngtop* get_copy_lttngtop(unsigned long start, unsigned long end)
 enum bt_cb_ret handle_statedump_process_state(struct bt_ctf_event *call_data,
 		void *private_data)
 {
-	const struct bt_definition *scope;
 	struct processtop *proc;
 	unsigned long timestamp;
 	int64_t pid, tid, ppid, vtid, vpid, vppid;
 	char *procname = NULL, *hostname = NULL;
 
-	timestamp = bt_ctf_get_timestamp(call_data);
+	timestamp = get_event_timestamp(call_data);
 	if (timestamp == -1ULL)
 		goto error;
 
-	scope = bt_ctf_get_top_level_scope(call_data,
-			 BT_EVENT_FIELDS);
-	pid = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-			     scope, "_pid"));
-	if (bt_ctf_field_get_error()) {
+	pid = get_field_int64(call_data, FIELD_PID);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing pid context info\n");
 		goto error;
 	}
-	ppid = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-				scope, "_ppid"));
-	if (bt_ctf_field_get_error()) {
+	ppid = get_field_int64(call_data, FIELD_PPID);
+	if (get_field_error()) {
 		goto end;
 	}
-	tid = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-				scope, "_tid"));
-	if (bt_ctf_field_get_error()) {
+	tid = get_field_int64(call_data, FIELD_TID);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing tid context info\n");
 		goto error;
 	}
-	vtid = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-				scope, "_vtid"));
-	if (bt_ctf_field_get_error()) {
+	vtid = get_field_int64(call_data, FIELD_VTID);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing vtid context info\n");
 		goto error;
 	}
-	vpid = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-				scope, "_vpid"));
-	if (bt_ctf_field_get_error()) {
+	vpid = get_field_int64(call_data, FIELD_VPID);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing vpid context info\n");
 		goto error;
 	}
-	vppid = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-				scope, "_vppid"));
-	if (bt_ctf_field_get_error()) {
+	vppid = get_field_int64(call_data, FIELD_VPPID);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing vppid context info\n");
 		goto error;
 	}
 
-	scope = bt_ctf_get_top_level_scope(call_data,
-			BT_EVENT_FIELDS);
-	procname = bt_ctf_get_char_array(bt_ctf_get_field(call_data,
-				scope, "_name"));
-	if (bt_ctf_field_get_error()) {
+	procname = get_field_char_array(call_data,
+				FIELD_NAME);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing process name context info\n");
 		goto error;
 	}
@@ -652,9 +1196,9 @@ enum bt_cb_ret handle_statedump_process_state(struct bt_ctf_event *call_data,
 	update_proc(proc, pid, tid, ppid, vpid, vtid, vppid, procname, hostname);
 
 	if (proc) {
-		free(proc->comm);
-		proc->comm = strdup(procname);
+		set_name(&proc->comm, procname);
 		proc->pid = pid;
+		proc->dirty = 1;
 	}
 
 end:
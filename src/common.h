@@ -26,9 +26,8 @@
 #define NSEC_PER_USEC 1000
 #define NSEC_PER_SEC 1000000000L
 
-sem_t goodtodisplay, goodtoupdate, timer, pause_sem, end_trace_sem, bootstrap;
+sem_t goodtoupdate, timer, end_trace_sem;
 
-GPtrArray *copies; /* struct lttngtop */
 GHashTable *global_perf_liszt;
 GHashTable *global_filter_list;
 GHashTable *global_host_list;
@@ -48,9 +47,24 @@ GHashTable *tid_filter_list;
 
 int remote_live;
 
+/*
+ * Set in the shard workers after the first: the state at the beginning of
+ * the window is carried from the previous shard by the parent, the worker
+ * keeps what the events of its window tell about the processes and files
+ * it does not know for the parent to complete them.
+ */
+int carried_state;
+
 int toggle_filter;
 
 extern int quit;
+/* timestamp of the last event processed */
+extern unsigned long last_event_ts;
+/*
+ * Restart the analysis of an offline trace at a time in the format of
+ * --begin-time, -1 if the time is invalid or the analysis cannot seek.
+ */
+int request_jump(const char *time);
 
 struct lttngtop *data;
 
@@ -69,15 +83,61 @@ struct processtop *get_proc_pid(struct lttngtop *ctx, int tid, int pid,
 
 void death_proc(struct lttngtop *ctx, int tid, char *comm,
 		unsigned long timestamp);
+void init_cpu_table(unsigned int nr_cpus);
 struct cputime* add_cpu(int cpu);
 struct cputime* get_cpu(int cpu);
 struct lttngtop* get_copy_lttngtop(unsigned long start, unsigned long end);
-struct perfcounter *add_perf_counter(GPtrArray *perf, GQuark quark,
-		unsigned long count);
-struct perfcounter *get_perf_counter(const char *name, struct processtop *proc,
-		struct cputime *cpu);
+void free_lttngtop_snapshot(struct lttngtop *snapshot);
+void reset_live_state(void);
+void restore_live_state(struct lttngtop *snapshot);
+void restart_live_state(unsigned long begin);
+void get_processtop_copy(struct processtop *new);
+void put_processtop_copy(struct processtop *new);
+unsigned long processtop_copy_mem_size(struct processtop *new);
+char *intern_name(const char *name);
+char *get_name(char *name);
+void put_name(char *name);
+void set_name(char **dst, const char *name);
+struct perfcounter *register_perf_counter(const char *name);
+int lookup_perf_slot(const char *name);
+uint64_t get_perf_value(const struct perf_values *perf, unsigned int slot);
+uint64_t *get_perf_value_ptr(struct perf_values *perf, unsigned int slot);
 void reset_global_counters(void);
 
+/*
+ * Context fields of the current event, -1ULL or NULL when the
+ * field is not in the trace.
+ */
+struct ctf_event_definition;
+
+/* where an event starts in its stream */
+struct event_position {
+	const struct ctf_stream_definition *stream;
+	uint64_t packet;
+	off_t mmap_offset;
+	const void *base;
+	int64_t offset;
+};
+
+struct event_context {
+	struct event_position position;
+	uint64_t timestamp;
+	uint64_t cpu_id;
+	uint64_t pid;
+	uint64_t tid;
+	uint64_t ppid;
+	uint64_t vpid;
+	uint64_t vtid;
+	uint64_t vppid;
+	char *comm;
+	char *hostname;
+};
+
+const struct event_context *decode_event_context(
+		const struct bt_ctf_event *event);
+const struct event_context *get_event_context(
+		const struct bt_ctf_event *event);
+
 /* common field access functions */
 uint64_t get_cpu_id(const struct bt_ctf_event *event);
 uint64_t get_context_tid(const struct bt_ctf_event *event);
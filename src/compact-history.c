@@ -0,0 +1,1325 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <glib.h>
+
+#include "common.h"
+#include "arena.h"
+#include "compact-history.h"
+
+/* values stored in the rows instead of pointers, index 0 is NULL */
+struct compact_dict {
+	GHashTable *ids;	/* pointer -> index */
+	GPtrArray *values;	/* index -> pointer */
+};
+
+/*
+ * A new generation of dictionaries starts at each keyframe, the entries
+ * only used by the older snapshots are released with them.
+ */
+struct compact_dicts {
+	/* references from the encoder and the compact snapshots */
+	int refcount;
+	struct compact_dict strings, hosts;
+};
+
+/* generation used by the encoder */
+static struct compact_dicts *dicts;
+/*
+ * The snapshots are decoded while the encoder adds entries, the values
+ * are appended and read under dict_lock.
+ */
+static pthread_mutex_t dict_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Last encoded state of each process, used to only encode the processes
+ * changed since the previous snapshot.
+ */
+struct compact_state {
+	struct compact_key key;
+	struct processtop *copy;	/* reference held */
+	struct compact_row *row;	/* values last encoded */
+	unsigned int generation;
+};
+
+/* struct compact_key -> struct compact_state */
+static GHashTable *compact_states;
+static unsigned int compact_generation;
+
+struct compact_reader {
+	const guchar *p;
+	const guchar *end;
+	/* index -> value of the dictionaries used by the encoder */
+	GPtrArray *strings;
+	GPtrArray *hosts;
+	/* the dictionaries are the ones of the encoder */
+	int shared;
+};
+
+/*
+ * Dictionary entries of the encoding process, rebuilt by the importer: a
+ * snapshot is exported with the entries added since the previous export.
+ */
+struct snapshot_import {
+	GPtrArray *strings;
+	GPtrArray *hosts;
+};
+
+static guint exported_strings, exported_hosts;
+
+static guint compact_key_hash(gconstpointer key)
+{
+	const struct compact_key *k = key;
+
+	return (guint) k->tid ^ (guint) k->birth;
+}
+
+static gboolean compact_key_equal(gconstpointer a, gconstpointer b)
+{
+	const struct compact_key *ka = a, *kb = b;
+
+	return ka->tid == kb->tid && ka->birth == kb->birth;
+}
+
+static guint dict_put(struct compact_dict *dict, gpointer value)
+{
+	gpointer id;
+
+	if (!value)
+		return 0;
+	id = g_hash_table_lookup(dict->ids, value);
+	if (id)
+		return GPOINTER_TO_UINT(id);
+
+	pthread_mutex_lock(&dict_lock);
+	g_ptr_array_add(dict->values, value);
+	pthread_mutex_unlock(&dict_lock);
+	g_hash_table_insert(dict->ids, value,
+			GUINT_TO_POINTER(dict->values->len - 1));
+
+	return dict->values->len - 1;
+}
+
+static void init_dict(struct compact_dict *dict)
+{
+	dict->ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+	dict->values = g_ptr_array_new();
+	g_ptr_array_add(dict->values, NULL);
+}
+
+static void fini_dict(struct compact_dict *dict)
+{
+	g_hash_table_destroy(dict->ids);
+	g_ptr_array_free(dict->values, TRUE);
+}
+
+static struct compact_dicts *new_dicts(void)
+{
+	struct compact_dicts *new;
+
+	new = g_new0(struct compact_dicts, 1);
+	new->refcount = 1;
+	init_dict(&new->strings);
+	init_dict(&new->hosts);
+
+	return new;
+}
+
+static struct compact_dicts *get_dicts(struct compact_dicts *d)
+{
+	g_atomic_int_inc(&d->refcount);
+	return d;
+}
+
+/* the last reference can be dropped by a decoder */
+static void put_dicts(struct compact_dicts *d)
+{
+	guint i;
+
+	if (!d || !g_atomic_int_dec_and_test(&d->refcount))
+		return;
+	for (i = 0; i < d->strings.values->len; i++)
+		put_name(g_ptr_array_index(d->strings.values, i));
+	fini_dict(&d->strings);
+	fini_dict(&d->hosts);
+	g_free(d);
+}
+
+/* the generation of the encoder, created by the first snapshot */
+static struct compact_dicts *encoder_dicts(void)
+{
+	if (!dicts)
+		dicts = new_dicts();
+	return dicts;
+}
+
+static gpointer dict_get(struct compact_reader *r, GPtrArray *values,
+		guint64 id)
+{
+	gpointer value = NULL;
+
+	if (r->shared)
+		pthread_mutex_lock(&dict_lock);
+	if (id && values && id < values->len)
+		value = g_ptr_array_index(values, id);
+	if (r->shared)
+		pthread_mutex_unlock(&dict_lock);
+
+	return value;
+}
+
+static void put_uint(GByteArray *buf, guint64 value)
+{
+	guint8 byte;
+
+	do {
+		byte = value & 0x7f;
+		value >>= 7;
+		if (value)
+			byte |= 0x80;
+		g_byte_array_append(buf, &byte, 1);
+	} while (value);
+}
+
+/* zigzag encoding so small negative values stay small */
+static void put_int(GByteArray *buf, gint64 value)
+{
+	put_uint(buf, ((guint64) value << 1) ^ (guint64) (value >> 63));
+}
+
+/* the names are interned, the dictionary holds a reference on its entries */
+static guint string_id(char *str)
+{
+	guint len, id;
+
+	len = dicts->strings.values->len;
+	id = dict_put(&dicts->strings, str);
+	if (dicts->strings.values->len != len)
+		get_name(str);
+
+	return id;
+}
+
+static void put_string(GByteArray *buf, char *str)
+{
+	put_uint(buf, string_id(str));
+}
+
+static guint64 get_uint(struct compact_reader *r)
+{
+	guint64 value = 0;
+	unsigned int shift = 0;
+	guint8 byte;
+
+	do {
+		if (r->p >= r->end)
+			return value;
+		byte = *r->p++;
+		value |= (guint64) (byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	return value;
+}
+
+static gint64 get_int(struct compact_reader *r)
+{
+	guint64 value = get_uint(r);
+
+	return (gint64) (value >> 1) ^ -(gint64) (value & 1);
+}
+
+/* the decoded name holds its own reference */
+static char *get_string(struct compact_reader *r)
+{
+	return get_name(dict_get(r, r->strings, get_uint(r)));
+}
+
+/* the trailing counters never set are not kept */
+static void put_perf(GByteArray *buf, const struct perf_values *perf)
+{
+	unsigned int i, len;
+
+	len = perf->len;
+	while (len > 0 && perf->count[len - 1] == 0)
+		len--;
+	put_uint(buf, len);
+	for (i = 0; i < len; i++)
+		put_uint(buf, perf->count[i]);
+}
+
+/* the counters are allocated in the arena, or on the heap without arena */
+static void get_perf(struct compact_reader *r, struct arena *arena,
+		struct perf_values *perf)
+{
+	unsigned int i;
+
+	perf->len = get_uint(r);
+	perf->count = NULL;
+	if (!perf->len)
+		return;
+	if (arena)
+		perf->count = arena_alloc(arena, perf->len * sizeof(uint64_t));
+	else
+		perf->count = g_new(uint64_t, perf->len);
+	for (i = 0; i < perf->len; i++)
+		perf->count[i] = get_uint(r);
+}
+
+static void put_file(GByteArray *buf, struct files *file)
+{
+	put_uint(buf, file->fuuid);
+	put_int(buf, file->fd);
+	put_string(buf, file->name);
+	put_int(buf, file->oldfd);
+	put_int(buf, file->device);
+	put_int(buf, file->openmode);
+	put_int(buf, file->flag);
+	put_uint(buf, file->openedat);
+	put_uint(buf, file->closedat);
+	put_uint(buf, file->lastaccess);
+	put_uint(buf, file->read);
+	put_uint(buf, file->write);
+	put_uint(buf, file->nbpoll);
+	put_uint(buf, file->nbselect);
+	put_uint(buf, file->nbopen);
+	put_uint(buf, file->nbclose);
+}
+
+static struct files *get_file(struct compact_reader *r,
+		struct processtop *proc)
+{
+	struct files *file;
+
+	file = g_new0(struct files, 1);
+	file->ref = proc;
+	file->fuuid = get_uint(r);
+	file->fd = get_int(r);
+	file->name = get_string(r);
+	file->oldfd = get_int(r);
+	file->device = get_int(r);
+	file->openmode = get_int(r);
+	file->flag = get_int(r);
+	file->openedat = get_uint(r);
+	file->closedat = get_uint(r);
+	file->lastaccess = get_uint(r);
+	file->read = get_uint(r);
+	file->write = get_uint(r);
+	file->nbpoll = get_uint(r);
+	file->nbselect = get_uint(r);
+	file->nbopen = get_uint(r);
+	file->nbclose = get_uint(r);
+
+	return file;
+}
+
+/*
+ * A process exported by export_snapshot(), the key (tid and birth)
+ * precedes it, the times are relative to the birth of the process.
+ */
+static void put_process(GByteArray *buf, struct processtop *proc)
+{
+	struct files *file;
+	gint i;
+
+	put_uint(buf, proc->puuid);
+	put_int(buf, proc->pid - proc->tid);
+	put_string(buf, proc->comm);
+	put_uint(buf, dict_put(&dicts->hosts, proc->host));
+	put_int(buf, proc->ppid);
+	put_int(buf, proc->vpid);
+	put_int(buf, proc->vtid);
+	put_int(buf, proc->vppid);
+	put_uint(buf, proc->death ? proc->death - proc->birth + 1 : 0);
+	put_uint(buf, proc->totalfileread);
+	put_uint(buf, proc->totalfilewrite);
+	put_uint(buf, proc->fileread);
+	put_uint(buf, proc->filewrite);
+	put_uint(buf, proc->totalcpunsec);
+	put_uint(buf, proc->threadstotalcpunsec);
+	put_perf(buf, &proc->perf);
+
+	put_uint(buf, proc->process_files_table->len);
+	for (i = 0; i < proc->process_files_table->len; i++) {
+		file = g_ptr_array_index(proc->process_files_table, i);
+		put_uint(buf, file != NULL);
+		if (file)
+			put_file(buf, file);
+	}
+}
+
+static struct processtop *read_process(struct compact_reader *r,
+		const struct compact_key *key)
+{
+	struct processtop *proc;
+	guint64 i, len, death;
+
+	proc = g_new0(struct processtop, 1);
+	proc->refcount = 1;
+	proc->tid = key->tid;
+	proc->birth = key->birth;
+	proc->puuid = get_uint(r);
+	proc->pid = proc->tid + get_int(r);
+	proc->comm = get_string(r);
+	proc->host = dict_get(r, r->hosts, get_uint(r));
+	proc->ppid = get_int(r);
+	proc->vpid = get_int(r);
+	proc->vtid = get_int(r);
+	proc->vppid = get_int(r);
+	death = get_uint(r);
+	proc->death = death ? proc->birth + death - 1 : 0;
+	proc->totalfileread = get_uint(r);
+	proc->totalfilewrite = get_uint(r);
+	proc->fileread = get_uint(r);
+	proc->filewrite = get_uint(r);
+	proc->totalcpunsec = get_uint(r);
+	proc->threadstotalcpunsec = get_uint(r);
+	get_perf(r, NULL, &proc->perf);
+
+	len = get_uint(r);
+	proc->process_files_table = g_ptr_array_sized_new(len);
+	for (i = 0; i < len; i++) {
+		if (get_uint(r))
+			g_ptr_array_add(proc->process_files_table,
+					get_file(r, proc));
+		else
+			g_ptr_array_add(proc->process_files_table, NULL);
+	}
+
+	return proc;
+}
+
+/*
+ * The compact snapshots store the processes by column: a column has the
+ * values of one field for all the processes encoded, each one as the
+ * difference with the value of the same process in the previous
+ * snapshot. The counters and the fields that did not change are encoded
+ * on one byte. A row holds the values of a process in the order of the
+ * columns: the process columns, its perf counters, then the file columns
+ * of each slot of its files table.
+ */
+enum process_column {
+	PROC_PUUID,
+	PROC_PID,
+	PROC_COMM,
+	PROC_HOST,
+	PROC_PPID,
+	PROC_VPID,
+	PROC_VTID,
+	PROC_VPPID,
+	/* relative to the birth, 0 while alive */
+	PROC_DEATH,
+	PROC_TOTALFILEREAD,
+	PROC_TOTALFILEWRITE,
+	PROC_FILEREAD,
+	PROC_FILEWRITE,
+	PROC_TOTALCPUNSEC,
+	PROC_THREADSTOTALCPUNSEC,
+	PROC_NR_PERF,
+	PROC_NR_FILES,
+	NR_PROCESS_COLUMNS,
+};
+
+enum file_column {
+	/* the other columns only have the slots used */
+	FILE_PRESENT,
+	FILE_FUUID,
+	FILE_FD,
+	FILE_NAME,
+	FILE_OLDFD,
+	FILE_DEVICE,
+	FILE_OPENMODE,
+	FILE_FLAG,
+	FILE_OPENEDAT,
+	FILE_CLOSEDAT,
+	FILE_LASTACCESS,
+	FILE_READ,
+	FILE_WRITE,
+	FILE_NBPOLL,
+	FILE_NBSELECT,
+	FILE_NBOPEN,
+	FILE_NBCLOSE,
+	NR_FILE_COLUMNS,
+};
+
+/* the signed fields are stored sign-extended */
+struct compact_row {
+	struct compact_key key;
+	guint len;
+	guint64 values[];
+};
+
+static struct compact_row *new_row(const struct compact_key *key,
+		guint64 nr_perf, guint64 nr_files)
+{
+	struct compact_row *row;
+	guint len;
+
+	len = NR_PROCESS_COLUMNS + nr_perf + nr_files * NR_FILE_COLUMNS;
+	row = g_malloc0(sizeof(struct compact_row) + len * sizeof(guint64));
+	row->key = *key;
+	row->len = len;
+	row->values[PROC_NR_PERF] = nr_perf;
+	row->values[PROC_NR_FILES] = nr_files;
+
+	return row;
+}
+
+static int same_row(struct compact_row *a, struct compact_row *b)
+{
+	return a->len == b->len && memcmp(a->values, b->values,
+			a->len * sizeof(guint64)) == 0;
+}
+
+static guint64 *row_perf(struct compact_row *row)
+{
+	return row->values + NR_PROCESS_COLUMNS;
+}
+
+static guint64 *row_slot(struct compact_row *row, guint64 i)
+{
+	return row->values + NR_PROCESS_COLUMNS + row->values[PROC_NR_PERF] +
+		i * NR_FILE_COLUMNS;
+}
+
+/* the values a file is encoded against, NULL for a new file */
+static guint64 *prev_slot(struct compact_row *prev, guint64 i)
+{
+	guint64 *slot;
+
+	if (!prev || i >= prev->values[PROC_NR_FILES])
+		return NULL;
+	slot = row_slot(prev, i);
+
+	return slot[FILE_PRESENT] ? slot : NULL;
+}
+
+static guint64 *prev_perf(struct compact_row *prev, guint64 i)
+{
+	if (!prev || i >= prev->values[PROC_NR_PERF])
+		return NULL;
+	return row_perf(prev);
+}
+
+/* the strings of the row are added to the dictionaries of the encoder */
+static struct compact_row *process_row(struct processtop *proc)
+{
+	struct compact_key key = { proc->tid, proc->birth };
+	struct compact_row *row;
+	struct files *file;
+	guint64 *v, *slot;
+	unsigned int nr_perf;
+	gint i;
+
+	nr_perf = proc->perf.len;
+	while (nr_perf > 0 && proc->perf.count[nr_perf - 1] == 0)
+		nr_perf--;
+	row = new_row(&key, nr_perf, proc->process_files_table->len);
+
+	v = row->values;
+	v[PROC_PUUID] = proc->puuid;
+	v[PROC_PID] = (gint64) proc->pid;
+	v[PROC_COMM] = string_id(proc->comm);
+	v[PROC_HOST] = dict_put(&dicts->hosts, proc->host);
+	v[PROC_PPID] = (gint64) proc->ppid;
+	v[PROC_VPID] = (gint64) proc->vpid;
+	v[PROC_VTID] = (gint64) proc->vtid;
+	v[PROC_VPPID] = (gint64) proc->vppid;
+	v[PROC_DEATH] = proc->death ? proc->death - proc->birth + 1 : 0;
+	v[PROC_TOTALFILEREAD] = proc->totalfileread;
+	v[PROC_TOTALFILEWRITE] = proc->totalfilewrite;
+	v[PROC_FILEREAD] = proc->fileread;
+	v[PROC_FILEWRITE] = proc->filewrite;
+	v[PROC_TOTALCPUNSEC] = proc->totalcpunsec;
+	v[PROC_THREADSTOTALCPUNSEC] = proc->threadstotalcpunsec;
+	for (i = 0; i < nr_perf; i++)
+		row_perf(row)[i] = proc->perf.count[i];
+
+	for (i = 0; i < proc->process_files_table->len; i++) {
+		file = g_ptr_array_index(proc->process_files_table, i);
+		if (!file)
+			continue;
+		slot = row_slot(row, i);
+		slot[FILE_PRESENT] = 1;
+		slot[FILE_FUUID] = file->fuuid;
+		slot[FILE_FD] = (gint64) file->fd;
+		slot[FILE_NAME] = string_id(file->name);
+		slot[FILE_OLDFD] = (gint64) file->oldfd;
+		slot[FILE_DEVICE] = (gint64) file->device;
+		slot[FILE_OPENMODE] = (gint64) file->openmode;
+		slot[FILE_FLAG] = (gint64) file->flag;
+		slot[FILE_OPENEDAT] = file->openedat;
+		slot[FILE_CLOSEDAT] = file->closedat;
+		slot[FILE_LASTACCESS] = file->lastaccess;
+		slot[FILE_READ] = file->read;
+		slot[FILE_WRITE] = file->write;
+		slot[FILE_NBPOLL] = file->nbpoll;
+		slot[FILE_NBSELECT] = file->nbselect;
+		slot[FILE_NBOPEN] = file->nbopen;
+		slot[FILE_NBCLOSE] = file->nbclose;
+	}
+
+	return row;
+}
+
+static struct processtop *row_process(struct compact_row *row,
+		struct compact_dicts *d)
+{
+	struct compact_reader r = {
+		.strings = d->strings.values,
+		.hosts = d->hosts.values,
+		.shared = 1,
+	};
+	struct processtop *proc;
+	struct files *file;
+	guint64 *v, *slot, i;
+
+	v = row->values;
+	proc = g_new0(struct processtop, 1);
+	proc->refcount = 1;
+	proc->tid = row->key.tid;
+	proc->birth = row->key.birth;
+	proc->puuid = v[PROC_PUUID];
+	proc->pid = (gint64) v[PROC_PID];
+	proc->comm = get_name(dict_get(&r, r.strings, v[PROC_COMM]));
+	proc->host = dict_get(&r, r.hosts, v[PROC_HOST]);
+	proc->ppid = (gint64) v[PROC_PPID];
+	proc->vpid = (gint64) v[PROC_VPID];
+	proc->vtid = (gint64) v[PROC_VTID];
+	proc->vppid = (gint64) v[PROC_VPPID];
+	proc->death = v[PROC_DEATH] ? proc->birth + v[PROC_DEATH] - 1 : 0;
+	proc->totalfileread = v[PROC_TOTALFILEREAD];
+	proc->totalfilewrite = v[PROC_TOTALFILEWRITE];
+	proc->fileread = v[PROC_FILEREAD];
+	proc->filewrite = v[PROC_FILEWRITE];
+	proc->totalcpunsec = v[PROC_TOTALCPUNSEC];
+	proc->threadstotalcpunsec = v[PROC_THREADSTOTALCPUNSEC];
+	proc->perf.len = v[PROC_NR_PERF];
+	if (proc->perf.len) {
+		proc->perf.count = g_new(uint64_t, proc->perf.len);
+		for (i = 0; i < proc->perf.len; i++)
+			proc->perf.count[i] = row_perf(row)[i];
+	}
+
+	proc->process_files_table = g_ptr_array_sized_new(v[PROC_NR_FILES]);
+	for (i = 0; i < v[PROC_NR_FILES]; i++) {
+		slot = row_slot(row, i);
+		if (!slot[FILE_PRESENT]) {
+			g_ptr_array_add(proc->process_files_table, NULL);
+			continue;
+		}
+		file = g_new0(struct files, 1);
+		file->ref = proc;
+		file->fuuid = slot[FILE_FUUID];
+		file->fd = (gint64) slot[FILE_FD];
+		file->name = get_name(dict_get(&r, r.strings, slot[FILE_NAME]));
+		file->oldfd = (gint64) slot[FILE_OLDFD];
+		file->device = (gint64) slot[FILE_DEVICE];
+		file->openmode = (gint64) slot[FILE_OPENMODE];
+		file->flag = (gint64) slot[FILE_FLAG];
+		file->openedat = slot[FILE_OPENEDAT];
+		file->closedat = slot[FILE_CLOSEDAT];
+		file->lastaccess = slot[FILE_LASTACCESS];
+		file->read = slot[FILE_READ];
+		file->write = slot[FILE_WRITE];
+		file->nbpoll = slot[FILE_NBPOLL];
+		file->nbselect = slot[FILE_NBSELECT];
+		file->nbopen = slot[FILE_NBOPEN];
+		file->nbclose = slot[FILE_NBCLOSE];
+		g_ptr_array_add(proc->process_files_table, file);
+	}
+
+	return proc;
+}
+
+/* difference with the previous value of the cell, 0 without previous */
+static void put_delta(GByteArray *buf, guint64 value, const guint64 *prev,
+		guint64 column)
+{
+	put_int(buf, (gint64) (value - (prev ? prev[column] : 0)));
+}
+
+static guint64 get_delta(struct compact_reader *r, const guint64 *prev,
+		guint64 column)
+{
+	return (prev ? prev[column] : 0) + (guint64) get_int(r);
+}
+
+/*
+ * Encode the keys and the columns of rows, each row against the one at
+ * the same index in prevs (NULL or without prevs for the new processes).
+ */
+static void put_columns(GByteArray *buf, GPtrArray *rows, GPtrArray *prevs)
+{
+	struct compact_row *row, *prev;
+	struct compact_key last = { 0, 0 };
+	guint64 *slot, i;
+	gint c, k;
+
+	put_uint(buf, rows->len);
+	for (k = 0; k < rows->len; k++) {
+		row = g_ptr_array_index(rows, k);
+		put_int(buf, row->key.tid - last.tid);
+		put_int(buf, (gint64) (row->key.birth - last.birth));
+		last = row->key;
+	}
+
+	for (c = 0; c < NR_PROCESS_COLUMNS; c++) {
+		for (k = 0; k < rows->len; k++) {
+			row = g_ptr_array_index(rows, k);
+			prev = prevs ? g_ptr_array_index(prevs, k) : NULL;
+			put_delta(buf, row->values[c],
+					prev ? prev->values : NULL, c);
+		}
+	}
+
+	for (k = 0; k < rows->len; k++) {
+		row = g_ptr_array_index(rows, k);
+		prev = prevs ? g_ptr_array_index(prevs, k) : NULL;
+		for (i = 0; i < row->values[PROC_NR_PERF]; i++)
+			put_delta(buf, row_perf(row)[i], prev_perf(prev, i), i);
+	}
+
+	/* FILE_PRESENT first, the decoder needs it for the other columns */
+	for (c = 0; c < NR_FILE_COLUMNS; c++) {
+		for (k = 0; k < rows->len; k++) {
+			row = g_ptr_array_index(rows, k);
+			prev = prevs ? g_ptr_array_index(prevs, k) : NULL;
+			for (i = 0; i < row->values[PROC_NR_FILES]; i++) {
+				slot = row_slot(row, i);
+				if (c != FILE_PRESENT && !slot[FILE_PRESENT])
+					continue;
+				put_delta(buf, slot[c], prev_slot(prev, i), c);
+			}
+		}
+	}
+}
+
+/*
+ * Decode the rows encoded by put_columns() against the ones of state
+ * (struct compact_key -> struct compact_row, rows owned) and replace them.
+ */
+static void get_columns(struct compact_reader *r, GHashTable *state)
+{
+	struct compact_row **rows, **prevs;
+	struct compact_key *keys, key = { 0, 0 };
+	guint64 *procs, *slot, i, nr;
+	gint c, k;
+
+	nr = get_uint(r);
+	if (!nr)
+		return;
+	/* the process columns give the size of the rows */
+	keys = g_new(struct compact_key, nr);
+	procs = g_new(guint64, nr * NR_PROCESS_COLUMNS);
+	rows = g_new(struct compact_row *, nr);
+	prevs = g_new(struct compact_row *, nr);
+	for (k = 0; k < nr; k++) {
+		key.tid += get_int(r);
+		key.birth += (guint64) get_int(r);
+		keys[k] = key;
+		prevs[k] = g_hash_table_lookup(state, &key);
+	}
+
+	for (c = 0; c < NR_PROCESS_COLUMNS; c++)
+		for (k = 0; k < nr; k++)
+			procs[k * NR_PROCESS_COLUMNS + c] = get_delta(r,
+					prevs[k] ? prevs[k]->values : NULL, c);
+	for (k = 0; k < nr; k++) {
+		rows[k] = new_row(&keys[k],
+				procs[k * NR_PROCESS_COLUMNS + PROC_NR_PERF],
+				procs[k * NR_PROCESS_COLUMNS + PROC_NR_FILES]);
+		memcpy(rows[k]->values, procs + k * NR_PROCESS_COLUMNS,
+				NR_PROCESS_COLUMNS * sizeof(guint64));
+	}
+
+	for (k = 0; k < nr; k++)
+		for (i = 0; i < rows[k]->values[PROC_NR_PERF]; i++)
+			row_perf(rows[k])[i] = get_delta(r,
+					prev_perf(prevs[k], i), i);
+
+	for (c = 0; c < NR_FILE_COLUMNS; c++) {
+		for (k = 0; k < nr; k++) {
+			for (i = 0; i < rows[k]->values[PROC_NR_FILES]; i++) {
+				slot = row_slot(rows[k], i);
+				if (c != FILE_PRESENT && !slot[FILE_PRESENT])
+					continue;
+				slot[c] = get_delta(r, prev_slot(prevs[k], i), c);
+			}
+		}
+	}
+
+	/* the previous rows are used until the end of the decoding */
+	for (k = 0; k < nr; k++)
+		g_hash_table_replace(state, &rows[k]->key, rows[k]);
+	g_free(prevs);
+	g_free(rows);
+	g_free(procs);
+	g_free(keys);
+}
+
+static void put_header(GByteArray *buf, struct lttngtop *snapshot)
+{
+	struct cputime *cpu;
+	struct kprobes *kprobe;
+	gint i;
+
+	put_uint(buf, snapshot->start);
+	put_uint(buf, snapshot->end - snapshot->start);
+	put_uint(buf, snapshot->nbproc);
+	put_uint(buf, snapshot->nbnewproc);
+	put_uint(buf, snapshot->nbdeadproc);
+	put_uint(buf, snapshot->nbthreads);
+	put_uint(buf, snapshot->nbnewthreads);
+	put_uint(buf, snapshot->nbdeadthreads);
+	put_uint(buf, snapshot->nbfiles);
+	put_uint(buf, snapshot->nbnewfiles);
+	put_uint(buf, snapshot->nbclosedfiles);
+
+	put_uint(buf, snapshot->cpu_table->len);
+	for (i = 0; i < snapshot->cpu_table->len; i++) {
+		cpu = g_ptr_array_index(snapshot->cpu_table, i);
+		put_uint(buf, cpu->id);
+		put_uint(buf, cpu->task_start);
+		put_uint(buf, cpu->busy_nsec);
+		put_perf(buf, &cpu->perf);
+	}
+
+	put_uint(buf, snapshot->kprobes_table->len);
+	for (i = 0; i < snapshot->kprobes_table->len; i++) {
+		kprobe = g_ptr_array_index(snapshot->kprobes_table, i);
+		put_string(buf, kprobe->probe_name);
+		put_string(buf, kprobe->symbol_name);
+		put_int(buf, kprobe->probe_addr);
+		put_int(buf, kprobe->probe_offset);
+		put_int(buf, kprobe->count);
+	}
+}
+
+static void read_header(struct compact_reader *r, struct lttngtop *snapshot)
+{
+	struct cputime *cpu;
+	struct kprobes *kprobe;
+	guint64 i, len;
+
+	snapshot->start = get_uint(r);
+	snapshot->end = snapshot->start + get_uint(r);
+	snapshot->nbproc = get_uint(r);
+	snapshot->nbnewproc = get_uint(r);
+	snapshot->nbdeadproc = get_uint(r);
+	snapshot->nbthreads = get_uint(r);
+	snapshot->nbnewthreads = get_uint(r);
+	snapshot->nbdeadthreads = get_uint(r);
+	snapshot->nbfiles = get_uint(r);
+	snapshot->nbnewfiles = get_uint(r);
+	snapshot->nbclosedfiles = get_uint(r);
+
+	len = get_uint(r);
+	for (i = 0; i < len; i++) {
+		cpu = arena_new0(snapshot->arena, struct cputime);
+		cpu->id = get_uint(r);
+		cpu->task_start = get_uint(r);
+		cpu->busy_nsec = get_uint(r);
+		get_perf(r, snapshot->arena, &cpu->perf);
+		g_ptr_array_add(snapshot->cpu_table, cpu);
+	}
+
+	len = get_uint(r);
+	for (i = 0; i < len; i++) {
+		kprobe = arena_new0(snapshot->arena, struct kprobes);
+		kprobe->probe_name = get_string(r);
+		kprobe->symbol_name = get_string(r);
+		kprobe->probe_addr = get_int(r);
+		kprobe->probe_offset = get_int(r);
+		kprobe->count = get_int(r);
+		g_ptr_array_add(snapshot->kprobes_table, kprobe);
+	}
+}
+
+static void get_header(struct compact_snapshot *compact,
+		struct lttngtop *snapshot)
+{
+	struct compact_reader r = {
+		.p = compact->header->data,
+		.end = compact->header->data + compact->header->len,
+		.strings = compact->dicts->strings.values,
+		.hosts = compact->dicts->hosts.values,
+		.shared = 1,
+	};
+
+	read_header(&r, snapshot);
+}
+
+static void free_compact_state(gpointer data)
+{
+	struct compact_state *state = data;
+
+	put_processtop_copy(state->copy);
+	g_free(state->row);
+	g_free(state);
+}
+
+static struct compact_snapshot *new_compact_snapshot(int keyframe)
+{
+	struct compact_snapshot *compact;
+
+	compact = g_new0(struct compact_snapshot, 1);
+	compact->refcount = 1;
+	compact->keyframe = keyframe;
+	compact->removed = g_array_new(FALSE, FALSE, sizeof(struct compact_key));
+	compact->columns = g_byte_array_new();
+
+	return compact;
+}
+
+static void compute_mem_size(struct compact_snapshot *compact)
+{
+	compact->mem_size = sizeof(struct compact_snapshot) +
+		compact->header->len +
+		compact->removed->len * sizeof(struct compact_key) +
+		compact->columns->len;
+}
+
+struct compact_snapshot *compact_snapshot(struct lttngtop *snapshot,
+		int keyframe)
+{
+	struct compact_snapshot *compact;
+	struct compact_state *state;
+	struct compact_row *row;
+	struct compact_key key;
+	struct processtop *proc;
+	GPtrArray *changed, *prevs;
+	GHashTableIter iter;
+	gpointer value;
+	gint i;
+
+	if (!compact_states)
+		compact_states = g_hash_table_new_full(compact_key_hash,
+				compact_key_equal, NULL, free_compact_state);
+	if (keyframe) {
+		/* the rows are encoded again with the new dictionaries */
+		put_dicts(dicts);
+		dicts = new_dicts();
+		g_hash_table_remove_all(compact_states);
+	}
+
+	compact = new_compact_snapshot(keyframe);
+	compact->dicts = get_dicts(encoder_dicts());
+	compact->header = g_byte_array_new();
+	put_header(compact->header, snapshot);
+
+	compact_generation++;
+	changed = g_ptr_array_new();
+	/* the rows replaced, used until the end of the encoding */
+	prevs = g_ptr_array_new_with_free_func(g_free);
+	for (i = 0; i < snapshot->process_table->len; i++) {
+		proc = g_ptr_array_index(snapshot->process_table, i);
+		key.tid = proc->tid;
+		key.birth = proc->birth;
+		state = g_hash_table_lookup(compact_states, &key);
+
+		/* the copy is shared while the process is not modified */
+		if (state && state->copy == proc) {
+			state->generation = compact_generation;
+			continue;
+		}
+		if (!state) {
+			state = g_new0(struct compact_state, 1);
+			state->key = key;
+			g_hash_table_insert(compact_states, &state->key, state);
+		}
+		put_processtop_copy(state->copy);
+		get_processtop_copy(proc);
+		state->copy = proc;
+		state->generation = compact_generation;
+
+		row = process_row(proc);
+		if (state->row && same_row(state->row, row)) {
+			g_free(row);
+			continue;
+		}
+		g_ptr_array_add(changed, row);
+		g_ptr_array_add(prevs, state->row);
+		state->row = row;
+	}
+	put_columns(compact->columns, changed, prevs);
+	g_ptr_array_free(prevs, TRUE);
+	g_ptr_array_free(changed, TRUE);
+
+	/* the processes not in this snapshot anymore */
+	g_hash_table_iter_init(&iter, compact_states);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		state = value;
+		if (state->generation == compact_generation)
+			continue;
+		if (!keyframe)
+			g_array_append_val(compact->removed, state->key);
+		g_hash_table_iter_remove(&iter);
+	}
+
+	compute_mem_size(compact);
+
+	return compact;
+}
+
+/* state: struct compact_key -> struct compact_row, rows owned */
+static void apply_compact_snapshot(GHashTable *state,
+		struct compact_snapshot *compact)
+{
+	struct compact_reader r = {
+		.p = compact->columns->data,
+		.end = compact->columns->data + compact->columns->len,
+	};
+	gint i;
+
+	if (compact->keyframe)
+		g_hash_table_remove_all(state);
+	for (i = 0; i < compact->removed->len; i++)
+		g_hash_table_remove(state, &g_array_index(compact->removed,
+					struct compact_key, i));
+	get_columns(&r, state);
+}
+
+static GHashTable *new_row_state(void)
+{
+	return g_hash_table_new_full(compact_key_hash, compact_key_equal,
+			NULL, g_free);
+}
+
+struct compact_snapshot *rebase_compact_snapshot(
+		struct compact_snapshot *keyframe,
+		struct compact_snapshot *delta)
+{
+	struct compact_snapshot *compact;
+	GHashTable *state;
+	GHashTableIter iter;
+	GPtrArray *rows;
+	gpointer value;
+
+	state = new_row_state();
+	apply_compact_snapshot(state, keyframe);
+	apply_compact_snapshot(state, delta);
+
+	compact = new_compact_snapshot(1);
+	/* the keyframe and the delta share their generation */
+	compact->dicts = get_dicts(delta->dicts);
+	compact->header = g_byte_array_ref(delta->header);
+	rows = g_ptr_array_new();
+	g_hash_table_iter_init(&iter, state);
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+		g_ptr_array_add(rows, value);
+	put_columns(compact->columns, rows, NULL);
+	g_ptr_array_free(rows, TRUE);
+	g_hash_table_destroy(state);
+
+	compute_mem_size(compact);
+
+	return compact;
+}
+
+static gint compare_process_tid(gconstpointer a, gconstpointer b)
+{
+	struct processtop *pa = *(struct processtop **) a;
+	struct processtop *pb = *(struct processtop **) b;
+
+	return (pa->tid > pb->tid) - (pa->tid < pb->tid);
+}
+
+static struct lttngtop *new_decoded_snapshot(void)
+{
+	struct lttngtop *snapshot;
+	struct arena *arena;
+
+	arena = arena_new();
+	snapshot = arena_new0(arena, struct lttngtop);
+	snapshot->arena = arena;
+	snapshot->process_table = g_ptr_array_new();
+	snapshot->files_table = g_ptr_array_new();
+	snapshot->cpu_table = g_ptr_array_new();
+	snapshot->kprobes_table = g_ptr_array_new();
+	snapshot->process_hash_table = g_hash_table_new(g_direct_hash,
+			g_direct_equal);
+
+	return snapshot;
+}
+
+void index_snapshot(struct lttngtop *snapshot)
+{
+	struct processtop *proc;
+	unsigned int i;
+	gint j;
+
+	g_hash_table_remove_all(snapshot->process_hash_table);
+	g_ptr_array_set_size(snapshot->files_table, 0);
+	g_ptr_array_sort(snapshot->process_table, compare_process_tid);
+	for (i = 0; i < snapshot->process_table->len; i++) {
+		proc = g_ptr_array_index(snapshot->process_table, i);
+		/* a dead process does not hide the one reusing its tid */
+		if (!proc->death || !g_hash_table_lookup(
+					snapshot->process_hash_table,
+					(gpointer) (unsigned long) proc->tid))
+			g_hash_table_insert(snapshot->process_hash_table,
+					(gpointer) (unsigned long) proc->tid,
+					proc);
+		for (j = 0; j < proc->process_files_table->len; j++)
+			g_ptr_array_add(snapshot->files_table,
+					g_ptr_array_index(
+						proc->process_files_table, j));
+	}
+}
+
+struct lttngtop *decode_compact_snapshot(struct compact_snapshot **chain,
+		unsigned int len)
+{
+	struct lttngtop *snapshot;
+	GHashTable *state;
+	GHashTableIter iter;
+	gpointer value;
+	unsigned int i;
+
+	state = new_row_state();
+	for (i = 0; i < len; i++)
+		apply_compact_snapshot(state, chain[i]);
+
+	snapshot = new_decoded_snapshot();
+	get_header(chain[len - 1], snapshot);
+
+	/* a chain starts at a keyframe, it uses a single generation */
+	g_hash_table_iter_init(&iter, state);
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+		g_ptr_array_add(snapshot->process_table,
+				row_process(value, chain[len - 1]->dicts));
+	g_hash_table_destroy(state);
+	index_snapshot(snapshot);
+
+	return snapshot;
+}
+
+static void put_bytes(GByteArray *buf, const void *data, guint len)
+{
+	put_uint(buf, len);
+	g_byte_array_append(buf, data, len);
+}
+
+/* the dictionary entries added since the previous export */
+static void export_dicts(GByteArray *buf)
+{
+	struct host *host;
+	const char *str;
+	guint i, first, len;
+
+	len = dicts->strings.values->len;
+	first = MAX(exported_strings, 1);
+	put_uint(buf, len - first);
+	for (i = first; i < len; i++) {
+		str = g_ptr_array_index(dicts->strings.values, i);
+		put_bytes(buf, str, strlen(str));
+	}
+	exported_strings = len;
+
+	/* the hosts by name */
+	len = dicts->hosts.values->len;
+	first = MAX(exported_hosts, 1);
+	put_uint(buf, len - first);
+	for (i = first; i < len; i++) {
+		host = g_ptr_array_index(dicts->hosts.values, i);
+		put_bytes(buf, host->hostname, strlen(host->hostname));
+	}
+	exported_hosts = len;
+}
+
+void export_snapshot(GByteArray *buf, struct lttngtop *snapshot)
+{
+	struct processtop *proc;
+	GByteArray *body, *record;
+	gint i;
+
+	/*
+	 * The encoding adds the dictionary entries exported first. A process
+	 * exporting its snapshots does not compact any, so the generation
+	 * never changes.
+	 */
+	encoder_dicts();
+	body = g_byte_array_new();
+	record = g_byte_array_new();
+	put_header(record, snapshot);
+	put_bytes(body, record->data, record->len);
+	put_uint(body, snapshot->process_table->len);
+	for (i = 0; i < snapshot->process_table->len; i++) {
+		proc = g_ptr_array_index(snapshot->process_table, i);
+		g_byte_array_set_size(record, 0);
+		put_process(record, proc);
+		put_int(body, proc->tid);
+		put_uint(body, proc->birth);
+		put_bytes(body, record->data, record->len);
+	}
+
+	export_dicts(buf);
+	g_byte_array_append(buf, body->data, body->len);
+	g_byte_array_free(record, TRUE);
+	g_byte_array_free(body, TRUE);
+}
+
+struct snapshot_import *new_snapshot_import(void)
+{
+	struct snapshot_import *import;
+
+	import = g_new0(struct snapshot_import, 1);
+	import->strings = g_ptr_array_new();
+	import->hosts = g_ptr_array_new();
+	/* index 0 is NULL */
+	g_ptr_array_add(import->strings, NULL);
+	g_ptr_array_add(import->hosts, NULL);
+
+	return import;
+}
+
+void free_snapshot_import(struct snapshot_import *import)
+{
+	guint i;
+
+	if (!import)
+		return;
+	for (i = 0; i < import->strings->len; i++)
+		put_name(g_ptr_array_index(import->strings, i));
+	g_ptr_array_free(import->strings, TRUE);
+	g_ptr_array_free(import->hosts, TRUE);
+	g_free(import);
+}
+
+/* NULL past the end of the data */
+static char *get_bytes(struct compact_reader *r)
+{
+	guint64 len;
+	char *str;
+
+	len = get_uint(r);
+	if (len > r->end - r->p)
+		return NULL;
+	str = g_strndup((const char *) r->p, len);
+	r->p += len;
+
+	return str;
+}
+
+static int import_dicts(struct snapshot_import *import,
+		struct compact_reader *r)
+{
+	guint64 i, len;
+	char *str;
+
+	len = get_uint(r);
+	for (i = 0; i < len; i++) {
+		str = get_bytes(r);
+		if (!str)
+			return -1;
+		g_ptr_array_add(import->strings, intern_name(str));
+		g_free(str);
+	}
+	len = get_uint(r);
+	for (i = 0; i < len; i++) {
+		str = get_bytes(r);
+		if (!str)
+			return -1;
+		g_ptr_array_add(import->hosts, add_hostname_list(str, 0));
+		g_free(str);
+	}
+
+	return 0;
+}
+
+/* reader over the next length-prefixed block of r */
+static int get_block(struct compact_reader *r, struct compact_reader *block)
+{
+	guint64 len;
+
+	len = get_uint(r);
+	if (len > r->end - r->p)
+		return -1;
+	*block = *r;
+	block->end = r->p + len;
+	r->p += len;
+
+	return 0;
+}
+
+struct lttngtop *import_snapshot(struct snapshot_import *import,
+		const guchar *data, gsize len)
+{
+	struct compact_reader r = {
+		.p = data,
+		.end = data + len,
+		.strings = import->strings,
+		.hosts = import->hosts,
+	};
+	struct compact_reader block;
+	struct lttngtop *snapshot;
+	struct compact_key key;
+	guint64 i, nr_procs;
+
+	if (import_dicts(import, &r) < 0)
+		return NULL;
+
+	snapshot = new_decoded_snapshot();
+	if (get_block(&r, &block) < 0)
+		goto error;
+	read_header(&block, snapshot);
+	nr_procs = get_uint(&r);
+	for (i = 0; i < nr_procs; i++) {
+		key.tid = get_int(&r);
+		key.birth = get_uint(&r);
+		if (get_block(&r, &block) < 0)
+			goto error;
+		g_ptr_array_add(snapshot->process_table,
+				read_process(&block, &key));
+	}
+	index_snapshot(snapshot);
+
+	snapshot->mem_size = arena_mem_size(snapshot->arena) +
+		(snapshot->process_table->len + snapshot->files_table->len) *
+		sizeof(gpointer) +
+		g_hash_table_size(snapshot->process_hash_table) *
+		3 * sizeof(gpointer);
+	for (i = 0; i < snapshot->process_table->len; i++)
+		snapshot->mem_size += processtop_copy_mem_size(
+				g_ptr_array_index(snapshot->process_table, i));
+
+	return snapshot;
+
+error:
+	free_lttngtop_snapshot(snapshot);
+	return NULL;
+}
+
+void get_compact_snapshot(struct compact_snapshot *compact)
+{
+	g_atomic_int_inc(&compact->refcount);
+}
+
+void put_compact_snapshot(struct compact_snapshot *compact)
+{
+	if (!compact || !g_atomic_int_dec_and_test(&compact->refcount))
+		return;
+	g_byte_array_unref(compact->header);
+	put_dicts(compact->dicts);
+	g_array_free(compact->removed, TRUE);
+	g_byte_array_free(compact->columns, TRUE);
+	g_free(compact);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _COMPACT_HISTORY_H
+#define _COMPACT_HISTORY_H
+
+#include <glib.h>
+#include "lttngtoptypes.h"
+
+/* identity of a process across the snapshots */
+struct compact_key {
+	int tid;
+	unsigned long birth;
+};
+
+struct compact_dicts;
+
+struct compact_snapshot {
+	/* references from the history and the decoders */
+	int refcount;
+	/* dictionaries of the names, shared from a keyframe to the next one */
+	struct compact_dicts *dicts;
+	/* records has all the processes instead of only the changed ones */
+	int keyframe;
+	unsigned long mem_size;
+	/* period, global counters, cpus and kprobes */
+	GByteArray *header;
+	/* struct compact_key, processes gone since the previous snapshot */
+	GArray *removed;
+	/*
+	 * Keys and columns of the processes changed since the previous
+	 * snapshot, each value is the difference with the previous one of
+	 * the process (see put_columns()).
+	 */
+	GByteArray *columns;
+};
+
+/*
+ * Encode a snapshot relative to the previous one given to this function
+ * (or completely if keyframe is set). The snapshots must be given in
+ * order. The encoding functions are called by one thread at a time, the
+ * compact snapshots are immutable and can be decoded by other threads
+ * while they hold a reference.
+ */
+struct compact_snapshot *compact_snapshot(struct lttngtop *snapshot,
+		int keyframe);
+
+/*
+ * Return the keyframe equivalent of delta, which must directly follow
+ * the keyframe.
+ */
+struct compact_snapshot *rebase_compact_snapshot(
+		struct compact_snapshot *keyframe,
+		struct compact_snapshot *delta);
+
+/*
+ * Decode the last snapshot of chain, chain[0] must be a keyframe and
+ * each snapshot must follow the previous one. The result is freed with
+ * free_lttngtop_snapshot().
+ */
+struct lttngtop *decode_compact_snapshot(struct compact_snapshot **chain,
+		unsigned int len);
+
+void get_compact_snapshot(struct compact_snapshot *compact);
+void put_compact_snapshot(struct compact_snapshot *compact);
+
+/*
+ * Self-contained encoding of a snapshot, to hand it to another process.
+ * The names are sent with the first snapshot using them, so the snapshots
+ * exported by a process must be imported in the same order with the same
+ * import state.
+ */
+struct snapshot_import;
+
+void export_snapshot(GByteArray *buf, struct lttngtop *snapshot);
+struct snapshot_import *new_snapshot_import(void);
+/*
+ * NULL if the data is truncated, the result is freed with
+ * free_lttngtop_snapshot().
+ */
+struct lttngtop *import_snapshot(struct snapshot_import *import,
+		const guchar *data, gsize len);
+void free_snapshot_import(struct snapshot_import *import);
+
+/*
+ * Sort the processes of a decoded or imported snapshot and fill its
+ * indexes again after its processes or files changed.
+ */
+void index_snapshot(struct lttngtop *snapshot);
+
+#endif /* _COMPACT_HISTORY_H */
@@ -19,6 +19,7 @@
 
 #include "lttngtoptypes.h"
 #include "common.h"
+#include "field-cache.h"
 #include "cputop.h"
 #include "lttngtop.h"
 
@@ -32,11 +33,15 @@ void update_cputop_data(unsigned long timestamp, int64_t cpu, int prev_pid,
 
 	if (tmpcpu->current_task && tmpcpu->current_task->pid == prev_pid) {
 		elapsed = timestamp - tmpcpu->task_start;
+		tmpcpu->busy_nsec += elapsed;
 		tmpcpu->current_task->totalcpunsec += elapsed;
 		tmpcpu->current_task->threadstotalcpunsec += elapsed;
+		tmpcpu->current_task->dirty = 1;
 		if (tmpcpu->current_task->threadparent &&
-				tmpcpu->current_task->pid != tmpcpu->current_task->tid)
+				tmpcpu->current_task->pid != tmpcpu->current_task->tid) {
 			tmpcpu->current_task->threadparent->threadstotalcpunsec += elapsed;
+			tmpcpu->current_task->threadparent->dirty = 1;
+		}
 	}
 
 	if (next_pid != 0)
@@ -51,43 +56,40 @@ void update_cputop_data(unsigned long timestamp, int64_t cpu, int prev_pid,
 enum bt_cb_ret handle_sched_switch(struct bt_ctf_event *call_data,
 		void *private_data)
 {
-	const struct bt_definition *scope;
 	unsigned long timestamp;
 	uint64_t cpu_id;
 	char *prev_comm, *next_comm;
 	int prev_tid, next_tid;
 	char *hostname = NULL;
 
-	timestamp = bt_ctf_get_timestamp(call_data);
+	timestamp = get_event_timestamp(call_data);
 	if (timestamp == -1ULL)
 		goto error;
 
-	scope = bt_ctf_get_top_level_scope(call_data,
-			BT_EVENT_FIELDS);
-	prev_comm = bt_ctf_get_char_array(bt_ctf_get_field(call_data,
-				scope, "_prev_comm"));
-	if (bt_ctf_field_get_error()) {
+	prev_comm = get_field_char_array(call_data,
+				FIELD_PREV_COMM);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing prev_comm context info\n");
 		goto error;
 	}
 
-	next_comm = bt_ctf_get_char_array(bt_ctf_get_field(call_data,
-				scope, "_next_comm"));
-	if (bt_ctf_field_get_error()) {
+	next_comm = get_field_char_array(call_data,
+				FIELD_NEXT_COMM);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing next_comm context info\n");
 		goto error;
 	}
 
-	prev_tid = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-				scope, "_prev_tid"));
-	if (bt_ctf_field_get_error()) {
+	prev_tid = get_field_int64(call_data,
+				FIELD_PREV_TID);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing prev_tid context info\n");
 		goto error;
 	}
 
-	next_tid = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-				scope, "_next_tid"));
-	if (bt_ctf_field_get_error()) {
+	next_tid = get_field_int64(call_data,
+				FIELD_NEXT_TID);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing next_tid context info\n");
 		goto error;
 	}
@@ -106,27 +108,24 @@ error:
 enum bt_cb_ret handle_sched_process_free(struct bt_ctf_event *call_data,
 		void *private_data)
 {
-	const struct bt_definition *scope;
 	unsigned long timestamp;
 	char *comm;
 	int tid;
 
-	timestamp = bt_ctf_get_timestamp(call_data);
+	timestamp = get_event_timestamp(call_data);
 	if (timestamp == -1ULL)
 		goto error;
 
-	scope = bt_ctf_get_top_level_scope(call_data,
-			BT_EVENT_FIELDS);
-	comm = bt_ctf_get_char_array(bt_ctf_get_field(call_data,
-				scope, "_comm"));
-	if (bt_ctf_field_get_error()) {
+	comm = get_field_char_array(call_data,
+				FIELD_COMM);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing procname context info\n");
 		goto error;
 	}
 
-	tid = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-				scope, "_tid"));
-	if (bt_ctf_field_get_error()) {
+	tid = get_field_int64(call_data,
+				FIELD_TID);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing tid field\n");
 		goto error;
 	}
@@ -146,35 +145,32 @@ error:
 enum bt_cb_ret handle_sched_process_fork(struct bt_ctf_event *call_data,
 		void *private_data)
 {
-	const struct bt_definition *scope;
 	struct processtop *tmp;
 	int tid, *hash_tid, parent_pid;
 	unsigned long timestamp;
 	char *comm;
 
-	timestamp = bt_ctf_get_timestamp(call_data);
+	timestamp = get_event_timestamp(call_data);
 	if (timestamp == -1ULL)
 		goto error;
 
-	scope = bt_ctf_get_top_level_scope(call_data,
-			BT_EVENT_FIELDS);
-	comm = bt_ctf_get_char_array(bt_ctf_get_field(call_data,
-				scope, "_child_comm"));
-	if (bt_ctf_field_get_error()) {
+	comm = get_field_char_array(call_data,
+				FIELD_CHILD_COMM);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing procname context info\n");
 		goto error;
 	}
 
-	tid = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-				scope, "_child_tid"));
-	if (bt_ctf_field_get_error()) {
+	tid = get_field_int64(call_data,
+				FIELD_CHILD_TID);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing child_tid field\n");
 		goto error;
 	}
 
-	parent_pid = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-				scope, "_parent_pid"));
-	if (bt_ctf_field_get_error()) {
+	parent_pid = get_field_int64(call_data,
+				FIELD_PARENT_PID);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing parent_pid field\n");
 		goto error;
 	}
@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <signal.h>
 #include <string.h>
 #include <ncurses.h>
@@ -32,6 +33,8 @@
 #include "lttngtoptypes.h"
 #include "iostreamtop.h"
 #include "common.h"
+#include "history.h"
+#include "live-stats.h"
 
 #define DEFAULT_DELAY 15
 #define MAX_LINE_LENGTH 50
@@ -39,6 +42,12 @@
 
 /* to prevent concurrent updates of the different windows */
 sem_t update_display_sem;
+/*
+ * Held by the display and keyboard threads while they replace the
+ * displayed snapshot and draw it: the previous snapshot is released
+ * when it is replaced.
+ */
+static pthread_mutex_t display_lock = PTHREAD_MUTEX_INITIALIZER;
 
 char *termtype;
 WINDOW *footer, *header, *center, *status;
@@ -49,7 +58,7 @@ int pref_panel_visible = 0;
 int pref_line_selected = 0;
 int pref_current_sort = 0;
 
-int last_display_index, currently_displayed_index;
+unsigned int currently_displayed_index;
 
 struct processtop *selected_process = NULL;
 int selected_ret;
@@ -82,11 +91,8 @@ void reset_ncurses()
 	curs_set(1);
 	endwin();
 	quit = 1;
-	sem_post(&pause_sem);
 	sem_post(&timer);
-	sem_post(&goodtodisplay);
 	sem_post(&end_trace_sem);
-	sem_post(&goodtoupdate);
 }
 
 static void handle_sigterm(int signal)
@@ -273,6 +279,8 @@ void update_footer()
 	print_key(footer, "F2", "CPUtop  ", current_view == cpu);
 	print_key(footer, "F3", "PerfTop  ", current_view == perf);
 	print_key(footer, "F4", "IOTop  ", current_view == iostream);
+	if (remote_live)
+		print_key(footer, "F6", "Live  ", current_view == live_stats);
 	print_key(footer, "Enter", "Details  ", current_view == process_details);
 	print_key(footer, "Space", "Highlight  ", 0);
 	print_key(footer, "q", "Quit ", 0);
@@ -280,6 +288,8 @@ void update_footer()
 	print_key(footer, "t", "Threads  ", toggle_threads);
 	print_key(footer, "v", "Virt  ", toggle_virt);
 	print_key(footer, "p", "Pause  ", toggle_pause);
+	if (!remote_live)
+		print_key(footer, "g", "Jump  ", 0);
 
 	wrefresh(footer);
 	sem_post(&update_display_sem);
@@ -540,6 +550,68 @@ void update_kprobes_display()
 	}
 }
 
+static void print_live_stats_line(int line,
+		struct live_stats_sample *sample)
+{
+	char unit[32];
+	uint64_t lag = 0;
+
+	if (sample->newest_ts > last_event_ts)
+		lag = sample->newest_ts - last_event_ts;
+	scale_unit(sample->bytes_per_sec, unit);
+	mvwprintw(center, line, 1, "%s", sample->name);
+	mvwprintw(center, line, 30, "%sB/s", unit);
+	mvwprintw(center, line, 42, "%.1f", sample->packets_per_sec);
+	mvwprintw(center, line, 54, "%" PRIu64 " us", sample->latency_us);
+	mvwprintw(center, line, 68, "%" PRIu64, sample->retries);
+	mvwprintw(center, line, 78, "%" PRIu64 " ms", lag / (1000 * NSEC_PER_USEC));
+}
+
+/*
+ * Rates since the previous refresh of the view: when they are sampled
+ * from the keyboard thread right after a refresh, they only cover a short
+ * interval.
+ */
+void update_live_stats_display()
+{
+	struct live_stats_sample *sample;
+	int header_offset = 2;
+	int current_line = 0;
+	GArray *samples;
+	int i;
+
+	set_window_title(center, "Network Live ");
+	wattron(center, A_BOLD);
+	mvwprintw(center, 1, 1, "STREAM");
+	mvwprintw(center, 1, 30, "THROUGHPUT");
+	mvwprintw(center, 1, 42, "PACKETS/S");
+	mvwprintw(center, 1, 54, "LATENCY");
+	mvwprintw(center, 1, 68, "RETRIES");
+	mvwprintw(center, 1, 78, "LAG");
+	wattroff(center, A_BOLD);
+
+	samples = live_stats_sample();
+	if (!samples) {
+		mvwprintw(center, header_offset, 1, "No live stream");
+		return;
+	}
+	/* the aggregate first */
+	wattron(center, A_BOLD);
+	print_live_stats_line(header_offset,
+			&g_array_index(samples, struct live_stats_sample, 0));
+	wattroff(center, A_BOLD);
+	max_center_lines = LINES - 5 - 7 - 1 - header_offset - 1;
+	for (i = 1; i < samples->len; i++) {
+		if (current_line >= max_center_lines)
+			break;
+		sample = &g_array_index(samples, struct live_stats_sample, i);
+		print_live_stats_line(current_line + header_offset + 1,
+				sample);
+		current_line++;
+	}
+	g_array_free(samples, TRUE);
+}
+
 void update_cputop_display()
 {
 	int i;
@@ -649,24 +721,15 @@ gint sort_perf(gconstpointer p1, gconstpointer p2, gpointer key)
 	struct processtop *n1 = *(struct processtop **) p1;
 	struct processtop *n2 = *(struct processtop **) p2;
 
-	struct perfcounter *tmp1, *tmp2;
+	struct perfcounter *global = key;
 	unsigned long totaln2 = 0;
 	unsigned long totaln1 = 0;
 
-	if (!key)
+	if (!global)
 		return 0;
 
-	tmp1 = g_hash_table_lookup(n1->perf, key);
-	if (!tmp1)
-		totaln1 = 0;
-	else
-		totaln1 = tmp1->count;
-
-	tmp2 = g_hash_table_lookup(n2->perf, key);
-	if (!tmp2)
-		totaln2 = 0;
-	else
-		totaln2 = tmp2->count;
+	totaln1 = get_perf_value(&n1->perf, global->slot);
+	totaln2 = get_perf_value(&n2->perf, global->slot);
 
 	if (totaln1 < totaln2)
 		return 1;
@@ -701,7 +764,7 @@ void update_process_details()
 	int column;
 	GPtrArray *newfilearray = g_ptr_array_new();
 	GHashTableIter iter;
-	struct perfcounter *perfn1, *perfn2;
+	struct perfcounter *perfn1;
 	gpointer key;
 
 	set_window_title(center, "Process details");
@@ -746,8 +809,8 @@ void update_process_details()
 	g_hash_table_iter_init(&iter, global_perf_liszt);
 	while (g_hash_table_iter_next (&iter, &key, (gpointer) &perfn1)) {
 		print_key_title((char *) key, line++);
-		perfn2 = g_hash_table_lookup(tmp->perf, (char *) key);
-		wprintw(center, "%d", perfn2 ? perfn2->count : 0);
+		wprintw(center, "%" PRIu64, get_perf_value(&tmp->perf,
+					perfn1->slot));
 	}
 	line++;
 
@@ -810,9 +873,8 @@ void update_perf()
 	struct processtop *tmp;
 	int header_offset = 2;
 	int perf_row = 40;
-	struct perfcounter *perfn1, *perfn2;
-	char *perf_key = NULL;
-	int value;
+	struct perfcounter *perfn1;
+	struct perfcounter *perf_key = NULL;
 	GHashTableIter iter;
 	gpointer key;
 
@@ -837,7 +899,7 @@ void update_perf()
 			perf_row += 20;
 		}
 		if (perfn1->sort) {
-			perf_key = (char *) key;
+			perf_key = perfn1;
 		}
 	}
 	wattroff(center, A_BOLD);
@@ -876,13 +938,10 @@ void update_perf()
 		perf_row = 40;
 		while (g_hash_table_iter_next (&iter, &key, (gpointer) &perfn1)) {
 			if (perfn1->visible) {
-				perfn2 = g_hash_table_lookup(tmp->perf, (char *) key);
-				if (perfn2)
-					value = perfn2->count;
-				else
-					value = 0;
 				mvwprintw(center, current_line + header_offset,
-						perf_row, "%d", value);
+						perf_row, "%" PRIu64,
+						get_perf_value(&tmp->perf,
+							perfn1->slot));
 				perf_row += 20;
 			}
 		}
@@ -1010,6 +1069,9 @@ void update_current_view()
 	case kprobes:
 		update_kprobes_display();
 		break;
+	case live_stats:
+		update_live_stats_display();
+		break;
 	default:
 		break;
 	}
@@ -1474,38 +1536,92 @@ void toggle_host_panel(void)
 	doupdate();
 }
 
-void display(unsigned int index)
+/*
+ * Show the last snapshot, unless the screen is paused. Return 1 if this
+ * snapshot was not shown by a previous call.
+ */
+int display(void)
 {
-	last_display_index = index;
+	static unsigned int latest_index;
+	static int latest_shown;
+	unsigned int index;
+	int ret = 0;
+
+	pthread_mutex_lock(&display_lock);
+	if (toggle_pause > 0)
+		goto end;
+	if (select_latest_history(&data, &index) < 0)
+		goto end;
+	if (!latest_shown || index != latest_index) {
+		latest_index = index;
+		latest_shown = 1;
+		ret = 1;
+	}
 	currently_displayed_index = index;
-	data = g_ptr_array_index(copies, index);
-	if (!data)
-		return;
 	max_elements = data->process_table->len;
 	update_current_view();
 	update_footer();
 	update_panels();
 	doupdate();
+
+end:
+	pthread_mutex_unlock(&display_lock);
+	return ret;
 }
 
 void pause_display()
 {
 	toggle_pause = 1;
 	print_log("Pause");
-	sem_wait(&pause_sem);
 }
 
 void resume_display()
 {
 	toggle_pause = -1;
 	print_log("Resume");
-	sem_post(&pause_sem);
+	/* show the last snapshot without waiting for the next tick */
+	sem_post(&timer);
+}
+
+/* ask for a time and restart the analysis of the offline trace there */
+static void jump_to_time(void)
+{
+	char str[32];
+	int ret;
+
+	sem_wait(&update_display_sem);
+	werase(footer);
+	mvwprintw(footer, 0, 1, "Jump to (timestamp in ns or +seconds): ");
+	wrefresh(footer);
+	/* wait for the whole line */
+	cbreak();
+	echo();
+	curs_set(1);
+	ret = wgetnstr(footer, str, sizeof(str) - 1);
+	curs_set(0);
+	noecho();
+	halfdelay(DEFAULT_DELAY);
+	sem_post(&update_display_sem);
+	update_footer();
+
+	if (ret == ERR || str[0] == '\0')
+		return;
+	if (request_jump(str) < 0) {
+		print_log("Cannot jump to this time");
+		return;
+	}
+	print_log("Jumping in time");
+	if (toggle_pause > 0)
+		resume_display();
 }
 
 void *handle_keyboard(void *p)
 {
 	int ch;
 	while((ch = getch())) {
+		/* not cancelled while holding the display lock */
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		pthread_mutex_lock(&display_lock);
 		switch(ch) {
 		/* Move the cursor and scroll */
 		case 'j':
@@ -1550,13 +1666,14 @@ void *handle_keyboard(void *p)
 
 		/* Navigate the history with arrows */
 		case KEY_LEFT:
-			if (currently_displayed_index > 0) {
+			if (currently_displayed_index > history_first_index() &&
+					select_history(&data,
+						currently_displayed_index - 1) == 0) {
 				currently_displayed_index--;
 				print_log("Going back in time");
 			} else {
 				print_log("Cannot rewind, last data is already displayed");
 			}
-			data = g_ptr_array_index(copies, currently_displayed_index);
 			max_elements = data->process_table->len;
 
 			/* we force to pause the display when moving in time */
@@ -1567,21 +1684,16 @@ void *handle_keyboard(void *p)
 			update_footer();
 			break;
 		case KEY_RIGHT:
-			if (currently_displayed_index < last_display_index) {
+			/* the trace is still analysed while paused */
+			if (select_history(&data,
+						currently_displayed_index + 1) == 0) {
 				currently_displayed_index++;
 				print_log("Going forward in time");
-				data = g_ptr_array_index(copies, currently_displayed_index);
 				max_elements = data->process_table->len;
 				update_current_view();
 				update_footer();
 			} else {
-				print_log("Manually moving forward");
-				sem_post(&timer);
-				if (toggle_pause > 0) {
-					sem_post(&pause_sem);
-					update_current_view();
-					sem_wait(&pause_sem);
-				}
+				print_log("Cannot go forward, last data is already displayed");
 			}
 
 			break;
@@ -1672,8 +1784,18 @@ void *handle_keyboard(void *p)
 			selected_line = 0;
 			update_current_view();
 			break;
+		case KEY_F(6):
+			if (!remote_live)
+				break;
+			if (pref_panel_visible)
+				toggle_pref_panel();
+			current_view = live_stats;
+			selected_line = 0;
+			update_current_view();
+			break;
 		case KEY_F(10):
 		case 'q':
+			pthread_mutex_unlock(&display_lock);
 			reset_ncurses();
 			/* exit keyboard thread */
 			pthread_exit(0);
@@ -1690,6 +1812,9 @@ void *handle_keyboard(void *p)
 		case 'h':
 			toggle_host_panel();
 			break;
+		case 'g':
+			jump_to_time();
+			break;
 		case 't':
 			toggle_threads *= -1;
 			update_current_view();
@@ -1724,6 +1849,8 @@ void *handle_keyboard(void *p)
 			break;
 		}
 		update_footer();
+		pthread_mutex_unlock(&display_lock);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	}
 	return NULL;
 }
@@ -30,12 +30,13 @@ enum view_list
 	iostream,
 	tree,
 	kprobes,
+	live_stats,
 };
 
 enum view_list current_view;
 enum view_list previous_view;
 
-void display(unsigned int);
+int display(void);
 void init_ncurses();
 void reset_ncurses();
 
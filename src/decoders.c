@@ -0,0 +1,609 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <babeltrace/babeltrace.h>
+#include <babeltrace/babeltrace-internal.h>
+#include <babeltrace/context-internal.h>
+#include <babeltrace/iterator-internal.h>
+#include <babeltrace/prio_heap.h>
+#include <babeltrace/ctf/events.h>
+#include <babeltrace/ctf/iterator.h>
+#include <babeltrace/ctf/types.h>
+#include <babeltrace/ctf/metadata.h>
+
+#include "common.h"
+#include "field-cache.h"
+#include "decoders.h"
+
+/* the records are handed to the merge by chunks of about this size */
+#define RECORD_CHUNK_SIZE	(64 * 1024)
+/* chunks decoded ahead by each decoder */
+#define MAX_QUEUED_CHUNKS	16
+
+/*
+ * Record of an event in a chunk, the values are not aligned:
+ *	uint64_t timestamp
+ *	uint32_t quark of the name
+ *	uint64_t present and strings (see struct event_record)
+ *	uint32_t number of perf counters
+ *	each present field in increasing order, an int64_t or a string with
+ *	its final '\0'
+ *	each perf counter, its uint32_t slot and its uint64_t value
+ */
+
+struct decoder {
+	unsigned int index;
+	struct bt_context *bt_ctx;
+	/* struct ctf_file_stream * -> itself, the streams of this decoder */
+	GHashTable *streams;
+	struct bt_ctf_iter *iter;
+	pthread_t thread;
+	int running;
+
+	/* GByteArray chunks from the thread to the merge, under lock */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	GQueue *chunks;
+	/* the thread read all its streams */
+	int done;
+	int stop;
+
+	/* merge side: chunk being read and its current record */
+	GByteArray *chunk;
+	guint offset;
+	struct event_record record;
+	unsigned int alloc_perf;
+};
+
+struct decoders {
+	unsigned int nr;
+	struct decoder *decoders;
+	int started;
+	/* the decoders with a current record, the earliest one on top */
+	struct ptr_heap heap;
+	/* struct event_callback of all the events */
+	GArray *main_callbacks;
+	/* event quark -> GArray of struct event_callback */
+	GHashTable *event_callbacks;
+	uint64_t seq;
+};
+
+static gint compare_stream_path(gconstpointer a, gconstpointer b)
+{
+	const struct ctf_file_stream *sa = *(struct ctf_file_stream **) a;
+	const struct ctf_file_stream *sb = *(struct ctf_file_stream **) b;
+
+	return strcmp(sa->parent.path, sb->parent.path);
+}
+
+/*
+ * The streams are dealt in the order of their path, which is the same
+ * in the context of every decoder.
+ */
+static void assign_streams(struct decoder *decoder, unsigned int nr)
+{
+	struct ctf_stream_declaration *stream_class;
+	struct ctf_stream_definition *stream;
+	struct bt_trace_descriptor *td;
+	struct ctf_trace *trace;
+	GPtrArray *streams;
+	gpointer file_stream;
+	int i, j, k;
+
+	streams = g_ptr_array_new();
+	for (i = 0; i < decoder->bt_ctx->tc->array->len; i++) {
+		td = g_ptr_array_index(decoder->bt_ctx->tc->array, i);
+		trace = container_of(td, struct ctf_trace, parent);
+		for (j = 0; j < trace->streams->len; j++) {
+			stream_class = g_ptr_array_index(trace->streams, j);
+			if (!stream_class)
+				continue;
+			for (k = 0; k < stream_class->streams->len; k++) {
+				stream = g_ptr_array_index(stream_class->streams, k);
+				if (!stream)
+					continue;
+				g_ptr_array_add(streams, container_of(stream,
+							struct ctf_file_stream,
+							parent));
+			}
+		}
+	}
+	g_ptr_array_sort(streams, compare_stream_path);
+	for (i = decoder->index; i < streams->len; i += nr) {
+		file_stream = g_ptr_array_index(streams, i);
+		g_hash_table_insert(decoder->streams, file_stream, file_stream);
+	}
+	g_ptr_array_free(streams, TRUE);
+}
+
+/* only keep the streams of the decoder in the heap of its iterator */
+static void keep_streams(struct decoder *decoder)
+{
+	struct ptr_heap *heap;
+	GPtrArray *kept;
+	void *file_stream;
+	guint i;
+
+	heap = bt_ctf_get_iter(decoder->iter)->stream_heap;
+	kept = g_ptr_array_new();
+	while ((file_stream = bt_heap_remove(heap)) != NULL) {
+		if (g_hash_table_lookup(decoder->streams, file_stream))
+			g_ptr_array_add(kept, file_stream);
+	}
+	for (i = 0; i < kept->len; i++)
+		bt_heap_insert(heap, g_ptr_array_index(kept, i));
+	g_ptr_array_free(kept, TRUE);
+}
+
+/*
+ * The type is checked before reading: the field error of babeltrace is
+ * shared by the decoder threads.
+ */
+static int read_field(const struct bt_definition *def, int64_t *value,
+		char **str)
+{
+	const struct bt_declaration *decl;
+
+	*str = NULL;
+	decl = bt_ctf_get_decl_from_def(def);
+	switch (bt_ctf_field_type(decl)) {
+	case CTF_TYPE_INTEGER:
+		/* the unsigned values are kept as their bits */
+		*value = bt_ctf_get_int64(def);
+		return 0;
+	case CTF_TYPE_STRING:
+		*str = bt_ctf_get_string(def);
+		break;
+	case CTF_TYPE_ARRAY:
+		*str = bt_ctf_get_char_array(def);
+		break;
+	default:
+		break;
+	}
+
+	return *str ? 0 : -1;
+}
+
+static void put_record(GByteArray *chunk, const struct bt_ctf_event *event)
+{
+	const struct bt_definition *def;
+	const struct perf_field *perf;
+	uint64_t timestamp, present = 0, strings = 0, value;
+	uint32_t name, nr_perf = 0, slot;
+	int64_t values[NR_FIELDS];
+	char *string_values[NR_FIELDS];
+	unsigned int i, count;
+	guint header;
+
+	for (i = 0; i < NR_FIELDS; i++) {
+		def = get_cached_field(event, i);
+		if (!def || read_field(def, &values[i], &string_values[i]) < 0)
+			continue;
+		present |= 1ULL << i;
+		if (string_values[i])
+			strings |= 1ULL << i;
+	}
+
+	timestamp = bt_ctf_get_timestamp(event);
+	name = get_event_name_quark(event);
+	g_byte_array_append(chunk, (guint8 *) &timestamp, sizeof(timestamp));
+	g_byte_array_append(chunk, (guint8 *) &name, sizeof(name));
+	g_byte_array_append(chunk, (guint8 *) &present, sizeof(present));
+	g_byte_array_append(chunk, (guint8 *) &strings, sizeof(strings));
+	/* written once the counters are read */
+	header = chunk->len;
+	g_byte_array_append(chunk, (guint8 *) &nr_perf, sizeof(nr_perf));
+
+	for (i = 0; i < NR_FIELDS; i++) {
+		if (!(present & (1ULL << i)))
+			continue;
+		if (strings & (1ULL << i))
+			g_byte_array_append(chunk, (guint8 *) string_values[i],
+					strlen(string_values[i]) + 1);
+		else
+			g_byte_array_append(chunk, (guint8 *) &values[i],
+					sizeof(int64_t));
+	}
+
+	count = get_cached_perf_fields(event, &perf);
+	for (i = 0; i < count; i++) {
+		def = get_perf_field(event, &perf[i]);
+		if (!def || bt_ctf_field_type(bt_ctf_get_decl_from_def(def)) !=
+				CTF_TYPE_INTEGER)
+			continue;
+		slot = perf[i].slot;
+		value = bt_ctf_get_uint64(def);
+		g_byte_array_append(chunk, (guint8 *) &slot, sizeof(slot));
+		g_byte_array_append(chunk, (guint8 *) &value, sizeof(value));
+		nr_perf++;
+	}
+	memcpy(chunk->data + header, &nr_perf, sizeof(nr_perf));
+}
+
+/* the chunk is released if the decoder is stopped */
+static int push_chunk(struct decoder *decoder, GByteArray *chunk)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&decoder->lock);
+	while (g_queue_get_length(decoder->chunks) >= MAX_QUEUED_CHUNKS &&
+			!decoder->stop)
+		pthread_cond_wait(&decoder->cond, &decoder->lock);
+	if (decoder->stop) {
+		g_byte_array_free(chunk, TRUE);
+		ret = -1;
+	} else {
+		g_queue_push_tail(decoder->chunks, chunk);
+		pthread_cond_broadcast(&decoder->cond);
+	}
+	pthread_mutex_unlock(&decoder->lock);
+
+	return ret;
+}
+
+static void *decode_streams(void *arg)
+{
+	struct decoder *decoder = arg;
+	const struct bt_ctf_event *event;
+	GByteArray *chunk;
+
+	chunk = g_byte_array_sized_new(RECORD_CHUNK_SIZE);
+	while ((event = bt_ctf_iter_read_event(decoder->iter)) != NULL) {
+		put_record(chunk, event);
+		if (chunk->len >= RECORD_CHUNK_SIZE) {
+			if (push_chunk(decoder, chunk) < 0)
+				goto end;
+			chunk = g_byte_array_sized_new(RECORD_CHUNK_SIZE);
+		}
+		if (bt_iter_next(bt_ctf_get_iter(decoder->iter)) < 0)
+			break;
+	}
+	if (chunk->len)
+		push_chunk(decoder, chunk);
+	else
+		g_byte_array_free(chunk, TRUE);
+
+end:
+	pthread_mutex_lock(&decoder->lock);
+	decoder->done = 1;
+	pthread_cond_broadcast(&decoder->cond);
+	pthread_mutex_unlock(&decoder->lock);
+	free_field_cache();
+
+	return NULL;
+}
+
+/* NULL once the decoder read all its streams */
+static GByteArray *pop_chunk(struct decoder *decoder)
+{
+	GByteArray *chunk;
+
+	pthread_mutex_lock(&decoder->lock);
+	while (g_queue_is_empty(decoder->chunks) && !decoder->done)
+		pthread_cond_wait(&decoder->cond, &decoder->lock);
+	chunk = g_queue_pop_head(decoder->chunks);
+	pthread_cond_broadcast(&decoder->cond);
+	pthread_mutex_unlock(&decoder->lock);
+
+	return chunk;
+}
+
+static const guint8 *get_value(const guint8 *p, void *value, size_t len)
+{
+	memcpy(value, p, len);
+	return p + len;
+}
+
+/*
+ * Make the next record of the decoder its current one, -1 at the end of
+ * its streams. The strings of the previous record are released.
+ */
+static int read_record(struct decoders *decoders, struct decoder *decoder)
+{
+	struct event_record *record = &decoder->record;
+	uint32_t name, nr_perf, slot;
+	const guint8 *p;
+	unsigned int i;
+
+	if (decoder->chunk && decoder->offset >= decoder->chunk->len) {
+		g_byte_array_free(decoder->chunk, TRUE);
+		decoder->chunk = NULL;
+	}
+	if (!decoder->chunk) {
+		decoder->chunk = pop_chunk(decoder);
+		if (!decoder->chunk)
+			return -1;
+		decoder->offset = 0;
+	}
+
+	p = decoder->chunk->data + decoder->offset;
+	p = get_value(p, &record->timestamp, sizeof(uint64_t));
+	p = get_value(p, &name, sizeof(name));
+	record->name = name;
+	p = get_value(p, &record->present, sizeof(uint64_t));
+	p = get_value(p, &record->strings, sizeof(uint64_t));
+	p = get_value(p, &nr_perf, sizeof(nr_perf));
+	for (i = 0; i < NR_FIELDS; i++) {
+		if (!(record->present & (1ULL << i)))
+			continue;
+		if (record->strings & (1ULL << i)) {
+			record->string_values[i] = (char *) p;
+			p += strlen((const char *) p) + 1;
+		} else {
+			p = get_value(p, &record->values[i], sizeof(int64_t));
+		}
+	}
+	if (nr_perf > decoder->alloc_perf) {
+		record->perf = g_renew(struct record_perf, record->perf,
+				nr_perf);
+		decoder->alloc_perf = nr_perf;
+	}
+	record->nr_perf = nr_perf;
+	for (i = 0; i < nr_perf; i++) {
+		p = get_value(p, &slot, sizeof(slot));
+		record->perf[i].slot = slot;
+		p = get_value(p, &record->perf[i].value, sizeof(uint64_t));
+	}
+	decoder->offset = p - decoder->chunk->data;
+	record->seq = ++decoders->seq;
+
+	return 0;
+}
+
+/* the earliest record on top, in the order of the decoders on a tie */
+static int record_gt(void *a, void *b)
+{
+	struct decoder *da = a, *db = b;
+
+	if (da->record.timestamp != db->record.timestamp)
+		return da->record.timestamp < db->record.timestamp;
+
+	return da->index < db->index;
+}
+
+static void free_callback_chain(gpointer data)
+{
+	g_array_free(data, TRUE);
+}
+
+static void set_callbacks(struct decoders *decoders, GArray *callbacks)
+{
+	struct event_callback *cb;
+	GArray *chain;
+	guint i;
+
+	decoders->main_callbacks = g_array_new(FALSE, FALSE,
+			sizeof(struct event_callback));
+	decoders->event_callbacks = g_hash_table_new_full(g_direct_hash,
+			g_direct_equal, NULL, free_callback_chain);
+	for (i = 0; i < callbacks->len; i++) {
+		cb = &g_array_index(callbacks, struct event_callback, i);
+		if (!cb->event) {
+			g_array_append_val(decoders->main_callbacks, *cb);
+			continue;
+		}
+		chain = g_hash_table_lookup(decoders->event_callbacks,
+				GUINT_TO_POINTER(cb->event));
+		if (!chain) {
+			chain = g_array_new(FALSE, FALSE,
+					sizeof(struct event_callback));
+			g_hash_table_insert(decoders->event_callbacks,
+					GUINT_TO_POINTER(cb->event), chain);
+		}
+		g_array_append_val(chain, *cb);
+	}
+}
+
+/* -1 when a callback stops the processing of the event */
+static int run_callback_chain(GArray *chain, struct event_record *record)
+{
+	struct event_callback *cb;
+	enum bt_cb_ret ret;
+	guint i;
+
+	for (i = 0; i < chain->len; i++) {
+		cb = &g_array_index(chain, struct event_callback, i);
+		ret = cb->callback(&record->event, cb->private_data);
+		if (ret == BT_CB_OK_STOP || ret == BT_CB_ERROR_STOP)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void run_callbacks(struct decoders *decoders,
+		struct event_record *record)
+{
+	GArray *chain;
+
+	if (run_callback_chain(decoders->main_callbacks, record) < 0)
+		return;
+	chain = g_hash_table_lookup(decoders->event_callbacks,
+			GUINT_TO_POINTER(record->name));
+	if (chain)
+		run_callback_chain(chain, record);
+}
+
+struct decoders *open_decoders(unsigned int nr,
+		int (*open_trace)(struct bt_context *bt_ctx))
+{
+	struct decoders *decoders;
+	struct decoder *decoder;
+	unsigned int i;
+
+	decoders = g_new0(struct decoders, 1);
+	decoders->nr = nr;
+	decoders->decoders = g_new0(struct decoder, nr);
+	for (i = 0; i < nr; i++) {
+		decoder = &decoders->decoders[i];
+		decoder->index = i;
+		decoder->streams = g_hash_table_new(g_direct_hash,
+				g_direct_equal);
+		decoder->chunks = g_queue_new();
+		pthread_mutex_init(&decoder->lock, NULL);
+		pthread_cond_init(&decoder->cond, NULL);
+	}
+
+	/* the metadata is parsed by a single thread */
+	for (i = 0; i < nr; i++) {
+		decoder = &decoders->decoders[i];
+		decoder->bt_ctx = bt_context_create();
+		if (!decoder->bt_ctx || open_trace(decoder->bt_ctx) < 0)
+			goto error;
+		assign_streams(decoder, nr);
+	}
+
+	return decoders;
+
+error:
+	fprintf(stderr, "[error] Opening the trace of the decoder %u\n", i);
+	close_decoders(decoders);
+	return NULL;
+}
+
+void close_decoders(struct decoders *decoders)
+{
+	struct decoder *decoder;
+	unsigned int i;
+
+	if (!decoders)
+		return;
+	stop_decoders(decoders);
+	for (i = 0; i < decoders->nr; i++) {
+		decoder = &decoders->decoders[i];
+		if (decoder->bt_ctx)
+			bt_context_put(decoder->bt_ctx);
+		g_hash_table_destroy(decoder->streams);
+		g_queue_free(decoder->chunks);
+		pthread_mutex_destroy(&decoder->lock);
+		pthread_cond_destroy(&decoder->cond);
+		g_free(decoder->record.perf);
+	}
+	g_free(decoders->decoders);
+	g_free(decoders);
+}
+
+int start_decoders(struct decoders *decoders, struct bt_iter_pos *pos,
+		GArray *callbacks)
+{
+	struct decoder *decoder;
+	unsigned int i;
+
+	if (bt_heap_init(&decoders->heap, decoders->nr, record_gt) < 0)
+		return -1;
+	set_callbacks(decoders, callbacks);
+	decoders->started = 1;
+
+	/* the iterators seek in the thread of the caller */
+	for (i = 0; i < decoders->nr; i++) {
+		decoder = &decoders->decoders[i];
+		decoder->iter = bt_ctf_iter_create(decoder->bt_ctx, pos, NULL);
+		if (!decoder->iter)
+			goto error;
+		keep_streams(decoder);
+		decoder->done = 0;
+		decoder->stop = 0;
+	}
+	for (i = 0; i < decoders->nr; i++) {
+		decoder = &decoders->decoders[i];
+		if (pthread_create(&decoder->thread, NULL, decode_streams,
+					decoder) != 0)
+			goto error;
+		decoder->running = 1;
+	}
+
+	/* wait for the first record of each decoder */
+	for (i = 0; i < decoders->nr; i++) {
+		decoder = &decoders->decoders[i];
+		if (read_record(decoders, decoder) == 0)
+			bt_heap_insert(&decoders->heap, decoder);
+	}
+
+	return 0;
+
+error:
+	fprintf(stderr, "[error] Starting the decoder %u\n", i);
+	stop_decoders(decoders);
+	return -1;
+}
+
+void stop_decoders(struct decoders *decoders)
+{
+	struct decoder *decoder;
+	GByteArray *chunk;
+	unsigned int i;
+
+	if (!decoders || !decoders->started)
+		return;
+	for (i = 0; i < decoders->nr; i++) {
+		decoder = &decoders->decoders[i];
+		if (decoder->running) {
+			pthread_mutex_lock(&decoder->lock);
+			decoder->stop = 1;
+			pthread_cond_broadcast(&decoder->cond);
+			pthread_mutex_unlock(&decoder->lock);
+			pthread_join(decoder->thread, NULL);
+			decoder->running = 0;
+		}
+		while ((chunk = g_queue_pop_head(decoder->chunks)) != NULL)
+			g_byte_array_free(chunk, TRUE);
+		if (decoder->chunk) {
+			g_byte_array_free(decoder->chunk, TRUE);
+			decoder->chunk = NULL;
+		}
+		if (decoder->iter) {
+			bt_ctf_iter_destroy(decoder->iter);
+			decoder->iter = NULL;
+		}
+	}
+	bt_heap_free(&decoders->heap);
+	g_array_free(decoders->main_callbacks, TRUE);
+	g_hash_table_destroy(decoders->event_callbacks);
+	decoders->started = 0;
+}
+
+struct bt_ctf_event *read_decoded_event(struct decoders *decoders)
+{
+	struct decoder *decoder;
+
+	decoder = bt_heap_maximum(&decoders->heap);
+	if (!decoder)
+		return NULL;
+	run_callbacks(decoders, &decoder->record);
+
+	return &decoder->record.event;
+}
+
+int next_decoded_event(struct decoders *decoders)
+{
+	struct decoder *decoder;
+
+	decoder = bt_heap_maximum(&decoders->heap);
+	if (!decoder)
+		return 0;
+	if (read_record(decoders, decoder) == 0)
+		bt_heap_replace_max(&decoders->heap, decoder);
+	else
+		bt_heap_remove(&decoders->heap);
+
+	return 0;
+}
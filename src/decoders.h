@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _DECODERS_H
+#define _DECODERS_H
+
+#include <glib.h>
+#include <babeltrace/babeltrace.h>
+#include <babeltrace/iterator.h>
+#include <babeltrace/ctf/events.h>
+#include <babeltrace/ctf/callbacks.h>
+
+#define MAX_DECODERS	64
+
+/*
+ * Parallel decoding of an offline trace: the stream files are shared
+ * between decoder threads, each one reads its streams with its own
+ * babeltrace context and copies the fields used by the callbacks in
+ * compact records. The records are merged in the order of the trace with
+ * a prio_heap and the callbacks run on the thread reading them, so the
+ * analysis state keeps a single writer.
+ */
+struct decoders;
+
+/* callback of the events named event, of all the events if it is 0 */
+struct event_callback {
+	GQuark event;
+	enum bt_cb_ret (*callback)(struct bt_ctf_event *event,
+			void *private_data);
+	void *private_data;
+};
+
+/*
+ * Open the trace in the context of each of the nr decoders with
+ * open_trace(), which returns a negative value on error. The perf
+ * counters of the trace must be registered first.
+ */
+struct decoders *open_decoders(unsigned int nr,
+		int (*open_trace)(struct bt_context *bt_ctx));
+void close_decoders(struct decoders *decoders);
+
+/*
+ * Start decoding at pos (BT_SEEK_BEGIN or BT_SEEK_TIME). The merged
+ * events go through the callbacks of the array of struct event_callback
+ * in the order babeltrace uses: the ones of all the events, then the
+ * ones of the event, until one returns a *_STOP value.
+ */
+int start_decoders(struct decoders *decoders, struct bt_iter_pos *pos,
+		GArray *callbacks);
+/* stop the threads, can be started again at another position */
+void stop_decoders(struct decoders *decoders);
+
+/*
+ * Same as bt_ctf_iter_read_event() and bt_iter_next() on the merged
+ * events: run the callbacks of the current event and return it, NULL at
+ * the end of the trace.
+ */
+struct bt_ctf_event *read_decoded_event(struct decoders *decoders);
+int next_decoded_event(struct decoders *decoders);
+
+#endif /* _DECODERS_H */
@@ -0,0 +1,449 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <babeltrace/babeltrace-internal.h>
+#include <babeltrace/ctf/events.h>
+#include <babeltrace/ctf/events-internal.h>
+#include <babeltrace/ctf-ir/metadata.h>
+#include <babeltrace/types.h>
+#include <glib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "common.h"
+#include "field-cache.h"
+
+struct field_desc {
+	enum bt_ctf_scope scope;
+	const char *name;
+	/* tried if name is not in the scope (UST has only the v* ids) */
+	const char *fallback;
+};
+
+static const struct field_desc field_desc[NR_FIELDS] = {
+	[FIELD_CPU_ID] = { BT_STREAM_PACKET_CONTEXT, "cpu_id", NULL },
+
+	[FIELD_CTX_PID] = { BT_STREAM_EVENT_CONTEXT, "_pid", "_vpid" },
+	[FIELD_CTX_TID] = { BT_STREAM_EVENT_CONTEXT, "_tid", "_vtid" },
+	[FIELD_CTX_PPID] = { BT_STREAM_EVENT_CONTEXT, "_ppid", NULL },
+	[FIELD_CTX_VPID] = { BT_STREAM_EVENT_CONTEXT, "_vpid", NULL },
+	[FIELD_CTX_VTID] = { BT_STREAM_EVENT_CONTEXT, "_vtid", NULL },
+	[FIELD_CTX_VPPID] = { BT_STREAM_EVENT_CONTEXT, "_vppid", NULL },
+	[FIELD_CTX_PROCNAME] = { BT_STREAM_EVENT_CONTEXT, "_procname", NULL },
+	[FIELD_CTX_HOSTNAME] = { BT_STREAM_EVENT_CONTEXT, "_hostname", NULL },
+
+	[FIELD_PREV_COMM] = { BT_EVENT_FIELDS, "_prev_comm", NULL },
+	[FIELD_NEXT_COMM] = { BT_EVENT_FIELDS, "_next_comm", NULL },
+	[FIELD_PREV_TID] = { BT_EVENT_FIELDS, "_prev_tid", NULL },
+	[FIELD_NEXT_TID] = { BT_EVENT_FIELDS, "_next_tid", NULL },
+	[FIELD_COMM] = { BT_EVENT_FIELDS, "_comm", NULL },
+	[FIELD_TID] = { BT_EVENT_FIELDS, "_tid", NULL },
+	[FIELD_CHILD_COMM] = { BT_EVENT_FIELDS, "_child_comm", NULL },
+	[FIELD_CHILD_TID] = { BT_EVENT_FIELDS, "_child_tid", NULL },
+	[FIELD_PARENT_PID] = { BT_EVENT_FIELDS, "_parent_pid", NULL },
+	[FIELD_RET] = { BT_EVENT_FIELDS, "_ret", NULL },
+	[FIELD_FD] = { BT_EVENT_FIELDS, "_fd", NULL },
+	[FIELD_FILENAME] = { BT_EVENT_FIELDS, "_filename", NULL },
+	[FIELD_PID] = { BT_EVENT_FIELDS, "_pid", NULL },
+	[FIELD_PPID] = { BT_EVENT_FIELDS, "_ppid", NULL },
+	[FIELD_VPID] = { BT_EVENT_FIELDS, "_vpid", NULL },
+	[FIELD_VTID] = { BT_EVENT_FIELDS, "_vtid", NULL },
+	[FIELD_VPPID] = { BT_EVENT_FIELDS, "_vppid", NULL },
+	[FIELD_NAME] = { BT_EVENT_FIELDS, "_name", NULL },
+};
+
+/*
+ * Kind of the event class and position of each field inside its scope,
+ * -1 when the event class does not have this field.
+ */
+struct field_cache_entry {
+	GQuark name;
+	enum lttngtop_event_kind kind;
+	int index[NR_FIELDS];
+	struct perf_field *perf;
+	unsigned int nr_perf;
+};
+
+/* scopes where the perf counters are looked for, in this order */
+static const enum bt_ctf_scope perf_scopes[] = {
+	BT_STREAM_EVENT_CONTEXT,
+	BT_STREAM_PACKET_CONTEXT,
+	BT_EVENT_CONTEXT,
+};
+
+/*
+ * struct ctf_event_declaration * -> struct field_cache_entry, one per
+ * thread: the decoder threads read their own context.
+ */
+static __thread GHashTable *field_cache;
+
+/*
+ * All the callbacks of an event look at the same event class, so keep
+ * the last one at hand to skip the hash table lookup.
+ */
+static __thread const struct ctf_event_declaration *last_decl;
+static __thread struct field_cache_entry *last_entry;
+
+/* error of the last get_field_*() */
+static int field_error;
+
+static struct declaration_struct *scope_declaration(
+		const struct ctf_event_declaration *decl, enum bt_ctf_scope scope)
+{
+	switch (scope) {
+	case BT_STREAM_PACKET_CONTEXT:
+		return decl->stream->packet_context_decl;
+	case BT_STREAM_EVENT_CONTEXT:
+		return decl->stream->event_context_decl;
+	case BT_EVENT_CONTEXT:
+		return decl->context_decl;
+	case BT_EVENT_FIELDS:
+		return decl->fields_decl;
+	default:
+		return NULL;
+	}
+}
+
+static int lookup_field_index(struct declaration_struct *scope_decl,
+		const char *name)
+{
+	GQuark quark;
+
+	/* don't create quarks for names that never existed in the metadata */
+	quark = g_quark_try_string(name);
+	if (!quark)
+		return -1;
+
+	return bt_struct_declaration_lookup_field_index(scope_decl, quark);
+}
+
+static enum lttngtop_event_kind classify_event(
+		const struct ctf_event_declaration *decl)
+{
+	const char *name = g_quark_to_string(decl->name);
+
+	if (!name)
+		return EVENT_KIND_OTHER;
+	if (strcmp(name, "sched_switch") == 0)
+		return EVENT_KIND_SCHED_SWITCH;
+	if (strncmp(name, "exit_syscall", 12) == 0 ||
+			strncmp(name, "syscall_exit", 12) == 0)
+		return EVENT_KIND_SYSCALL_EXIT;
+	if (strncmp(name, "sys_", 4) == 0 ||
+			strncmp(name, "syscall_entry", 13) == 0)
+		return EVENT_KIND_SYSCALL_ENTRY;
+
+	return EVENT_KIND_OTHER;
+}
+
+static void resolve_perf_fields(struct field_cache_entry *entry,
+		const struct ctf_event_declaration *decl)
+{
+	struct declaration_struct *scope_decl;
+	struct declaration_field *field;
+	struct perf_field perf;
+	GArray *fields;
+	const char *name;
+	int slot;
+	guint i, j;
+
+	fields = g_array_new(FALSE, FALSE, sizeof(struct perf_field));
+	for (i = 0; i < G_N_ELEMENTS(perf_scopes); i++) {
+		scope_decl = scope_declaration(decl, perf_scopes[i]);
+		if (!scope_decl)
+			continue;
+		for (j = 0; j < scope_decl->fields->len; j++) {
+			field = &g_array_index(scope_decl->fields,
+					struct declaration_field, j);
+			name = g_quark_to_string(field->name);
+			/* the metadata prefixes the names with '_' */
+			if (name[0] == '_')
+				name++;
+			if (strncmp(name, "perf_", 5) != 0)
+				continue;
+			slot = lookup_perf_slot(name);
+			if (slot < 0)
+				continue;
+			perf.scope = perf_scopes[i];
+			perf.index = j;
+			perf.slot = slot;
+			g_array_append_val(fields, perf);
+		}
+	}
+	entry->nr_perf = fields->len;
+	entry->perf = (struct perf_field *) g_array_free(fields,
+			fields->len == 0);
+}
+
+static void free_field_cache_entry(gpointer data)
+{
+	struct field_cache_entry *entry = data;
+
+	g_free(entry->perf);
+	g_free(entry);
+}
+
+static struct field_cache_entry *resolve_fields(
+		const struct ctf_event_declaration *decl)
+{
+	struct field_cache_entry *entry;
+	struct declaration_struct *scope_decl;
+	int i;
+
+	entry = g_new0(struct field_cache_entry, 1);
+	entry->name = decl->name;
+	entry->kind = classify_event(decl);
+	for (i = 0; i < NR_FIELDS; i++) {
+		entry->index[i] = -1;
+		scope_decl = scope_declaration(decl, field_desc[i].scope);
+		if (!scope_decl)
+			continue;
+		entry->index[i] = lookup_field_index(scope_decl,
+				field_desc[i].name);
+		if (entry->index[i] < 0 && field_desc[i].fallback)
+			entry->index[i] = lookup_field_index(scope_decl,
+					field_desc[i].fallback);
+	}
+	resolve_perf_fields(entry, decl);
+	if (!field_cache)
+		field_cache = g_hash_table_new_full(g_direct_hash,
+				g_direct_equal, NULL, free_field_cache_entry);
+	g_hash_table_insert(field_cache, (gpointer) decl, entry);
+
+	return entry;
+}
+
+static struct field_cache_entry *lookup_field_cache(
+		const struct bt_ctf_event *event)
+{
+	struct ctf_stream_definition *stream;
+	const struct ctf_event_declaration *decl;
+	struct field_cache_entry *entry = NULL;
+
+	stream = event->parent->stream;
+	decl = g_ptr_array_index(stream->stream_class->events_by_id,
+			stream->event_id);
+	if (decl == last_decl)
+		return last_entry;
+
+	if (field_cache)
+		entry = g_hash_table_lookup(field_cache, decl);
+	if (!entry)
+		entry = resolve_fields(decl);
+
+	last_decl = decl;
+	last_entry = entry;
+
+	return entry;
+}
+
+static const struct bt_definition *get_field_by_index(
+		const struct bt_ctf_event *event, enum bt_ctf_scope scope_id,
+		int index)
+{
+	const struct bt_definition *scope;
+	struct definition_struct *scope_def;
+
+	scope = bt_ctf_get_top_level_scope(event, scope_id);
+	if (!scope)
+		return NULL;
+	scope_def = container_of(scope, struct definition_struct, p);
+
+	return g_ptr_array_index(scope_def->fields, index);
+}
+
+const struct bt_definition *get_cached_field(const struct bt_ctf_event *event,
+		enum lttngtop_field field)
+{
+	struct field_cache_entry *entry;
+
+	if (!event)
+		return NULL;
+
+	entry = lookup_field_cache(event);
+	if (entry->index[field] < 0)
+		return NULL;
+
+	return get_field_by_index(event, field_desc[field].scope,
+			entry->index[field]);
+}
+
+unsigned int get_cached_perf_fields(const struct bt_ctf_event *event,
+		const struct perf_field **fields)
+{
+	struct field_cache_entry *entry;
+
+	if (!event)
+		return 0;
+
+	entry = lookup_field_cache(event);
+	*fields = entry->perf;
+
+	return entry->nr_perf;
+}
+
+const struct bt_definition *get_perf_field(const struct bt_ctf_event *event,
+		const struct perf_field *field)
+{
+	return get_field_by_index(event, field->scope, field->index);
+}
+
+enum lttngtop_event_kind get_event_kind(const struct bt_ctf_event *event)
+{
+	if (!event)
+		return EVENT_KIND_OTHER;
+
+	return lookup_field_cache(event)->kind;
+}
+
+GQuark get_event_name_quark(const struct bt_ctf_event *event)
+{
+	struct event_record *record;
+
+	record = get_event_record(event);
+	if (record)
+		return record->name;
+
+	return lookup_field_cache(event)->name;
+}
+
+void invalidate_field_cache(void)
+{
+	last_decl = NULL;
+	last_entry = NULL;
+	if (field_cache)
+		g_hash_table_remove_all(field_cache);
+}
+
+void free_field_cache(void)
+{
+	last_decl = NULL;
+	last_entry = NULL;
+	if (field_cache)
+		g_hash_table_destroy(field_cache);
+	field_cache = NULL;
+}
+
+struct event_record *get_event_record(const struct bt_ctf_event *event)
+{
+	if (!event || event->parent)
+		return NULL;
+
+	return container_of(event, struct event_record, event);
+}
+
+uint64_t get_event_timestamp(const struct bt_ctf_event *event)
+{
+	struct event_record *record;
+
+	record = get_event_record(event);
+	if (record)
+		return record->timestamp;
+
+	return bt_ctf_get_timestamp(event);
+}
+
+/* the value of a field of a record, or the error */
+static int record_value(const struct event_record *record,
+		enum lttngtop_field field, int string)
+{
+	if (!(record->present & (1ULL << field)) ||
+			!(record->strings & (1ULL << field)) != !string) {
+		field_error = -EINVAL;
+		return -1;
+	}
+	field_error = 0;
+
+	return 0;
+}
+
+int64_t get_field_int64(const struct bt_ctf_event *event,
+		enum lttngtop_field field)
+{
+	struct event_record *record;
+	int64_t value;
+
+	record = get_event_record(event);
+	if (record)
+		return record_value(record, field, 0) < 0 ?
+			0 : record->values[field];
+
+	value = bt_ctf_get_int64(get_cached_field(event, field));
+	field_error = bt_ctf_field_get_error();
+
+	return value;
+}
+
+uint64_t get_field_uint64(const struct bt_ctf_event *event,
+		enum lttngtop_field field)
+{
+	struct event_record *record;
+	uint64_t value;
+
+	record = get_event_record(event);
+	if (record)
+		return record_value(record, field, 0) < 0 ?
+			0 : (uint64_t) record->values[field];
+
+	value = bt_ctf_get_uint64(get_cached_field(event, field));
+	field_error = bt_ctf_field_get_error();
+
+	return value;
+}
+
+char *get_field_char_array(const struct bt_ctf_event *event,
+		enum lttngtop_field field)
+{
+	struct event_record *record;
+	char *value;
+
+	record = get_event_record(event);
+	if (record)
+		return record_value(record, field, 1) < 0 ?
+			NULL : record->string_values[field];
+
+	value = bt_ctf_get_char_array(get_cached_field(event, field));
+	field_error = bt_ctf_field_get_error();
+
+	return value;
+}
+
+char *get_field_string(const struct bt_ctf_event *event,
+		enum lttngtop_field field)
+{
+	struct event_record *record;
+	char *value;
+
+	record = get_event_record(event);
+	if (record)
+		return record_value(record, field, 1) < 0 ?
+			NULL : record->string_values[field];
+
+	value = bt_ctf_get_string(get_cached_field(event, field));
+	field_error = bt_ctf_field_get_error();
+
+	return value;
+}
+
+int get_field_error(void)
+{
+	int ret = field_error;
+
+	field_error = 0;
+
+	return ret;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FIELD_CACHE_H
+#define _FIELD_CACHE_H
+
+#include <stdint.h>
+#include <glib.h>
+#include <babeltrace/babeltrace-internal.h>
+#include <babeltrace/ctf/events.h>
+#include <babeltrace/ctf/events-internal.h>
+
+/*
+ * Every field read by the callbacks. The name and scope of each one is
+ * defined in field-cache.c, the position of the field in its scope is
+ * resolved once per event class and then read by index.
+ */
+enum lttngtop_field {
+	/* BT_STREAM_PACKET_CONTEXT */
+	FIELD_CPU_ID = 0,
+	/* BT_STREAM_EVENT_CONTEXT */
+	FIELD_CTX_PID,
+	FIELD_CTX_TID,
+	FIELD_CTX_PPID,
+	FIELD_CTX_VPID,
+	FIELD_CTX_VTID,
+	FIELD_CTX_VPPID,
+	FIELD_CTX_PROCNAME,
+	FIELD_CTX_HOSTNAME,
+	/* BT_EVENT_FIELDS */
+	FIELD_PREV_COMM,
+	FIELD_NEXT_COMM,
+	FIELD_PREV_TID,
+	FIELD_NEXT_TID,
+	FIELD_COMM,
+	FIELD_TID,
+	FIELD_CHILD_COMM,
+	FIELD_CHILD_TID,
+	FIELD_PARENT_PID,
+	FIELD_RET,
+	FIELD_FD,
+	FIELD_FILENAME,
+	FIELD_PID,
+	FIELD_PPID,
+	FIELD_VPID,
+	FIELD_VTID,
+	FIELD_VPPID,
+	FIELD_NAME,
+	NR_FIELDS,
+};
+
+/*
+ * Event classes treated specially by textdump, resolved once per event
+ * class from the event name.
+ */
+enum lttngtop_event_kind {
+	EVENT_KIND_OTHER = 0,
+	EVENT_KIND_SCHED_SWITCH,
+	EVENT_KIND_SYSCALL_ENTRY,	/* sys_* and syscall_entry_* */
+	EVENT_KIND_SYSCALL_EXIT,	/* exit_syscall and syscall_exit_* */
+};
+
+/*
+ * Return the definition of the field for this event or NULL if the
+ * event class does not have it. The value is read with the usual
+ * bt_ctf_get_* functions which set the field error on NULL.
+ */
+const struct bt_definition *get_cached_field(const struct bt_ctf_event *event,
+		enum lttngtop_field field);
+
+enum lttngtop_event_kind get_event_kind(const struct bt_ctf_event *event);
+
+/*
+ * perf_* context field of an event class, with the slot of the counter
+ * given by register_perf_counter().
+ */
+struct perf_field {
+	enum bt_ctf_scope scope;
+	int index;
+	unsigned int slot;
+};
+
+/*
+ * Return the number of registered perf counters in the contexts of this
+ * event and set fields to their description.
+ */
+unsigned int get_cached_perf_fields(const struct bt_ctf_event *event,
+		const struct perf_field **fields);
+const struct bt_definition *get_perf_field(const struct bt_ctf_event *event,
+		const struct perf_field *field);
+
+/* name of the event class, the quark the callbacks are registered with */
+GQuark get_event_name_quark(const struct bt_ctf_event *event);
+
+/*
+ * Forget all the resolved event classes, must be called when the
+ * metadata changes or when a trace is removed from the context.
+ */
+void invalidate_field_cache(void);
+
+/*
+ * Each thread resolves the event classes of its own context, a thread
+ * releases its cache before exiting.
+ */
+void free_field_cache(void);
+
+struct record_perf {
+	unsigned int slot;
+	uint64_t value;
+};
+
+/*
+ * Event merged from the decoder threads (see decoders.h), the callbacks
+ * get its event member whose parent is NULL. The fields were read by the
+ * decoder, the strings point in its queue and are only valid until the
+ * next event, like the ones of the iterator.
+ */
+struct event_record {
+	struct bt_ctf_event event;
+	/* order in the merge, tells the events apart for the context cache */
+	uint64_t seq;
+	uint64_t timestamp;
+	GQuark name;
+	/* (1ULL << field) set for the fields of the event, and the strings */
+	uint64_t present;
+	uint64_t strings;
+	int64_t values[NR_FIELDS];
+	char *string_values[NR_FIELDS];
+	unsigned int nr_perf;
+	struct record_perf *perf;
+};
+
+/* NULL for an event of the iterator */
+struct event_record *get_event_record(const struct bt_ctf_event *event);
+
+/*
+ * The callbacks read the events of the iterator and the merged ones with
+ * these functions, they set the error returned by get_field_error() like
+ * the bt_ctf_get_* ones.
+ */
+uint64_t get_event_timestamp(const struct bt_ctf_event *event);
+int64_t get_field_int64(const struct bt_ctf_event *event,
+		enum lttngtop_field field);
+uint64_t get_field_uint64(const struct bt_ctf_event *event,
+		enum lttngtop_field field);
+char *get_field_char_array(const struct bt_ctf_event *event,
+		enum lttngtop_field field);
+char *get_field_string(const struct bt_ctf_event *event,
+		enum lttngtop_field field);
+/* error of the last field read, cleared once returned */
+int get_field_error(void);
+
+#endif /* _FIELD_CACHE_H */
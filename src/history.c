@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <glib.h>
+#include <urcu.h>
+
+#include "common.h"
+#include "compact-history.h"
+#include "history.h"
+
+/*
+ * The snapshots older than the HISTORY_FULL_SNAPSHOTS last ones are
+ * compacted, only the processes changed since the previous snapshot are
+ * kept, by column as the differences with their previous values, with a
+ * keyframe every HISTORY_KEYFRAME_INTERVAL snapshots. They are decoded
+ * when they are selected.
+ */
+#define HISTORY_FULL_SNAPSHOTS		10
+#define HISTORY_KEYFRAME_INTERVAL	60
+
+struct history_entry {
+	struct lttngtop *snapshot;		/* NULL when compacted */
+	struct compact_snapshot *compact;
+	/* end of the period, to find it without decoding it */
+	unsigned long end;
+};
+
+/*
+ * The snapshot of index i is in ring[i % ring_size]. The tracing thread
+ * adds the snapshots while the display and keyboard threads select them,
+ * history_lock protects the ring. The full and compact snapshots are
+ * refcounted, the compact ones are decoded without the lock. The oldest
+ * compacted snapshot is always a keyframe.
+ */
+static pthread_mutex_t history_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct history_entry *ring;
+static unsigned int ring_size;
+static unsigned int ring_count;
+static unsigned int first_index;
+/* index of the next snapshot to compact */
+static unsigned int compact_index;
+static unsigned int since_keyframe;
+static unsigned long history_mem, history_max_mem;
+
+/*
+ * The last snapshot added is published without history_lock so the
+ * display never waits for the tracing thread and the other way around:
+ * the tracing thread swaps the pointer, the previous one is released
+ * after a grace period.
+ */
+struct latest_snapshot {
+	/* reference held until the grace period ends */
+	struct lttngtop *snapshot;
+	unsigned int index;
+	struct rcu_head rcu_head;
+};
+
+static struct latest_snapshot *latest;
+
+int init_history(unsigned int max_snapshots, unsigned long max_mem)
+{
+	if (max_snapshots == 0) {
+		fprintf(stderr, "[error] The history must keep at least "
+				"one snapshot\n");
+		return -1;
+	}
+	ring = g_new0(struct history_entry, max_snapshots);
+	ring_size = max_snapshots;
+	history_max_mem = max_mem;
+
+	return 0;
+}
+
+static void put_snapshot(struct lttngtop *snapshot)
+{
+	if (snapshot && g_atomic_int_dec_and_test(&snapshot->refcount))
+		free_lttngtop_snapshot(snapshot);
+}
+
+static void free_latest(struct rcu_head *head)
+{
+	struct latest_snapshot *old;
+
+	old = caa_container_of(head, struct latest_snapshot, rcu_head);
+	put_snapshot(old->snapshot);
+	g_free(old);
+}
+
+static struct history_entry *get_entry(unsigned int index)
+{
+	return &ring[index % ring_size];
+}
+
+/*
+ * Must be called with history_lock held, return the full snapshot to
+ * release when the lock is released.
+ */
+static struct lttngtop *evict_oldest(void)
+{
+	struct history_entry *entry, *next;
+	struct compact_snapshot *keyframe;
+	struct lttngtop *snapshot;
+
+	entry = get_entry(first_index);
+	snapshot = entry->snapshot;
+	if (snapshot)
+		history_mem -= snapshot->mem_size;
+
+	/* the next compact snapshot becomes the oldest one */
+	next = get_entry(first_index + 1);
+	if (entry->compact && ring_count > 1 && next->compact &&
+			!next->compact->keyframe) {
+		keyframe = rebase_compact_snapshot(entry->compact,
+				next->compact);
+		history_mem -= next->compact->mem_size;
+		put_compact_snapshot(next->compact);
+		next->compact = keyframe;
+		history_mem += keyframe->mem_size;
+	}
+	if (entry->compact) {
+		history_mem -= entry->compact->mem_size;
+		put_compact_snapshot(entry->compact);
+	}
+	entry->snapshot = NULL;
+	entry->compact = NULL;
+	first_index++;
+	ring_count--;
+
+	return snapshot;
+}
+
+/*
+ * Must be called with history_lock held, return the full snapshot to
+ * release when the lock is released.
+ */
+static struct lttngtop *compact_next(void)
+{
+	struct history_entry *entry;
+	struct lttngtop *snapshot;
+	int keyframe;
+
+	/* the previous snapshot was evicted before being compacted */
+	if (compact_index < first_index) {
+		compact_index = first_index;
+		since_keyframe = 0;
+	}
+	keyframe = (compact_index == first_index || since_keyframe == 0);
+
+	entry = get_entry(compact_index);
+	snapshot = entry->snapshot;
+	entry->compact = compact_snapshot(snapshot, keyframe);
+	entry->snapshot = NULL;
+	history_mem -= snapshot->mem_size;
+	history_mem += entry->compact->mem_size;
+
+	compact_index++;
+	since_keyframe = (since_keyframe + 1) % HISTORY_KEYFRAME_INTERVAL;
+	if (keyframe)
+		since_keyframe = 1;
+
+	return snapshot;
+}
+
+void add_history(struct lttngtop *snapshot)
+{
+	struct latest_snapshot *new, *old;
+	GPtrArray *released;
+	unsigned int i;
+
+	released = g_ptr_array_new();
+	/* references held by the history and the latest snapshot */
+	snapshot->refcount = 2;
+	new = g_new0(struct latest_snapshot, 1);
+	new->snapshot = snapshot;
+
+	pthread_mutex_lock(&history_lock);
+	if (ring_count == ring_size)
+		g_ptr_array_add(released, evict_oldest());
+	new->index = first_index + ring_count;
+	get_entry(new->index)->snapshot = snapshot;
+	get_entry(new->index)->end = snapshot->end;
+	ring_count++;
+	history_mem += snapshot->mem_size;
+
+	while (first_index + ring_count - MAX(compact_index, first_index) >
+			HISTORY_FULL_SNAPSHOTS)
+		g_ptr_array_add(released, compact_next());
+
+	/* always keep the last snapshot */
+	while (history_max_mem && history_mem > history_max_mem &&
+			ring_count > 1)
+		g_ptr_array_add(released, evict_oldest());
+	pthread_mutex_unlock(&history_lock);
+
+	old = rcu_xchg_pointer(&latest, new);
+	if (old)
+		call_rcu(&old->rcu_head, free_latest);
+
+	for (i = 0; i < released->len; i++)
+		put_snapshot(g_ptr_array_index(released, i));
+	g_ptr_array_free(released, TRUE);
+}
+
+int select_latest_history(struct lttngtop **current, unsigned int *index)
+{
+	struct latest_snapshot *p;
+	struct lttngtop *old;
+
+	rcu_read_lock();
+	p = rcu_dereference(latest);
+	if (!p) {
+		rcu_read_unlock();
+		return -1;
+	}
+	old = *current;
+	*current = p->snapshot;
+	g_atomic_int_inc(&(*current)->refcount);
+	*index = p->index;
+	rcu_read_unlock();
+
+	put_snapshot(old);
+
+	return 0;
+}
+
+/*
+ * Must be called with history_lock held, return the compact snapshots
+ * from the last keyframe up to index with a reference held on each.
+ */
+static struct compact_snapshot **get_chain(unsigned int index,
+		unsigned int *len)
+{
+	struct compact_snapshot **chain;
+	unsigned int first, i;
+
+	first = index;
+	while (first > first_index && !get_entry(first)->compact->keyframe)
+		first--;
+
+	*len = index - first + 1;
+	chain = g_new(struct compact_snapshot *, *len);
+	for (i = first; i <= index; i++) {
+		chain[i - first] = get_entry(i)->compact;
+		get_compact_snapshot(chain[i - first]);
+	}
+
+	return chain;
+}
+
+/* the decoded snapshot is only referenced by the caller */
+static struct lttngtop *decode_chain(struct compact_snapshot **chain,
+		unsigned int len)
+{
+	struct lttngtop *snapshot;
+	unsigned int i;
+
+	snapshot = decode_compact_snapshot(chain, len);
+	for (i = 0; i < len; i++)
+		put_compact_snapshot(chain[i]);
+	g_free(chain);
+
+	snapshot->refcount = 1;
+
+	return snapshot;
+}
+
+int select_history(struct lttngtop **current, unsigned int index)
+{
+	struct compact_snapshot **chain = NULL;
+	struct history_entry *entry;
+	struct lttngtop *old, *snapshot = NULL;
+	unsigned int len;
+
+	pthread_mutex_lock(&history_lock);
+	if (index < first_index || index - first_index >= ring_count) {
+		pthread_mutex_unlock(&history_lock);
+		return -1;
+	}
+	entry = get_entry(index);
+	if (entry->snapshot) {
+		snapshot = entry->snapshot;
+		g_atomic_int_inc(&snapshot->refcount);
+	} else {
+		chain = get_chain(index, &len);
+	}
+	pthread_mutex_unlock(&history_lock);
+
+	/* add_history() does not wait for the decoding */
+	if (chain)
+		snapshot = decode_chain(chain, len);
+	old = *current;
+	*current = snapshot;
+	put_snapshot(old);
+
+	return 0;
+}
+
+void release_history(struct lttngtop **current)
+{
+	put_snapshot(*current);
+	*current = NULL;
+}
+
+int find_history_before(unsigned long time, unsigned int *index)
+{
+	unsigned long best = 0;
+	unsigned int i;
+	int ret = -1;
+
+	pthread_mutex_lock(&history_lock);
+	for (i = first_index; i - first_index < ring_count; i++) {
+		if (get_entry(i)->end > time || get_entry(i)->end < best)
+			continue;
+		best = get_entry(i)->end;
+		*index = i;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&history_lock);
+
+	return ret;
+}
+
+int history_empty(void)
+{
+	int empty;
+
+	rcu_read_lock();
+	empty = rcu_dereference(latest) == NULL;
+	rcu_read_unlock();
+
+	return empty;
+}
+
+void register_history_thread(void)
+{
+	rcu_register_thread();
+}
+
+void unregister_history_thread(void)
+{
+	rcu_unregister_thread();
+}
+
+unsigned int history_first_index(void)
+{
+	unsigned int index;
+
+	pthread_mutex_lock(&history_lock);
+	index = first_index;
+	pthread_mutex_unlock(&history_lock);
+
+	return index;
+}
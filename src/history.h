@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include "lttngtoptypes.h"
+
+/* one hour of history with the default refresh rate */
+#define DEFAULT_HISTORY_SIZE	3600
+
+/*
+ * The snapshots are kept in a ring of at most max_snapshots entries and
+ * max_mem bytes (0 for no memory limit), the oldest ones are freed first.
+ * Each snapshot is identified by its index, starting at 0 and increasing
+ * for each snapshot added.
+ */
+int init_history(unsigned int max_snapshots, unsigned long max_mem);
+/* never waits for the threads reading the history */
+void add_history(struct lttngtop *snapshot);
+
+/*
+ * Replace *current by the snapshot at index, the snapshot is kept until
+ * it is replaced even if it is evicted from the history in the meantime.
+ * The threads sharing *current serialize the replacements and the reads.
+ * Return -1 if the snapshot is not in the history anymore.
+ */
+int select_history(struct lttngtop **current, unsigned int index);
+
+/* release the snapshot selected in *current and set it to NULL */
+void release_history(struct lttngtop **current);
+
+/*
+ * Give the index of the snapshot whose period ends the last at or before
+ * time, the snapshots are not in the order of the trace after a jump.
+ * Return -1 if there is none.
+ */
+int find_history_before(unsigned long time, unsigned int *index);
+
+/*
+ * Replace *current by the last snapshot added and give its index, without
+ * taking the lock of the history. Return -1 if no snapshot was added yet.
+ */
+int select_latest_history(struct lttngtop **current, unsigned int *index);
+
+/* no snapshot was added yet */
+int history_empty(void);
+
+/*
+ * The threads calling add_history() or select_latest_history() must be
+ * registered while they use the history.
+ */
+void register_history_thread(void);
+void unregister_history_thread(void);
+
+/* index of the oldest snapshot still in the history */
+unsigned int history_first_index(void);
+
+#endif /* _HISTORY_H */
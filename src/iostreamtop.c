@@ -24,8 +24,49 @@
 
 #include "lttngtoptypes.h"
 #include "common.h"
+#include "field-cache.h"
+#include "pool.h"
 #include "iostreamtop.h"
 
+static struct pool files_pool = POOL_INIT(struct files);
+static struct pool file_history_pool = POOL_INIT(struct file_history);
+
+struct files *new_file(void)
+{
+	return pool_alloc0(&files_pool);
+}
+
+void free_file(struct files *file)
+{
+	/* the files tables have holes */
+	if (!file)
+		return;
+	put_name(file->name);
+	pool_free(&files_pool, file);
+}
+
+/*
+ * The history only keeps the files of the opens waiting for their exit,
+ * the file belongs to the process files table once the open returns.
+ */
+static struct files *pop_file_history(struct processtop *proc)
+{
+	struct file_history *head = proc->files_history;
+	struct files *file;
+
+	file = head->file;
+	proc->files_history = head->next;
+	pool_free(&file_history_pool, head);
+
+	return file;
+}
+
+void free_files_history(struct processtop *proc)
+{
+	while (proc->files_history)
+		free_file(pop_file_history(proc));
+}
+
 void add_file(struct processtop *proc, struct files *file, int fd)
 {
 	struct files *tmp_file;
@@ -33,6 +74,7 @@ void add_file(struct processtop *proc, struct files *file, int fd)
 	int size;
 	int i;
 
+	proc->dirty = 1;
 	size = proc->process_files_table->len;
 	parent = proc->threadparent;
 	if (parent)
@@ -86,8 +128,9 @@ void edit_file(struct processtop *proc, struct files *file, int fd)
 	} else {
 		tmpfile = g_ptr_array_index(proc->process_files_table, fd);
 		if (tmpfile) {
-			tmpfile->name = strdup(file->name);
-			free(file);
+			set_name(&tmpfile->name, file->name);
+			proc->dirty = 1;
+			free_file(file);
 		} else
 			add_file(proc, file, fd);
 	}
@@ -102,20 +145,14 @@ void insert_file(struct processtop *proc, int fd)
 	if (fd < 0)
 		return;
 	if (fd >= proc->process_files_table->len) {
-		tmp = g_new0(struct files, 1);
-		tmp->name = NULL;
-		tmp->read = 0;
-		tmp->write = 0;
+		tmp = new_file();
 		tmp->fd = fd;
 		tmp->flag = -1;
 		add_file(proc, tmp, fd);
 	} else {
 		tmp = g_ptr_array_index(proc->process_files_table, fd);
 		if (tmp == NULL) {
-			tmp = g_new0(struct files, 1);
-			tmp->name = NULL;
-			tmp->read = 0;
-			tmp->write = 0;
+			tmp = new_file();
 			tmp->fd = fd;
 			tmp->flag = -1;
 			add_file(proc, tmp, fd);
@@ -126,7 +163,7 @@ void insert_file(struct processtop *proc, int fd)
 					parent->process_files_table, fd);
 				if (tmp_parent && tmp->name && tmp_parent->name &&
 				   (strcmp(tmp->name, tmp_parent->name)) != 0)
-					tmp->name = strdup(tmp_parent->name);
+					set_name(&tmp->name, tmp_parent->name);
 			}
 		}
 	}
@@ -137,8 +174,16 @@ void close_file(struct processtop *proc, int fd)
 	struct files *file;
 
 	file = get_file(proc, fd);
+	/* the parent finds if the file was opened before the window */
+	if (file == NULL && carried_state && fd >= 0) {
+		file = new_file();
+		file->fd = fd;
+		file->flag = -1;
+		add_file(proc, file, fd);
+	}
 	if (file != NULL) {
 		file->flag = __NR_close;
+		proc->dirty = 1;
 		lttngtop.nbfiles--;
 		/*
 		if (file->name) {
@@ -209,63 +254,69 @@ int update_iostream_ret(struct lttngtop *ctx, int tid, char *comm,
 		err = -1;
 		goto end;
 	}
-	if (tmp->syscall_info != NULL) {
-		if (tmp->syscall_info->type == __NR_read
+	if (tmp->syscall_pending) {
+		if (tmp->syscall_info.type == __NR_read
 			&& ret > 0) {
 			tmp->totalfileread += ret;
 			tmp->fileread += ret;
-			tmpfile = get_file(tmp, tmp->syscall_info->fd);
+			tmpfile = get_file(tmp, tmp->syscall_info.fd);
 			if (tmpfile)
 				tmpfile->read += ret;
-		} else if (tmp->syscall_info->type == __NR_write
+		} else if (tmp->syscall_info.type == __NR_write
 			&& ret > 0) {
 			tmp->totalfilewrite += ret;
 			tmp->filewrite += ret;
-			tmpfile = get_file(tmp, tmp->syscall_info->fd);
+			tmpfile = get_file(tmp, tmp->syscall_info.fd);
 			if (tmpfile)
 				tmpfile->write += ret;
-		} else if (tmp->syscall_info->type == __NR_open
-			&& ret > 0) {
-			tmpfile = tmp->files_history->file;
-			add_file(tmp, tmpfile, ret);
-			tmpfile->fd = ret;
+		} else if (tmp->syscall_info.type == __NR_open
+			&& tmp->files_history) {
+			tmpfile = pop_file_history(tmp);
+			if (ret > 0) {
+				add_file(tmp, tmpfile, ret);
+				tmpfile->fd = ret;
+			} else {
+				free_file(tmpfile);
+				err = -1;
+			}
 		} else {
 			err = -1;
 		}
-		g_free(tmp->syscall_info);
-		tmp->syscall_info = NULL;
+		tmp->syscall_pending = 0;
  	}
 
 end:
 	return err;
 }
 
-struct syscalls *create_syscall_info(unsigned int type, uint64_t cpu_id,
-		unsigned int tid, int fd)
+void set_syscall_info(struct processtop *proc, unsigned int type,
+		uint64_t cpu_id, unsigned int tid, int fd)
+{
+	memset(&proc->syscall_info, 0, sizeof(struct syscalls));
+	proc->syscall_info.type = type;
+	proc->syscall_info.cpu_id = cpu_id;
+	proc->syscall_info.tid = tid;
+	proc->syscall_info.fd = fd;
+	proc->syscall_pending = 1;
+}
+
+static struct files *new_named_file(char *file_name)
 {
-	struct syscalls *syscall_info;
-	
-	syscall_info = g_new0(struct syscalls, 1);
-	syscall_info->type = type;
-	syscall_info->cpu_id = cpu_id;
-	syscall_info->tid = tid;
-	syscall_info->fd = fd;
-
-	return syscall_info;
+	struct files *file;
+
+	file = new_file();
+	file->name = intern_name(file_name);
+	file->flag = -1;
+
+	return file;
 }
 
 struct file_history *create_file(struct file_history *history, char *file_name)
 {
-	struct files *new_file;
 	struct file_history *new_history;
 
-	new_file = g_new0(struct files, 1);
-	new_history = g_new0(struct file_history, 1);
-	new_file->name = strdup(file_name);
-	new_file->read = 0;
-	new_file->write = 0;
-	new_file->flag = -1;
-	new_history->file = new_file;
+	new_history = pool_alloc(&file_history_pool);
+	new_history->file = new_named_file(file_name);
 	new_history->next = history;
 
 	return new_history;
@@ -274,25 +325,22 @@ struct file_history *create_file(struct file_history *history, char *file_name)
 enum bt_cb_ret handle_exit_syscall(struct bt_ctf_event *call_data,
 		void *private_data)
 {
-	const struct bt_definition *scope;
 	unsigned long timestamp;
 	char *comm;
 	uint64_t ret, tid;
 	uint64_t cpu_id;
 	char *hostname;
 
-	timestamp = bt_ctf_get_timestamp(call_data);
+	timestamp = get_event_timestamp(call_data);
 	if (timestamp == -1ULL)
 		goto error;
 
 	comm = get_context_comm(call_data);
 	tid = get_context_tid(call_data);
 
-	scope = bt_ctf_get_top_level_scope(call_data,
-			BT_EVENT_FIELDS);
-	ret = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-				scope, "_ret"));
-	if (bt_ctf_field_get_error()) {
+	ret = get_field_int64(call_data,
+				FIELD_RET);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing ret context info\n");
 		goto error;
 	}
@@ -319,7 +367,6 @@ error:
 enum bt_cb_ret handle_sys_write(struct bt_ctf_event *call_data,
 		void *private_data)
 {
-	const struct bt_definition *scope;
 	struct processtop *tmp;
 	unsigned long timestamp;
 	uint64_t cpu_id;
@@ -327,7 +374,7 @@ enum bt_cb_ret handle_sys_write(struct bt_ctf_event *call_data,
 	char *procname, *hostname;
 	int fd;
 
-	timestamp = bt_ctf_get_timestamp(call_data);
+	timestamp = get_event_timestamp(call_data);
 	if (timestamp == -1ULL)
 		goto error;
 
@@ -337,11 +384,9 @@ enum bt_cb_ret handle_sys_write(struct bt_ctf_event *call_data,
 	procname = get_context_comm(call_data);
 	hostname = get_context_hostname(call_data);
 
-	scope = bt_ctf_get_top_level_scope(call_data,
-			BT_EVENT_FIELDS);
-	fd = bt_ctf_get_uint64(bt_ctf_get_field(call_data,
-				scope, "_fd"));
-	if (bt_ctf_field_get_error()) {
+	fd = get_field_uint64(call_data,
+				FIELD_FD);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing fd context info\n");
 		goto error;
 	}
@@ -350,7 +395,7 @@ enum bt_cb_ret handle_sys_write(struct bt_ctf_event *call_data,
 	if (!tmp)
 		goto end;
 
-	tmp->syscall_info = create_syscall_info(__NR_write, cpu_id, tid, fd);
+	set_syscall_info(tmp, __NR_write, cpu_id, tid, fd);
 
 	insert_file(tmp, fd);
 
@@ -365,7 +410,6 @@ enum bt_cb_ret handle_sys_read(struct bt_ctf_event *call_data,
 		void *private_data)
 {
 	struct processtop *tmp;
-	const struct bt_definition *scope;
 	unsigned long timestamp;
 	uint64_t cpu_id;
 	int64_t tid;
@@ -373,7 +417,7 @@ enum bt_cb_ret handle_sys_read(struct bt_ctf_event *call_data,
 	int fd;
 	char *hostname;
 
-	timestamp = bt_ctf_get_timestamp(call_data);
+	timestamp = get_event_timestamp(call_data);
 	if (timestamp == -1ULL)
 		goto error;
 
@@ -383,11 +427,9 @@ enum bt_cb_ret handle_sys_read(struct bt_ctf_event *call_data,
 	procname = get_context_comm(call_data);
 	hostname = get_context_hostname(call_data);
 
-	scope = bt_ctf_get_top_level_scope(call_data,
-			BT_EVENT_FIELDS);
-	fd = bt_ctf_get_uint64(bt_ctf_get_field(call_data,
-				scope, "_fd"));
-	if (bt_ctf_field_get_error()) {
+	fd = get_field_uint64(call_data,
+				FIELD_FD);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing fd context info\n");
 		goto error;
 	}
@@ -396,7 +438,7 @@ enum bt_cb_ret handle_sys_read(struct bt_ctf_event *call_data,
 	if (!tmp)
 		goto end;
 
-	tmp->syscall_info = create_syscall_info(__NR_read, cpu_id, tid, fd);
+	set_syscall_info(tmp, __NR_read, cpu_id, tid, fd);
 
 	insert_file(tmp, fd);
 
@@ -412,14 +454,13 @@ enum bt_cb_ret handle_sys_open(struct bt_ctf_event *call_data,
 {
 
 	struct processtop *tmp;
-	const struct bt_definition *scope;
 	unsigned long timestamp;
 	uint64_t cpu_id;
 	int64_t tid;
 	char *procname, *hostname;
 	char *file;
 
-	timestamp = bt_ctf_get_timestamp(call_data);
+	timestamp = get_event_timestamp(call_data);
 	if (timestamp == -1ULL)
 		goto error;
 
@@ -429,11 +470,9 @@ enum bt_cb_ret handle_sys_open(struct bt_ctf_event *call_data,
 	procname = get_context_comm(call_data);
 	hostname = get_context_hostname(call_data);
 
-	scope = bt_ctf_get_top_level_scope(call_data,
-			BT_EVENT_FIELDS);
-	file = bt_ctf_get_string(bt_ctf_get_field(call_data,
-				scope, "_filename"));
-	if (bt_ctf_field_get_error()) {
+	file = get_field_string(call_data,
+				FIELD_FILENAME);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing file name context info\n");
 		goto error;
 	}
@@ -442,7 +481,7 @@ enum bt_cb_ret handle_sys_open(struct bt_ctf_event *call_data,
 	if (!tmp)
 		goto end;
 
-	tmp->syscall_info = create_syscall_info(__NR_open, cpu_id, tid, -1);
+	set_syscall_info(tmp, __NR_open, cpu_id, tid, -1);
 
 	tmp->files_history = create_file(tmp->files_history, file);
 
@@ -464,7 +503,7 @@ enum bt_cb_ret handle_sys_socket(struct bt_ctf_event *call_data,
 	char *procname, *hostname;
 	char *file;
 
-	timestamp = bt_ctf_get_timestamp(call_data);
+	timestamp = get_event_timestamp(call_data);
 	if (timestamp == -1ULL)
 		goto error;
 
@@ -474,13 +513,13 @@ enum bt_cb_ret handle_sys_socket(struct bt_ctf_event *call_data,
 	procname = get_context_comm(call_data);
 	hostname = get_context_hostname(call_data);
 
-	file = strdup("socket");
+	file = "socket";
 
 	tmp = get_proc(&lttngtop, tid, procname, timestamp, hostname);
 	if (!tmp)
 		goto end;
 
-	tmp->syscall_info = create_syscall_info(__NR_open, cpu_id, tid, -1);
+	set_syscall_info(tmp, __NR_open, cpu_id, tid, -1);
 
 	tmp->files_history = create_file(tmp->files_history, file);
 
@@ -494,7 +533,6 @@ error:
 enum bt_cb_ret handle_sys_close(struct bt_ctf_event *call_data,
 		void *private_data)
 {
-	const struct bt_definition *scope;
 	struct processtop *tmp;
 	unsigned long timestamp;
 	int64_t tid;
@@ -502,7 +540,7 @@ enum bt_cb_ret handle_sys_close(struct bt_ctf_event *call_data,
 	int fd;
 	char *hostname;
 
-	timestamp = bt_ctf_get_timestamp(call_data);
+	timestamp = get_event_timestamp(call_data);
 	if (timestamp == -1ULL)
 		goto error;
 
@@ -511,11 +549,9 @@ enum bt_cb_ret handle_sys_close(struct bt_ctf_event *call_data,
 	procname = get_context_comm(call_data);
 	hostname = get_context_hostname(call_data);
 
-	scope = bt_ctf_get_top_level_scope(call_data,
-			BT_EVENT_FIELDS);
-	fd = bt_ctf_get_uint64(bt_ctf_get_field(call_data,
-				scope, "_fd"));
-	if (bt_ctf_field_get_error()) {
+	fd = get_field_uint64(call_data,
+				FIELD_FD);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing fd context info\n");
 		goto error;
 	}
@@ -536,7 +572,6 @@ error:
 enum bt_cb_ret handle_statedump_file_descriptor(struct bt_ctf_event *call_data,
 		void *private_data)
 {
-	const struct bt_definition *scope;
 	struct processtop *parent;
 	struct files *file;
 	unsigned long timestamp;
@@ -544,33 +579,27 @@ enum bt_cb_ret handle_statedump_file_descriptor(struct bt_ctf_event *call_data,
 	char *file_name, *hostname;
 	int fd;
 
-	timestamp = bt_ctf_get_timestamp(call_data);
+	timestamp = get_event_timestamp(call_data);
 	if (timestamp == -1ULL)
 		goto error;
 
-	scope = bt_ctf_get_top_level_scope(call_data,
-			 BT_EVENT_FIELDS);
-	pid = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-			     scope, "_pid"));
-	if (bt_ctf_field_get_error()) {
+	pid = get_field_int64(call_data,
+			FIELD_PID);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing tid context info\n");
 		goto error;
 	}
 
-	scope = bt_ctf_get_top_level_scope(call_data,
-			BT_EVENT_FIELDS);
-	fd = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-				scope, "_fd"));
-	if (bt_ctf_field_get_error()) {
+	fd = get_field_int64(call_data,
+				FIELD_FD);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing fd context info\n");
 		goto error;
 	}
 
-	scope = bt_ctf_get_top_level_scope(call_data,
-			BT_EVENT_FIELDS);
-	file_name = bt_ctf_get_string(bt_ctf_get_field(call_data,
-				scope, "_filename"));
-	if (bt_ctf_field_get_error()) {
+	file_name = get_field_string(call_data,
+				FIELD_FILENAME);
+	if (get_field_error()) {
 		fprintf(stderr, "Missing file name context info\n");
 		goto error;
 	}
@@ -580,8 +609,7 @@ enum bt_cb_ret handle_statedump_file_descriptor(struct bt_ctf_event *call_data,
 	if (!parent)
 		goto end;
 
-	parent->files_history = create_file(parent->files_history, file_name);
-	file = parent->files_history->file;
+	file = new_named_file(file_name);
 	edit_file(parent, file, fd);
 
 end:
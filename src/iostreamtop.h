@@ -24,6 +24,9 @@
 #include <glib.h>
 #include <asm/unistd.h>
 
+struct files *new_file(void);
+void free_file(struct files *file);
+void free_files_history(struct processtop *proc);
 struct files *get_file(struct processtop *proc, int fd);
 void show_table(GPtrArray *tab);
 void insert_file(struct processtop *proc, int fd);
@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include <babeltrace/endian.h>
+#include <babeltrace/ctf/ctf-index.h>
+
+#include "lttng-viewer-abi.h"
+#include "live-record.h"
+
+/* the relay sends the fields of the CTF index 1.0 */
+#define RECORD_INDEX_MINOR	0
+#define RECORD_INDEX_LEN	offsetof(struct ctf_packet_index, stream_instance_id)
+
+struct live_record {
+	int fd;
+	int index_fd;		/* -1 for the metadata */
+	uint64_t offset;	/* end of the data file */
+};
+
+static int record_dirfd = -1;
+static int record_error;
+
+static void record_failed(const char *path)
+{
+	fprintf(stderr, "[error] Recording the live trace in %s: %s, "
+			"recording stopped\n", path, strerror(errno));
+	record_error = 1;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, p, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		p += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* the paths come from the relay, they must stay in the record directory */
+static int check_path(const char *path)
+{
+	gchar **parts;
+	int i, ret = 0;
+
+	parts = g_strsplit(path, "/", -1);
+	for (i = 0; parts[i]; i++) {
+		if (!strcmp(parts[i], "..")) {
+			ret = -1;
+			break;
+		}
+	}
+	g_strfreev(parts);
+	return ret;
+}
+
+static int make_dirs(const char *path)
+{
+	char *dir, *p;
+	int ret = 0, last;
+
+	dir = g_strdup(path);
+	for (p = dir; ; p++) {
+		if (*p != '/' && *p != '\0')
+			continue;
+		last = (*p == '\0');
+		*p = '\0';
+		if (*dir && mkdirat(record_dirfd, dir, 0755) < 0 &&
+				errno != EEXIST) {
+			ret = -1;
+			break;
+		}
+		if (last)
+			break;
+		*p = '/';
+	}
+	g_free(dir);
+	return ret;
+}
+
+int live_record_init(const char *dir)
+{
+	if (!dir)
+		return 0;
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+		goto error;
+	record_dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (record_dirfd < 0)
+		goto error;
+	return 0;
+
+error:
+	fprintf(stderr, "[error] Cannot open the record directory %s: %s\n",
+			dir, strerror(errno));
+	return -1;
+}
+
+int live_record_enabled(void)
+{
+	return record_dirfd >= 0 && !record_error;
+}
+
+static int open_index(struct live_record *rec, const char *path,
+		const char *name)
+{
+	struct ctf_packet_index_file_hdr hdr;
+	char *dir, *file;
+	int ret = -1;
+
+	dir = g_build_filename(path, "index", NULL);
+	file = g_strdup_printf("%s/%s.idx", dir, name);
+	if (make_dirs(dir) < 0)
+		goto end;
+	rec->index_fd = openat(record_dirfd, file,
+			O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (rec->index_fd < 0)
+		goto end;
+
+	hdr.magic = htobe32(CTF_INDEX_MAGIC);
+	hdr.index_major = htobe32(CTF_INDEX_MAJOR);
+	hdr.index_minor = htobe32(RECORD_INDEX_MINOR);
+	hdr.packet_index_len = htobe32(RECORD_INDEX_LEN);
+	ret = write_full(rec->index_fd, &hdr, sizeof(hdr));
+
+end:
+	if (ret < 0)
+		record_failed(file);
+	g_free(file);
+	g_free(dir);
+	return ret;
+}
+
+struct live_record *live_record_open(const char *path, const char *name,
+		int with_index)
+{
+	struct live_record *rec;
+	char *file;
+
+	if (!live_record_enabled())
+		return NULL;
+
+	while (*path == '/')
+		path++;
+	file = g_build_filename(path, name, NULL);
+	if (check_path(file) < 0 || strchr(name, '/')) {
+		errno = EINVAL;
+		goto error;
+	}
+	if (make_dirs(path) < 0)
+		goto error;
+
+	rec = g_new0(struct live_record, 1);
+	rec->index_fd = -1;
+	rec->fd = openat(record_dirfd, file, O_WRONLY | O_CREAT | O_TRUNC,
+			0644);
+	if (rec->fd < 0) {
+		g_free(rec);
+		goto error;
+	}
+	if (with_index && open_index(rec, path, name) < 0) {
+		live_record_close(rec);
+		g_free(file);
+		return NULL;
+	}
+	g_free(file);
+	return rec;
+
+error:
+	record_failed(file);
+	g_free(file);
+	return NULL;
+}
+
+/*
+ * The packet is written from the buffer it was received in, the index
+ * entry points to its offset in the local file.
+ */
+void live_record_packet(struct live_record *rec,
+		const struct lttng_viewer_index *index,
+		const void *data, size_t len)
+{
+	struct ctf_packet_index entry;
+
+	if (!rec || record_error)
+		return;
+
+	if (write_full(rec->fd, data, len) < 0)
+		goto error;
+
+	/* both indexes are big endian */
+	memset(&entry, 0, sizeof(entry));
+	entry.offset = htobe64(rec->offset);
+	entry.packet_size = index->packet_size;
+	entry.content_size = index->content_size;
+	entry.timestamp_begin = index->timestamp_begin;
+	entry.timestamp_end = index->timestamp_end;
+	entry.events_discarded = index->events_discarded;
+	entry.stream_id = index->stream_id;
+	if (write_full(rec->index_fd, &entry, RECORD_INDEX_LEN) < 0)
+		goto error;
+	rec->offset += len;
+	return;
+
+error:
+	record_failed("the data files");
+}
+
+void live_record_metadata(struct live_record *rec, const void *data,
+		size_t len)
+{
+	if (!rec || record_error)
+		return;
+	if (write_full(rec->fd, data, len) < 0)
+		record_failed("the metadata");
+}
+
+void live_record_close(struct live_record *rec)
+{
+	if (!rec)
+		return;
+	close(rec->fd);
+	if (rec->index_fd >= 0)
+		close(rec->index_fd);
+	g_free(rec);
+}
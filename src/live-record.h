@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _LIVE_RECORD_H
+#define _LIVE_RECORD_H
+
+#include <stddef.h>
+
+struct lttng_viewer_index;
+
+/*
+ * Copy of the live packets in a local CTF trace, readable offline. The
+ * files of a stream are created in the directory given by the relay
+ * under the record directory: the packets of each stream are appended
+ * to its data file with their entry in index/<name>.idx, the metadata is
+ * appended to the metadata file of the trace. After the first error the
+ * recording stops, the live reading goes on. Not thread-safe.
+ */
+struct live_record;
+
+/* NULL disables the recording */
+int live_record_init(const char *dir);
+int live_record_enabled(void);
+/* with_index for the data streams, NULL on error or when disabled */
+struct live_record *live_record_open(const char *path, const char *name,
+		int with_index);
+/* index in network byte order, as received from the relay */
+void live_record_packet(struct live_record *rec,
+		const struct lttng_viewer_index *index,
+		const void *data, size_t len);
+void live_record_metadata(struct live_record *rec, const void *data,
+		size_t len);
+void live_record_close(struct live_record *rec);
+
+#endif /* _LIVE_RECORD_H */
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <glib.h>
+
+#include "live-stats.h"
+
+struct live_counters {
+	uint64_t bytes;
+	uint64_t packets;
+	uint64_t latency_us;
+};
+
+struct live_stream_stats {
+	char name[LIVE_STATS_NAME_LEN];
+	struct live_counters total;
+	/* at the previous sample */
+	struct live_counters prev;
+	uint64_t retries;
+	uint64_t newest_ts;
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+/* struct live_stream_stats */
+static GPtrArray *streams;
+static uint64_t prev_sample_us;
+
+static uint64_t get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+struct live_stream_stats *live_stats_new(const char *name)
+{
+	struct live_stream_stats *stats;
+
+	stats = g_new0(struct live_stream_stats, 1);
+	g_strlcpy(stats->name, name, sizeof(stats->name));
+
+	pthread_mutex_lock(&stats_lock);
+	if (!streams)
+		streams = g_ptr_array_new();
+	g_ptr_array_add(streams, stats);
+	pthread_mutex_unlock(&stats_lock);
+
+	return stats;
+}
+
+void live_stats_packet(struct live_stream_stats *stats, uint64_t bytes,
+		uint64_t latency_us)
+{
+	pthread_mutex_lock(&stats_lock);
+	stats->total.bytes += bytes;
+	stats->total.packets++;
+	stats->total.latency_us += latency_us;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void live_stats_retry(struct live_stream_stats *stats)
+{
+	pthread_mutex_lock(&stats_lock);
+	stats->retries++;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void live_stats_newest(struct live_stream_stats *stats, uint64_t ts)
+{
+	pthread_mutex_lock(&stats_lock);
+	if (ts > stats->newest_ts)
+		stats->newest_ts = ts;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static void fill_sample(struct live_stats_sample *sample,
+		const struct live_counters *delta, double elapsed)
+{
+	sample->bytes_per_sec = delta->bytes / elapsed;
+	sample->packets_per_sec = delta->packets / elapsed;
+	if (delta->packets)
+		sample->latency_us = delta->latency_us / delta->packets;
+}
+
+GArray *live_stats_sample(void)
+{
+	struct live_stats_sample sample, *all;
+	struct live_counters delta, all_delta;
+	struct live_stream_stats *stats;
+	GArray *samples = NULL;
+	uint64_t now;
+	double elapsed;
+	int i;
+
+	pthread_mutex_lock(&stats_lock);
+	if (!streams)
+		goto end;
+
+	now = get_time_us();
+	elapsed = (now - prev_sample_us) / 1000000.0;
+	if (!prev_sample_us || elapsed <= 0)
+		elapsed = 1;
+	prev_sample_us = now;
+
+	samples = g_array_sized_new(FALSE, TRUE,
+			sizeof(struct live_stats_sample), streams->len + 1);
+	g_array_set_size(samples, 1);
+	memset(&all_delta, 0, sizeof(all_delta));
+	for (i = 0; i < streams->len; i++) {
+		stats = g_ptr_array_index(streams, i);
+		delta.bytes = stats->total.bytes - stats->prev.bytes;
+		delta.packets = stats->total.packets - stats->prev.packets;
+		delta.latency_us = stats->total.latency_us -
+			stats->prev.latency_us;
+		stats->prev = stats->total;
+
+		memset(&sample, 0, sizeof(sample));
+		strcpy(sample.name, stats->name);
+		fill_sample(&sample, &delta, elapsed);
+		sample.retries = stats->retries;
+		sample.newest_ts = stats->newest_ts;
+		g_array_append_val(samples, sample);
+
+		all_delta.bytes += delta.bytes;
+		all_delta.packets += delta.packets;
+		all_delta.latency_us += delta.latency_us;
+		all = &g_array_index(samples, struct live_stats_sample, 0);
+		all->retries += stats->retries;
+		all->newest_ts = MAX(all->newest_ts, stats->newest_ts);
+	}
+	all = &g_array_index(samples, struct live_stats_sample, 0);
+	strcpy(all->name, "all");
+	fill_sample(all, &all_delta, elapsed);
+
+end:
+	pthread_mutex_unlock(&stats_lock);
+	return samples;
+}
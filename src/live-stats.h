@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _LIVE_STATS_H
+#define _LIVE_STATS_H
+
+#include <stdint.h>
+#include <glib.h>
+
+#define LIVE_STATS_NAME_LEN	64
+
+/*
+ * Counters of the network live streams, updated while they are read and
+ * sampled by the display to know if the viewer keeps up with the relay.
+ * Thread-safe.
+ */
+struct live_stream_stats;
+
+/* the counters are kept until the end, name is hostname/channel */
+struct live_stream_stats *live_stats_new(const char *name);
+void live_stats_packet(struct live_stream_stats *stats, uint64_t bytes,
+		uint64_t latency_us);
+void live_stats_retry(struct live_stream_stats *stats);
+/* end of the newest index received, in ns */
+void live_stats_newest(struct live_stream_stats *stats, uint64_t ts);
+
+struct live_stats_sample {
+	char name[LIVE_STATS_NAME_LEN];
+	double bytes_per_sec;
+	double packets_per_sec;
+	/* average time from an index to its data over the interval */
+	uint64_t latency_us;
+	uint64_t retries;
+	uint64_t newest_ts;
+};
+
+/*
+ * Rates since the previous sample, the first element is the aggregate of
+ * all the streams. NULL without live streams, free with g_array_free().
+ */
+GArray *live_stats_sample(void);
+
+#endif /* _LIVE_STATS_H */
@@ -22,6 +22,7 @@
  */
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -34,6 +35,8 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <poll.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <babeltrace/ctf/ctf-index.h>
 
@@ -56,12 +59,71 @@ replaced with
 */
 #include "network-live.h"
 #include "lttngtop.h"
+#include "field-cache.h"
 
 #include "lttng-live-comm.h"
 #include "lttng-viewer-abi.h"
+#include "packet-pool.h"
+#include "live-record.h"
+#include "live-stats.h"
 
 #define ACTIVE_POLL_DELAY       100     /* ms */
 
+/*
+ * A prefetch thread pipelines the requests of all the streams: each
+ * stream reads ahead up to LIVE_PIPELINE_WINDOW packets, kept in memory
+ * until the iterator seeks them, so the round-trips overlap with each
+ * other and with the decoding. LIVE_MAX_REQUESTS bounds the requests in
+ * flight on the control socket.
+ */
+#define LIVE_PIPELINE_WINDOW	4
+#define LIVE_MAX_REQUESTS	64
+
+/*
+ * A stream answering LTTNG_VIEWER_INDEX_RETRY is asked again after a
+ * delay doubling from LIVE_MIN_RETRY_DELAY up to the live timer of the
+ * session: the relay does not receive the indexes more often than that.
+ */
+#define LIVE_MIN_RETRY_DELAY	10	/* ms */
+#define LIVE_STATS_INTERVAL	10000	/* ms */
+/*
+ * The sessions not started yet are asked for streams after a delay
+ * doubling from LIVE_SESSIONS_INTERVAL up to LIVE_SESSIONS_MAX_INTERVAL:
+ * asking pauses the pipeline of every connection.
+ */
+#define LIVE_SESSIONS_INTERVAL	1000	/* ms */
+#define LIVE_SESSIONS_MAX_INTERVAL	60000	/* ms */
+
+/* responses read at once by the prefetch thread */
+#define LIVE_RECV_BUFFER_SIZE	(64 * 1024)
+
+enum live_packet_state {
+	LIVE_PACKET_WAIT_INDEX,
+	LIVE_PACKET_WAIT_DATA,
+	/* the data must be requested again */
+	LIVE_PACKET_RETRY,
+	LIVE_PACKET_READY,
+};
+
+/* Index read ahead for a stream, with its data once received. */
+struct live_packet {
+	enum live_packet_state state;
+	uint32_t status;	/* enum lttng_viewer_next_index_return_code */
+	struct lttng_viewer_index index;	/* network byte order */
+	/* from the packet pool, given to the stream position when sought */
+	struct mmap_align *mma;
+	uint64_t len;
+	/* when the index was received, in us */
+	uint64_t index_time;
+};
+
+/* Request in flight, the relay answers in order. */
+struct live_request {
+	uint32_t cmd;
+	struct lttng_live_viewer_stream *stream;
+	struct live_packet *packet;
+};
+
 /*
  * Memory allocation zeroed
  */
@@ -75,10 +137,15 @@ replaced with
 static void ctf_live_packet_seek(struct bt_stream_pos *stream_pos,
 		size_t index, int whence);
 static void add_traces(gpointer key, gpointer value, gpointer user_data);
+static void get_trace_metadata(gpointer key, gpointer value,
+		gpointer user_data);
 static int del_traces(gpointer key, gpointer value, gpointer user_data);
+static int create_viewer_session(struct lttng_live_ctx *ctx, int sock);
+static struct lttng_live_session *lttng_live_session_new(
+		struct lttng_live_ctx *ctx, uint64_t id);
+static void stop_prefetch(struct lttng_live_ctx *ctx);
 static int get_new_metadata(struct lttng_live_ctx *ctx,
-		struct lttng_live_viewer_stream *viewer_stream,
-		char **metadata_buf);
+		struct lttng_live_viewer_stream *viewer_stream);
 
 static
 ssize_t lttng_live_recv(int fd, void *buf, size_t len)
@@ -87,7 +154,7 @@ ssize_t lttng_live_recv(int fd, void *buf, size_t len)
 	size_t copied = 0, to_copy = len;
 
 	do {
-		ret = recv(fd, buf + copied, to_copy, 0);
+		ret = recv(fd, buf + copied, to_copy, MSG_WAITALL);
 		if (ret > 0) {
 			assert(ret <= to_copy);
 			copied += ret;
@@ -112,16 +179,57 @@ ssize_t lttng_live_send(int fd, const void *buf, size_t len)
 	return ret;
 }
 
-int lttng_live_connect_viewer(struct lttng_live_ctx *ctx)
+/*
+ * Send a command header and its payload with a single system call.
+ * Returns the number of bytes sent or a negative value on error.
+ */
+static
+ssize_t lttng_live_send_cmd(int fd, const struct lttng_viewer_cmd *cmd,
+		const void *payload, size_t len)
 {
-	struct hostent *host;
-	struct sockaddr_in server_addr;
-	int ret;
+	struct iovec iov[2];
+	struct msghdr msg;
+	size_t sent = 0, total = sizeof(*cmd) + len;
+	ssize_t ret;
 
-	if (lttng_live_should_quit()) {
-		ret = -1;
-		goto end;
+	iov[0].iov_base = (void *) cmd;
+	iov[0].iov_len = sizeof(*cmd);
+	iov[1].iov_base = (void *) payload;
+	iov[1].iov_len = len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = len ? 2 : 1;
+
+	while (sent < total) {
+		ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return ret;
+		}
+		sent += ret;
+		/* partial send, skip what is already sent */
+		while (ret > 0) {
+			if (ret >= msg.msg_iov->iov_len) {
+				ret -= msg.msg_iov->iov_len;
+				msg.msg_iov++;
+				msg.msg_iovlen--;
+			} else {
+				msg.msg_iov->iov_base += ret;
+				msg.msg_iov->iov_len -= ret;
+				ret = 0;
+			}
+		}
 	}
+	return sent;
+}
+
+static
+int open_relay_socket(struct lttng_live_ctx *ctx)
+{
+	struct hostent *host;
+	struct sockaddr_in server_addr;
+	int sock;
 
 	host = gethostbyname(ctx->relay_hostname);
 	if (!host) {
@@ -130,7 +238,7 @@ int lttng_live_connect_viewer(struct lttng_live_ctx *ctx)
 		goto error;
 	}
 
-	if ((ctx->control_sock = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+	if ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
 		perror("Socket");
 		goto error;
 	}
@@ -140,23 +248,33 @@ int lttng_live_connect_viewer(struct lttng_live_ctx *ctx)
 	server_addr.sin_addr = *((struct in_addr *) host->h_addr);
 	bzero(&(server_addr.sin_zero), 8);
 
-	if (connect(ctx->control_sock, (struct sockaddr *) &server_addr,
+	if (connect(sock, (struct sockaddr *) &server_addr,
 				sizeof(struct sockaddr)) == -1) {
 		perror("Connect");
+		close(sock);
 		goto error;
 	}
 
-	ret = 0;
-
-end:
-	return ret;
+	return sock;
 
 error:
 	fprintf(stderr, "[error] Connection failed\n");
 	return -1;
 }
 
-int lttng_live_establish_connection(struct lttng_live_ctx *ctx)
+int lttng_live_connect_viewer(struct lttng_live_ctx *ctx)
+{
+	if (lttng_live_should_quit())
+		return -1;
+
+	ctx->control_sock = open_relay_socket(ctx);
+	if (ctx->control_sock < 0)
+		return -1;
+	return 0;
+}
+
+static
+int send_viewer_connect(struct lttng_live_ctx *ctx, int sock)
 {
 	struct lttng_viewer_cmd cmd;
 	struct lttng_viewer_connect connect;
@@ -177,21 +295,14 @@ int lttng_live_establish_connection(struct lttng_live_ctx *ctx)
 	connect.minor = htobe32(LTTNG_LIVE_MINOR);
 	connect.type = htobe32(LTTNG_VIEWER_CLIENT_COMMAND);
 
-	ret_len = lttng_live_send(ctx->control_sock, &cmd, sizeof(cmd));
-	if (ret_len < 0) {
-		perror("[error] Error sending cmd");
-		goto error;
-	}
-	assert(ret_len == sizeof(cmd));
-
-	ret_len = lttng_live_send(ctx->control_sock, &connect, sizeof(connect));
+	ret_len = lttng_live_send_cmd(sock, &cmd, &connect, sizeof(connect));
 	if (ret_len < 0) {
 		perror("[error] Error sending version");
 		goto error;
 	}
-	assert(ret_len == sizeof(connect));
+	assert(ret_len == sizeof(cmd) + sizeof(connect));
 
-	ret_len = lttng_live_recv(ctx->control_sock, &connect, sizeof(connect));
+	ret_len = lttng_live_recv(sock, &connect, sizeof(connect));
 	if (ret_len == 0) {
 		fprintf(stderr, "[error] Remote side has closed connection\n");
 		goto error;
@@ -227,6 +338,11 @@ error:
 	return -1;
 }
 
+int lttng_live_establish_connection(struct lttng_live_ctx *ctx)
+{
+	return send_viewer_connect(ctx, ctx->control_sock);
+}
+
 static
 void free_session_list(GPtrArray *session_list)
 {
@@ -355,13 +471,21 @@ int lttng_live_list_sessions(struct lttng_live_ctx *ctx, const char *path)
 					be32toh(lsession.clients),
 					be32toh(lsession.live_timer));
 		} else {
-			if ((strncmp(lsession.session_name, ctx->session_name,
-				NAME_MAX) == 0) && (strncmp(lsession.hostname,
-					ctx->traced_hostname, NAME_MAX) == 0)) {
-				printf_verbose("Reading from session %" PRIu64 "\n",
-						session_id);
-				g_array_append_val(ctx->session_ids,
+			/* the names of the URL can be patterns */
+			if (g_pattern_match_simple(ctx->session_name,
+					lsession.session_name) &&
+					g_pattern_match_simple(ctx->traced_hostname,
+						lsession.hostname)) {
+				struct lttng_live_session *session;
+
+				printf_verbose("Reading from session %s/%s (%"
+						PRIu64 ")\n", lsession.hostname,
+						lsession.session_name, session_id);
+				session = lttng_live_session_new(ctx,
 						session_id);
+				session->live_timer_interval =
+					be32toh(lsession.live_timer);
+				g_ptr_array_add(ctx->sessions, session);
 			}
 		}
 	}
@@ -379,6 +503,121 @@ error:
 	return -1;
 }
 
+static
+struct lttng_live_session *lttng_live_session_new(struct lttng_live_ctx *ctx,
+		uint64_t id)
+{
+	struct lttng_live_session *session;
+
+	session = g_new0(struct lttng_live_session, 1);
+	session->id = id;
+	/* We need a pointer to the context from the packet_seek function. */
+	session->ctx = ctx;
+	/* HT to store the CTF traces. */
+	session->ctf_traces = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	return session;
+}
+
+void lttng_live_session_free(struct lttng_live_session *session)
+{
+	g_hash_table_destroy(session->ctf_traces);
+	g_free(session->streams);
+	g_free(session);
+}
+
+/*
+ * Call func on the traces of all the sessions.
+ */
+static
+void foreach_live_trace(struct lttng_live_ctx *ctx, GHFunc func,
+		gpointer user_data)
+{
+	struct lttng_live_session *session;
+	int i;
+
+	for (i = 0; i < ctx->sessions->len; i++) {
+		session = g_ptr_array_index(ctx->sessions, i);
+		g_hash_table_foreach(session->ctf_traces, func, user_data);
+	}
+}
+
+static
+uint64_t live_stream_count(struct lttng_live_ctx *ctx)
+{
+	struct lttng_live_session *session;
+	uint64_t count = 0;
+	int i;
+
+	for (i = 0; i < ctx->sessions->len; i++) {
+		session = g_ptr_array_index(ctx->sessions, i);
+		count += session->stream_count;
+	}
+	return count;
+}
+
+static
+int live_open_sessions(struct lttng_live_ctx *ctx)
+{
+	struct lttng_live_session *session;
+	int i, count = 0;
+
+	for (i = 0; i < ctx->sessions->len; i++) {
+		session = g_ptr_array_index(ctx->sessions, i);
+		if (!session->closed)
+			count++;
+	}
+	return count;
+}
+
+static
+uint64_t get_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * The relay only flags the new streams on the streams of the same
+ * session, the sessions without streams are asked periodically.
+ * Called with ctx->lock held.
+ */
+static
+int live_waiting_sessions(struct lttng_live_ctx *ctx, uint64_t now)
+{
+	struct lttng_live_session *session;
+	int i;
+
+	for (i = 0; i < ctx->sessions->len; i++) {
+		session = g_ptr_array_index(ctx->sessions, i);
+		if (!session->closed && !session->stream_count &&
+				now >= session->new_streams_time)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Called with ctx->lock held after asking a session for its new
+ * streams.
+ */
+static
+void backoff_session(struct lttng_live_session *session, uint64_t now)
+{
+	if (session->stream_count) {
+		session->new_streams_delay = 0;
+		return;
+	}
+	if (!session->new_streams_delay)
+		session->new_streams_delay = LIVE_SESSIONS_INTERVAL;
+	else
+		session->new_streams_delay = MIN(session->new_streams_delay * 2,
+				LIVE_SESSIONS_MAX_INTERVAL);
+	session->new_streams_time = now + session->new_streams_delay;
+}
+
 int lttng_live_ctf_trace_assign(struct lttng_live_viewer_stream *stream,
 		uint64_t ctf_trace_id)
 {
@@ -404,23 +643,8 @@ int lttng_live_ctf_trace_assign(struct lttng_live_viewer_stream *stream,
 	return ret;
 }
 
-static
-int open_metadata_fp_write(struct lttng_live_viewer_stream *stream,
-		char **metadata_buf, size_t *size)
-{
-	int ret = 0;
-
-	stream->metadata_fp_write =
-		babeltrace_open_memstream(metadata_buf, size);
-	if (!stream->metadata_fp_write) {
-		perror("Metadata open_memstream");
-		ret = -1;
-	}
-
-	return ret;
-}
-
-int lttng_live_attach_session(struct lttng_live_ctx *ctx, uint64_t id)
+int lttng_live_attach_session(struct lttng_live_ctx *ctx,
+		struct lttng_live_session *session)
 {
 	struct lttng_viewer_cmd cmd;
 	struct lttng_viewer_attach_session_request rq;
@@ -439,24 +663,17 @@ int lttng_live_attach_session(struct lttng_live_ctx *ctx, uint64_t id)
 	cmd.cmd_version = 0;
 
 	memset(&rq, 0, sizeof(rq));
-	rq.session_id = htobe64(id);
+	rq.session_id = htobe64(session->id);
 	// TODO: add cmd line parameter to select seek beginning
 	// rq.seek = htobe32(LTTNG_VIEWER_SEEK_BEGINNING);
 	rq.seek = htobe32(LTTNG_VIEWER_SEEK_LAST);
 
-	ret_len = lttng_live_send(ctx->control_sock, &cmd, sizeof(cmd));
-	if (ret_len < 0) {
-		perror("[error] Error sending cmd");
-		goto error;
-	}
-	assert(ret_len == sizeof(cmd));
-
-	ret_len = lttng_live_send(ctx->control_sock, &rq, sizeof(rq));
+	ret_len = lttng_live_send_cmd(ctx->control_sock, &cmd, &rq, sizeof(rq));
 	if (ret_len < 0) {
 		perror("[error] Error sending attach request");
 		goto error;
 	}
-	assert(ret_len == sizeof(rq));
+	assert(ret_len == sizeof(cmd) + sizeof(rq));
 
 	ret_len = lttng_live_recv(ctx->control_sock, &rp, sizeof(rp));
 	if (ret_len == 0) {
@@ -493,20 +710,20 @@ int lttng_live_attach_session(struct lttng_live_ctx *ctx, uint64_t id)
 		goto error;
 	}
 
-	ctx->session->stream_count += be32toh(rp.streams_count);
+	session->stream_count += be32toh(rp.streams_count);
 	/*
 	 * When the session is created but not started, we do an active wait
 	 * until it starts. It allows the viewer to start processing the trace
 	 * as soon as the session starts.
 	 */
-	if (ctx->session->stream_count == 0) {
+	if (session->stream_count == 0) {
 		ret = 0;
 		goto end;
 	}
 	printf_verbose("Waiting for %" PRIu64 " streams:\n",
-		ctx->session->stream_count);
-	ctx->session->streams = g_new0(struct lttng_live_viewer_stream,
-			ctx->session->stream_count);
+		session->stream_count);
+	session->streams = g_new0(struct lttng_live_viewer_stream,
+			session->stream_count);
 	for (i = 0; i < be32toh(rp.streams_count); i++) {
 		ret_len = lttng_live_recv(ctx->control_sock, &stream, sizeof(stream));
 		if (ret_len == 0) {
@@ -524,16 +741,19 @@ int lttng_live_attach_session(struct lttng_live_ctx *ctx, uint64_t id)
 		printf_verbose("    stream %" PRIu64 " : %s/%s\n",
 				be64toh(stream.id), stream.path_name,
 				stream.channel_name);
-		ctx->session->streams[i].id = be64toh(stream.id);
-		ctx->session->streams[i].session = ctx->session;
+		session->streams[i].id = be64toh(stream.id);
+		session->streams[i].session = session;
 
-		ctx->session->streams[i].mmap_size = 0;
-		ctx->session->streams[i].ctf_stream_id = -1ULL;
+		session->streams[i].ctf_stream_id = -1ULL;
+		strncpy(session->streams[i].path, stream.path_name,
+				sizeof(session->streams[i].path) - 1);
+		strcpy(session->streams[i].channel_name,
+				stream.channel_name);
 
 		if (be32toh(stream.metadata_flag)) {
-			ctx->session->streams[i].metadata_flag = 1;
+			session->streams[i].metadata_flag = 1;
 		}
-		ret = lttng_live_ctf_trace_assign(&ctx->session->streams[i],
+		ret = lttng_live_ctf_trace_assign(&session->streams[i],
 				be64toh(stream.ctf_trace_id));
 		if (ret < 0) {
 			goto error;
@@ -556,13 +776,14 @@ error:
 static
 int ask_new_streams(struct lttng_live_ctx *ctx)
 {
+	struct lttng_live_session *session;
 	int i, ret = 0, nb_streams = 0;
-	uint64_t id;
 
-restart:
-	for (i = 0; i < ctx->session_ids->len; i++) {
-		id = g_array_index(ctx->session_ids, uint64_t, i);
-		ret = lttng_live_get_new_streams(ctx, id);
+	for (i = 0; i < ctx->sessions->len; i++) {
+		session = g_ptr_array_index(ctx->sessions, i);
+		if (session->closed)
+			continue;
+		ret = lttng_live_get_new_streams(ctx, session);
 		printf_verbose("Asking for new streams returns %d\n", ret);
 		if (ret < 0) {
 			if (lttng_live_should_quit()) {
@@ -570,18 +791,13 @@ restart:
 			}
 			if (ret == -LTTNG_VIEWER_NEW_STREAMS_HUP) {
 				printf_verbose("Session %" PRIu64 " closed\n",
-						id);
+						session->id);
 				/*
 				 * The streams have already been closed during
-				 * the reading, so we only need to get rid of
-				 * the trace in our internal table of sessions.
-				 */
-				g_array_remove_index(ctx->session_ids, i);
-				/*
-				 * We can't continue iterating on the g_array
-				 * after a remove, we have to start again.
+				 * the reading, we only stop asking for new
+				 * streams, the other sessions go on.
 				 */
-				goto restart;
+				session->closed = 1;
 			} else {
 				ret = -1;
 				goto end;
@@ -589,6 +805,9 @@ restart:
 		} else {
 			nb_streams += ret;
 		}
+		pthread_mutex_lock(&ctx->lock);
+		backoff_session(session, get_time_ms());
+		pthread_mutex_unlock(&ctx->lock);
 	}
 	ret = nb_streams;
 
@@ -596,84 +815,131 @@ end:
 	return ret;
 }
 
+static
+uint64_t get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Parse the metadata received for a trace, the FILE only wraps the
+ * receive buffer and is closed by babeltrace. The parse time is
+ * accounted separately from the index polling.
+ */
+static
+int parse_new_metadata(struct lttng_live_ctx *ctx,
+		struct lttng_live_ctf_trace *trace)
+{
+	GByteArray *buf = trace->metadata_stream->metadata_buf;
+	uint64_t start;
+	FILE *fp;
+	int ret;
+
+	fp = babeltrace_fmemopen(buf->data, buf->len, "rb");
+	if (!fp) {
+		perror("Metadata fmemopen");
+		return -1;
+	}
+	start = get_time_us();
+	ret = ctf_append_trace_metadata(trace->handle->td, fp);
+	pthread_mutex_lock(&ctx->lock);
+	ctx->poll_stats.metadata_parse_us += get_time_us() - start;
+	ctx->poll_stats.metadata_updates++;
+	ctx->poll_stats.metadata_bytes += buf->len;
+	pthread_mutex_unlock(&ctx->lock);
+	g_byte_array_set_size(buf, 0);
+
+	return ret;
+}
+
 static
 int append_metadata(struct lttng_live_ctx *ctx,
 		struct lttng_live_viewer_stream *viewer_stream)
 {
 	int ret;
-	struct lttng_live_viewer_stream *metadata;
-	char *metadata_buf = NULL;
 
 	printf_verbose("get_next_index: new metadata needed\n");
-	ret = get_new_metadata(ctx, viewer_stream, &metadata_buf);
-	if (ret < 0) {
-		free(metadata_buf);
+	ret = get_new_metadata(ctx, viewer_stream);
+	if (ret < 0)
 		goto error;
-	}
 
-	metadata = viewer_stream->ctf_trace->metadata_stream;
-	metadata->ctf_trace->metadata_fp =
-		babeltrace_fmemopen(metadata_buf,
-				metadata->metadata_len, "rb");
-	if (!metadata->ctf_trace->metadata_fp) {
-		perror("Metadata fmemopen");
-		free(metadata_buf);
-		ret = -1;
-		goto error;
-	}
-	ret = ctf_append_trace_metadata(
-			viewer_stream->ctf_trace->handle->td,
-			metadata->ctf_trace->metadata_fp);
+	ret = parse_new_metadata(ctx, viewer_stream->ctf_trace);
 	/* We accept empty metadata packets */
 	if (ret != 0 && ret != -ENOENT) {
 		fprintf(stderr, "[error] Appending metadata\n");
 		goto error;
 	}
+	/* new event classes may have been declared */
+	invalidate_field_cache();
 	ret = 0;
 
 error:
 	return ret;
 }
 
+/*
+ * The streams are recorded by the iterator thread, the metadata when it is
+ * received and the packets when they are sought, as they are analysed.
+ */
 static
-int get_data_packet(struct lttng_live_ctx *ctx,
-		struct ctf_stream_pos *pos,
-		struct lttng_live_viewer_stream *stream, uint64_t offset,
-		uint64_t len)
+struct live_record *get_stream_record(struct lttng_live_viewer_stream *stream)
+{
+	if (!stream->record && live_record_enabled()) {
+		stream->record = live_record_open(stream->path,
+				stream->metadata_flag ? "metadata" :
+					stream->channel_name,
+				!stream->metadata_flag);
+	}
+	return stream->record;
+}
+
+static
+void record_metadata(struct lttng_live_viewer_stream *stream,
+		const void *data, size_t len)
+{
+	live_record_metadata(get_stream_record(stream), data, len);
+}
+
+static
+void record_packet(struct lttng_live_viewer_stream *stream,
+		struct live_packet *packet)
+{
+	live_record_packet(get_stream_record(stream), &packet->index,
+			mmap_align_addr(packet->mma), packet->len);
+}
+
+static
+int get_one_metadata_packet(struct lttng_live_ctx *ctx,
+		struct lttng_live_viewer_stream *metadata_stream)
 {
+	uint64_t len = 0;
+	int ret;
 	struct lttng_viewer_cmd cmd;
-	struct lttng_viewer_get_packet rq;
-	struct lttng_viewer_trace_packet rp;
+	struct lttng_viewer_get_metadata rq;
+	struct lttng_viewer_metadata_packet rp;
+	GByteArray *buf;
+	size_t offset;
 	ssize_t ret_len;
-	int ret;
 
-retry:
 	if (lttng_live_should_quit()) {
 		ret = -1;
 		goto end;
 	}
-	cmd.cmd = htobe32(LTTNG_VIEWER_GET_PACKET);
+
+	rq.stream_id = htobe64(metadata_stream->id);
+	cmd.cmd = htobe32(LTTNG_VIEWER_GET_METADATA);
 	cmd.data_size = sizeof(rq);
 	cmd.cmd_version = 0;
 
-	memset(&rq, 0, sizeof(rq));
-	rq.stream_id = htobe64(stream->id);
-	rq.offset = htobe64(offset);
-	rq.len = htobe32(len);
-
-	ret_len = lttng_live_send(ctx->control_sock, &cmd, sizeof(cmd));
-	if (ret_len < 0) {
-		perror("[error] Error sending cmd");
-		goto error;
-	}
-	assert(ret_len == sizeof(cmd));
-
-	ret_len = lttng_live_send(ctx->control_sock, &rq, sizeof(rq));
+	ret_len = lttng_live_send_cmd(ctx->control_sock, &cmd, &rq, sizeof(rq));
 	if (ret_len < 0) {
-		perror("[error] Error sending get_data_packet request");
+		perror("[error] Error sending get_metadata request");
 		goto error;
 	}
-	assert(ret_len == sizeof(rq));
+	assert(ret_len == sizeof(cmd) + sizeof(rq));
 
 	ret_len = lttng_live_recv(ctx->control_sock, &rp, sizeof(rp));
 	if (ret_len == 0) {
@@ -681,386 +947,993 @@ retry:
 		goto error;
 	}
 	if (ret_len < 0) {
-		perror("[error] Error receiving data response");
-		goto error;
-	}
-	if (ret_len != sizeof(rp)) {
-		fprintf(stderr, "[error] get_data_packet: expected %" PRId64
-				", received %" PRId64 "\n", sizeof(rp),
-				ret_len);
+		perror("[error] Error receiving metadata response");
 		goto error;
 	}
-
-	rp.flags = be32toh(rp.flags);
+	assert(ret_len == sizeof(rp));
 
 	switch (be32toh(rp.status)) {
-	case LTTNG_VIEWER_GET_PACKET_OK:
-		len = be32toh(rp.len);
-		printf_verbose("get_data_packet: Ok, packet size : %" PRIu64
-				"\n", len);
-		break;
-	case LTTNG_VIEWER_GET_PACKET_RETRY:
-		/* Unimplemented by relay daemon */
-		printf_verbose("get_data_packet: retry\n");
-		goto error;
-	case LTTNG_VIEWER_GET_PACKET_ERR:
-		if (rp.flags & LTTNG_VIEWER_FLAG_NEW_METADATA) {
-			printf_verbose("get_data_packet: new metadata needed\n");
-			ret = append_metadata(ctx, stream);
-			if (ret)
-				goto error;
-		}
-		if (rp.flags & LTTNG_VIEWER_FLAG_NEW_STREAM) {
-			printf_verbose("get_data_packet: new streams needed\n");
-			ret = ask_new_streams(ctx);
-			if (ret < 0)
-				goto error;
-			else if (ret > 0)
-				g_hash_table_foreach(ctx->session->ctf_traces,
-						add_traces, ctx->bt_ctx);
-		}
-		if (rp.flags & (LTTNG_VIEWER_FLAG_NEW_METADATA
-				| LTTNG_VIEWER_FLAG_NEW_STREAM)) {
-			goto retry;
-		}
-		fprintf(stderr, "[error] get_data_packet: error\n");
-		goto error;
-	case LTTNG_VIEWER_GET_PACKET_EOF:
-		ret = -2;
-		goto end;
-	default:
-		printf_verbose("get_data_packet: unknown\n");
-		goto error;
+		case LTTNG_VIEWER_METADATA_OK:
+			printf_verbose("get_metadata : OK\n");
+			break;
+		case LTTNG_VIEWER_NO_NEW_METADATA:
+			printf_verbose("get_metadata : NO NEW\n");
+			ret = 0;
+			goto end;
+		case LTTNG_VIEWER_METADATA_ERR:
+			printf_verbose("get_metadata : ERR\n");
+			goto error;
+		default:
+			printf_verbose("get_metadata : UNKNOWN\n");
+			goto error;
 	}
 
-	if (len == 0) {
+	len = be64toh(rp.len);
+	printf_verbose("Writing %" PRIu64" bytes to metadata\n", len);
+	if (len <= 0) {
 		goto error;
 	}
 
-	if (len > stream->mmap_size) {
-		uint64_t new_size;
-
-		new_size = max_t(uint64_t, len, stream->mmap_size << 1);
-		if (pos->base_mma) {
-			/* unmap old base */
-			ret = munmap_align(pos->base_mma);
-			if (ret) {
-				perror("[error] Unable to unmap old base");
-				goto error;
-			}
-			pos->base_mma = NULL;
-		}
-		pos->base_mma = mmap_align(new_size,
-				PROT_READ | PROT_WRITE,
-				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-		if (pos->base_mma == MAP_FAILED) {
-			perror("[error] mmap error");
-			pos->base_mma = NULL;
-			goto error;
-		}
-
-		stream->mmap_size = new_size;
-		printf_verbose("Expanding stream mmap size to %" PRIu64 " bytes\n",
-				stream->mmap_size);
-	}
-
-	ret_len = lttng_live_recv(ctx->control_sock,
-			mmap_align_addr(pos->base_mma), len);
+	/* received after the metadata not parsed yet */
+	buf = metadata_stream->metadata_buf;
+	offset = buf->len;
+	g_byte_array_set_size(buf, offset + len);
+	ret_len = lttng_live_recv(ctx->control_sock, buf->data + offset, len);
 	if (ret_len == 0) {
 		fprintf(stderr, "[error] Remote side has closed connection\n");
-		goto error;
+		goto error_truncate;
 	}
 	if (ret_len < 0) {
 		perror("[error] Error receiving trace packet");
-		goto error;
+		goto error_truncate;
 	}
 	assert(ret_len == len);
-	ret = 0;
+	record_metadata(metadata_stream, buf->data + offset, len);
+	ret = len;
 end:
 	return ret;
 
+error_truncate:
+	g_byte_array_set_size(buf, offset);
 error:
 	return -1;
 }
 
+/*
+ * Return 0 on success, a negative value on error.
+ */
 static
-int get_one_metadata_packet(struct lttng_live_ctx *ctx,
-		struct lttng_live_viewer_stream *metadata_stream)
+int get_new_metadata(struct lttng_live_ctx *ctx,
+		struct lttng_live_viewer_stream *viewer_stream)
+{
+	int ret = 0;
+	struct lttng_live_viewer_stream *metadata_stream;
+	size_t len_read = 0;
+
+	metadata_stream = viewer_stream->ctf_trace->metadata_stream;
+	if (!metadata_stream) {
+		fprintf(stderr, "[error] No metadata stream\n");
+		ret = -1;
+		goto error;
+	}
+	if (!metadata_stream->metadata_buf)
+		metadata_stream->metadata_buf = g_byte_array_new();
+	g_byte_array_set_size(metadata_stream->metadata_buf, 0);
+
+	do {
+		/*
+		 * get_one_metadata_packet returns the number of bytes
+		 * received, 0 when we have received everything, a
+		 * negative value on error.
+		 */
+		ret = get_one_metadata_packet(ctx, metadata_stream);
+		if (ret > 0) {
+			len_read += ret;
+		}
+		if (!len_read) {
+			(void) poll(NULL, 0, ACTIVE_POLL_DELAY);
+		}
+	} while (ret > 0 || !len_read);
+
+error:
+	return ret;
+}
+
+/*
+ * Assign the fields from a lttng_viewer_index to a packet_index.
+ */
+static
+void lttng_index_to_packet_index(struct lttng_viewer_index *lindex,
+		struct packet_index *pindex)
+{
+	assert(lindex);
+	assert(pindex);
+
+	pindex->offset = be64toh(lindex->offset);
+	pindex->packet_size = be64toh(lindex->packet_size);
+	pindex->content_size = be64toh(lindex->content_size);
+	pindex->ts_cycles.timestamp_begin = be64toh(lindex->timestamp_begin);
+	pindex->ts_cycles.timestamp_end = be64toh(lindex->timestamp_end);
+	pindex->events_discarded = be64toh(lindex->events_discarded);
+}
+
+/*
+ * Queue a GET_NEXT_INDEX or GET_PACKET request, the requests are sent
+ * together by flush_live_requests() and their responses are read by
+ * recv_response() in the same order.
+ */
+static
+int send_live_request(struct lttng_live_conn *conn, uint32_t cmd_type,
+		const void *rq, size_t len,
+		struct lttng_live_viewer_stream *stream,
+		struct live_packet *packet)
 {
-	uint64_t len = 0;
-	int ret;
 	struct lttng_viewer_cmd cmd;
-	struct lttng_viewer_get_metadata rq;
-	struct lttng_viewer_metadata_packet rp;
-	char *data = NULL;
+	struct live_request *req;
+
+	cmd.cmd = htobe32(cmd_type);
+	cmd.data_size = len;
+	cmd.cmd_version = 0;
+
+	g_byte_array_append(conn->send_buf, (const guint8 *) &cmd, sizeof(cmd));
+	g_byte_array_append(conn->send_buf, rq, len);
+
+	req = g_new(struct live_request, 1);
+	req->cmd = cmd_type;
+	req->stream = stream;
+	req->packet = packet;
+	g_queue_push_tail(conn->requests, req);
+
+	return 0;
+}
+
+static
+int flush_live_requests(struct lttng_live_conn *conn)
+{
+	size_t sent = 0;
 	ssize_t ret_len;
 
-	if (lttng_live_should_quit()) {
-		ret = -1;
+	while (sent < conn->send_buf->len) {
+		ret_len = lttng_live_send(conn->sock,
+				conn->send_buf->data + sent,
+				conn->send_buf->len - sent);
+		if (ret_len < 0) {
+			perror("[error] Error sending requests");
+			return -1;
+		}
+		sent += ret_len;
+	}
+	g_byte_array_set_size(conn->send_buf, 0);
+	return 0;
+}
+
+/*
+ * Read as much as the socket has, at least min bytes, in the empty
+ * receive buffer. Returns the number of bytes buffered, 0 if the relay
+ * closed the connection or a negative value on error.
+ */
+static
+ssize_t fill_recv_buffer(struct lttng_live_conn *conn, size_t min)
+{
+	struct lttng_live_recv_buffer *rb = &conn->recv_buf;
+	ssize_t ret;
+
+	rb->start = rb->end = 0;
+	while (rb->end < min) {
+		ret = recv(conn->sock, rb->data + rb->end,
+				LIVE_RECV_BUFFER_SIZE - rb->end, 0);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return ret;
+		rb->end += ret;
+	}
+	return rb->end;
+}
+
+/*
+ * Receive a response on the socket of a connection, the lock is released
+ * while waiting for the relay. Only the prefetch thread of the connection
+ * reads its responses and the packets being received are not visible to
+ * the iterator thread.
+ * The small responses are read in bulk, so the indexes of several
+ * streams usually come in one system call, the packet data goes straight
+ * to its buffer.
+ */
+static
+ssize_t prefetch_recv(struct lttng_live_conn *conn, void *buf, size_t len)
+{
+	struct lttng_live_ctx *ctx = conn->ctx;
+	struct lttng_live_recv_buffer *rb = &conn->recv_buf;
+	size_t copied;
+	ssize_t ret;
+
+	copied = MIN(len, rb->end - rb->start);
+	memcpy(buf, rb->data + rb->start, copied);
+	rb->start += copied;
+	if (copied == len)
+		return len;
+
+	pthread_mutex_unlock(&ctx->lock);
+	ret = flush_live_requests(conn);
+	if (ret < 0)
+		goto end;
+	if (len - copied >= LIVE_RECV_BUFFER_SIZE) {
+		ret = lttng_live_recv(conn->sock, buf + copied,
+				len - copied);
+		if (ret > 0)
+			ret = len;
 		goto end;
 	}
+	ret = fill_recv_buffer(conn, len - copied);
+	if (ret <= 0)
+		goto end;
+	memcpy(buf + copied, rb->data, len - copied);
+	rb->start = len - copied;
+	ret = len;
+end:
+	pthread_mutex_lock(&ctx->lock);
+	return ret;
+}
 
-	rq.stream_id = htobe64(metadata_stream->id);
-	cmd.cmd = htobe32(LTTNG_VIEWER_GET_METADATA);
-	cmd.data_size = sizeof(rq);
-	cmd.cmd_version = 0;
+static
+int request_index(struct lttng_live_conn *conn,
+		struct lttng_live_viewer_stream *stream)
+{
+	struct lttng_viewer_get_next_index rq;
+	struct live_packet *packet;
+	int ret;
 
-	ret_len = lttng_live_send(ctx->control_sock, &cmd, sizeof(cmd));
+	printf_verbose("get_next_index for stream %" PRIu64 "\n",
+			stream->id);
+	memset(&rq, 0, sizeof(rq));
+	rq.stream_id = htobe64(stream->id);
+
+	packet = g_new0(struct live_packet, 1);
+	packet->state = LIVE_PACKET_WAIT_INDEX;
+	ret = send_live_request(conn, LTTNG_VIEWER_GET_NEXT_INDEX, &rq,
+			sizeof(rq), stream, packet);
+	if (ret < 0) {
+		g_free(packet);
+		goto end;
+	}
+	g_queue_push_tail(stream->packets, packet);
+	stream->index_requested = 1;
+	conn->ctx->poll_stats.index_requests++;
+
+end:
+	return ret;
+}
+
+static
+int request_packet(struct lttng_live_conn *conn,
+		struct lttng_live_viewer_stream *stream,
+		struct live_packet *packet)
+{
+	struct lttng_viewer_get_packet rq;
+
+	printf_verbose("get_data_packet for stream %" PRIu64 "\n",
+			stream->id);
+	memset(&rq, 0, sizeof(rq));
+	rq.stream_id = htobe64(stream->id);
+	/* the index is still in network byte order */
+	rq.offset = packet->index.offset;
+	rq.len = htobe32(be64toh(packet->index.packet_size) / CHAR_BIT);
+
+	packet->state = LIVE_PACKET_WAIT_DATA;
+	return send_live_request(conn, LTTNG_VIEWER_GET_PACKET, &rq,
+			sizeof(rq), stream, packet);
+}
+
+static
+void packet_ready(struct lttng_live_ctx *ctx, struct live_packet *packet)
+{
+	packet->state = LIVE_PACKET_READY;
+	pthread_cond_broadcast(&ctx->cond);
+}
+
+/*
+ * Queue a stream which may have a request to send, the prefetch thread of
+ * its connection serves the active streams in round-robin.
+ */
+static
+void wake_stream(struct lttng_live_ctx *ctx,
+		struct lttng_live_viewer_stream *stream)
+{
+	if (stream->sched != LTTNG_LIVE_SCHED_IDLE || stream->id == -1ULL)
+		return;
+	stream->sched = LTTNG_LIVE_SCHED_ACTIVE;
+	g_queue_push_tail(stream->conn->active_streams, stream);
+	pthread_cond_broadcast(&ctx->cond);
+}
+
+static
+gint compare_retry_time(gconstpointer a, gconstpointer b, gpointer data)
+{
+	const struct lttng_live_viewer_stream *sa = a, *sb = b;
+
+	if (sa->retry_time < sb->retry_time)
+		return -1;
+	return sa->retry_time > sb->retry_time;
+}
+
+static
+void backoff_stream(struct lttng_live_conn *conn,
+		struct lttng_live_viewer_stream *stream)
+{
+	struct lttng_live_ctx *ctx = conn->ctx;
+	uint64_t max_delay;
+
+	/* the live timer is in us */
+	max_delay = stream->session->live_timer_interval / 1000;
+	if (!max_delay)
+		max_delay = ACTIVE_POLL_DELAY;
+	max_delay = MAX(max_delay, LIVE_MIN_RETRY_DELAY);
+	if (!stream->retry_delay)
+		stream->retry_delay = LIVE_MIN_RETRY_DELAY;
+	else
+		stream->retry_delay = MIN(stream->retry_delay * 2, max_delay);
+	stream->retry_time = get_time_ms() + stream->retry_delay;
+	ctx->poll_stats.backoff_ms += stream->retry_delay;
+
+	/* woken up by the consumer while its index was in flight */
+	if (stream->sched == LTTNG_LIVE_SCHED_ACTIVE)
+		g_queue_remove(conn->active_streams, stream);
+	stream->sched = LTTNG_LIVE_SCHED_BACKOFF;
+	g_queue_insert_sorted(conn->backoff_streams, stream,
+			compare_retry_time, NULL);
+}
+
+static
+void print_poll_stats(struct lttng_live_ctx *ctx)
+{
+	struct lttng_live_poll_stats *stats = &ctx->poll_stats;
+
+	printf_verbose("Live polling: %" PRIu64 " index requests, %" PRIu64
+			" retries, %" PRIu64 " inactive beacons, %" PRIu64
+			" packets, %" PRIu64 " ms of backoff\n",
+			stats->index_requests, stats->index_retries,
+			stats->inactive, stats->packets, stats->backoff_ms);
+	printf_verbose("Live metadata: %" PRIu64 " updates, %" PRIu64
+			" bytes, %" PRIu64 " us parsing\n",
+			stats->metadata_updates, stats->metadata_bytes,
+			stats->metadata_parse_us);
+}
+
+/*
+ * Remember the flags of a response, they are handled by the iterator
+ * thread once all the requests in flight are answered.
+ */
+static
+void add_live_flags(struct lttng_live_ctx *ctx,
+		struct lttng_live_viewer_stream *stream, uint32_t flags)
+{
+	struct lttng_live_viewer_stream *metadata;
+	int i;
+
+	if (flags & LTTNG_VIEWER_FLAG_NEW_METADATA) {
+		/* only one update per trace */
+		for (i = 0; i < ctx->metadata_streams->len; i++) {
+			metadata = g_ptr_array_index(ctx->metadata_streams, i);
+			if (metadata->ctf_trace == stream->ctf_trace)
+				break;
+		}
+		if (i == ctx->metadata_streams->len)
+			g_ptr_array_add(ctx->metadata_streams, stream);
+	}
+	flags &= LTTNG_VIEWER_FLAG_NEW_METADATA | LTTNG_VIEWER_FLAG_NEW_STREAM;
+	if (flags && !ctx->pending_flags) {
+		/* the other prefetch threads stop sending requests */
+		pthread_cond_broadcast(&ctx->cond);
+	}
+	ctx->pending_flags |= flags;
+}
+
+static
+int recv_index(struct lttng_live_conn *conn,
+		struct lttng_live_viewer_stream *stream,
+		struct live_packet *packet)
+{
+	struct lttng_live_ctx *ctx = conn->ctx;
+	struct lttng_viewer_index *rp = &packet->index;
+	ssize_t ret_len;
+	int ret;
+
+	ret_len = prefetch_recv(conn, rp, sizeof(*rp));
+	if (ret_len == 0) {
+		fprintf(stderr, "[error] Remote side has closed connection\n");
+		goto error;
+	}
 	if (ret_len < 0) {
-		perror("[error] Error sending cmd");
+		perror("[error] Error receiving index response");
 		goto error;
 	}
-	assert(ret_len == sizeof(cmd));
+	assert(ret_len == sizeof(*rp));
 
-	ret_len = lttng_live_send(ctx->control_sock, &rq, sizeof(rq));
-	if (ret_len < 0) {
-		perror("[error] Error sending get_metadata request");
+	stream->index_requested = 0;
+	rp->flags = be32toh(rp->flags);
+	packet->status = be32toh(rp->status);
+
+	switch (packet->status) {
+	case LTTNG_VIEWER_INDEX_INACTIVE:
+		printf_verbose("get_next_index: inactive\n");
+		ctx->poll_stats.inactive++;
+		stream->retry_delay = 0;
+		packet_ready(ctx, packet);
+		break;
+	case LTTNG_VIEWER_INDEX_OK:
+		printf_verbose("get_next_index: Ok, need metadata update : %u\n",
+				rp->flags & LTTNG_VIEWER_FLAG_NEW_METADATA);
+		stream->retry_delay = 0;
+		packet->index_time = get_time_us();
+		stream->newest_ts_cycles = MAX(stream->newest_ts_cycles,
+				be64toh(rp->timestamp_end));
+		add_live_flags(ctx, stream, rp->flags);
+		if (be64toh(rp->packet_size) == 0) {
+			packet_ready(ctx, packet);
+		} else if (ctx->pending_flags) {
+			/* requested again after the update */
+			packet->state = LIVE_PACKET_RETRY;
+		} else {
+			/*
+			 * The packet request must be sent before the next
+			 * index request of the stream: the relay can destroy
+			 * the stream once its last index is sent.
+			 */
+			ret = request_packet(conn, stream, packet);
+			if (ret < 0)
+				goto error;
+		}
+		/* read ahead */
+		wake_stream(ctx, stream);
+		break;
+	case LTTNG_VIEWER_INDEX_RETRY:
+		printf_verbose("get_next_index: retry\n");
+		ctx->poll_stats.index_retries++;
+		live_stats_retry(stream->stats);
+		/* only the last index of a stream can be in flight */
+		assert(g_queue_peek_tail(stream->packets) == packet);
+		g_queue_pop_tail(stream->packets);
+		g_free(packet);
+		backoff_stream(conn, stream);
+		break;
+	case LTTNG_VIEWER_INDEX_HUP:
+		printf_verbose("get_next_index: stream hung up\n");
+		stream->id = -1ULL;
+		stream->session->stream_count--;
+		packet_ready(ctx, packet);
+		break;
+	case LTTNG_VIEWER_INDEX_ERR:
+		fprintf(stderr, "[error] get_next_index: error\n");
+		goto error;
+	default:
+		fprintf(stderr, "[error] get_next_index: unkwown value\n");
 		goto error;
 	}
-	assert(ret_len == sizeof(rq));
+	return 0;
 
-	ret_len = lttng_live_recv(ctx->control_sock, &rp, sizeof(rp));
+error:
+	return -1;
+}
+
+static
+int recv_packet(struct lttng_live_conn *conn,
+		struct lttng_live_viewer_stream *stream,
+		struct live_packet *packet)
+{
+	struct lttng_live_ctx *ctx = conn->ctx;
+	struct lttng_viewer_trace_packet rp;
+	ssize_t ret_len;
+	uint64_t len;
+
+	ret_len = prefetch_recv(conn, &rp, sizeof(rp));
 	if (ret_len == 0) {
 		fprintf(stderr, "[error] Remote side has closed connection\n");
 		goto error;
 	}
 	if (ret_len < 0) {
-		perror("[error] Error receiving metadata response");
+		perror("[error] Error receiving data response");
+		goto error;
+	}
+	if (ret_len != sizeof(rp)) {
+		fprintf(stderr, "[error] get_data_packet: expected %" PRId64
+				", received %" PRId64 "\n", sizeof(rp),
+				ret_len);
 		goto error;
 	}
-	assert(ret_len == sizeof(rp));
+
+	rp.flags = be32toh(rp.flags);
 
 	switch (be32toh(rp.status)) {
-		case LTTNG_VIEWER_METADATA_OK:
-			printf_verbose("get_metadata : OK\n");
-			break;
-		case LTTNG_VIEWER_NO_NEW_METADATA:
-			printf_verbose("get_metadata : NO NEW\n");
-			ret = 0;
+	case LTTNG_VIEWER_GET_PACKET_OK:
+		len = be32toh(rp.len);
+		printf_verbose("get_data_packet: Ok, packet size : %" PRIu64
+				"\n", len);
+		break;
+	case LTTNG_VIEWER_GET_PACKET_RETRY:
+		/* Unimplemented by relay daemon */
+		printf_verbose("get_data_packet: retry\n");
+		goto error;
+	case LTTNG_VIEWER_GET_PACKET_ERR:
+		if (rp.flags & (LTTNG_VIEWER_FLAG_NEW_METADATA
+				| LTTNG_VIEWER_FLAG_NEW_STREAM)) {
+			printf_verbose("get_data_packet: new metadata or "
+					"streams needed\n");
+			add_live_flags(ctx, stream, rp.flags);
+			packet->state = LIVE_PACKET_RETRY;
+			wake_stream(ctx, stream);
 			goto end;
-		case LTTNG_VIEWER_METADATA_ERR:
-			printf_verbose("get_metadata : ERR\n");
-			goto error;
-		default:
-			printf_verbose("get_metadata : UNKNOWN\n");
-			goto error;
+		}
+		fprintf(stderr, "[error] get_data_packet: error\n");
+		goto error;
+	case LTTNG_VIEWER_GET_PACKET_EOF:
+		/*
+		 * The packet is skipped, the next index tells if the stream
+		 * hung up.
+		 */
+		printf_verbose("get_data_packet: eof\n");
+		g_queue_remove(stream->packets, packet);
+		g_free(packet);
+		wake_stream(ctx, stream);
+		/* the iterator may wait on this packet */
+		pthread_cond_broadcast(&ctx->cond);
+		goto end;
+	default:
+		printf_verbose("get_data_packet: unknown\n");
+		goto error;
 	}
 
-	len = be64toh(rp.len);
-	printf_verbose("Writing %" PRIu64" bytes to metadata\n", len);
-	if (len <= 0) {
+	if (len == 0) {
 		goto error;
 	}
 
-	data = zmalloc(len);
-	if (!data) {
-		perror("relay data zmalloc");
+	packet->mma = packet_pool_get(len);
+	if (!packet->mma) {
 		goto error;
 	}
-	ret_len = lttng_live_recv(ctx->control_sock, data, len);
+	ret_len = prefetch_recv(conn, mmap_align_addr(packet->mma), len);
 	if (ret_len == 0) {
 		fprintf(stderr, "[error] Remote side has closed connection\n");
-		goto error_free_data;
+		goto error;
 	}
 	if (ret_len < 0) {
 		perror("[error] Error receiving trace packet");
-		goto error_free_data;
+		goto error;
 	}
 	assert(ret_len == len);
+	packet->len = len;
+	ctx->poll_stats.packets++;
+	live_stats_packet(stream->stats, len,
+			get_time_us() - packet->index_time);
+	packet_ready(ctx, packet);
 
-	do {
-		ret_len = fwrite(data, 1, len,
-				metadata_stream->metadata_fp_write);
-	} while (ret_len < 0 && errno == EINTR);
-	if (ret_len < 0) {
-		fprintf(stderr, "[error] Writing in the metadata fp\n");
-		goto error_free_data;
+end:
+	return 0;
+
+error:
+	return -1;
+}
+
+/*
+ * Read the response of the oldest request in flight.
+ */
+static
+int recv_response(struct lttng_live_conn *conn)
+{
+	struct live_request *req;
+	int ret;
+
+	req = g_queue_pop_head(conn->requests);
+	assert(req);
+	if (req->cmd == LTTNG_VIEWER_GET_NEXT_INDEX)
+		ret = recv_index(conn, req->stream, req->packet);
+	else
+		ret = recv_packet(conn, req->stream, req->packet);
+	g_free(req);
+
+	return ret;
+}
+
+/*
+ * Send the requests of a stream: the data requested again and the next
+ * index if there is room in its window. An index is only read ahead
+ * after a packet of data, the inactive beacons are requested when the
+ * previous one is consumed.
+ */
+static
+int schedule_stream(struct lttng_live_conn *conn,
+		struct lttng_live_viewer_stream *stream)
+{
+	struct live_packet *packet;
+	unsigned int window;
+	GList *l;
+	int ret;
+
+	/* hung up while it was active */
+	if (stream->id == -1ULL)
+		goto end;
+	for (l = stream->packets->head; l; l = l->next) {
+		packet = l->data;
+		if (packet->state != LIVE_PACKET_RETRY)
+			continue;
+		ret = request_packet(conn, stream, packet);
+		if (ret < 0)
+			goto error;
+	}
+
+	/* without read ahead once the packet buffers reach their limit */
+	window = packet_pool_full() ? 1 : LIVE_PIPELINE_WINDOW;
+	if (stream->index_requested ||
+			g_queue_get_length(stream->packets) >= window)
+		goto end;
+	packet = g_queue_peek_tail(stream->packets);
+	if (packet && packet->status != LTTNG_VIEWER_INDEX_OK)
+		goto end;
+	ret = request_index(conn, stream);
+	if (ret < 0)
+		goto error;
+end:
+	return 0;
+
+error:
+	return -1;
+}
+
+/*
+ * Serve the active streams in round-robin, a stream is only active when
+ * it can send a request: the waiting streams are woken up by a response
+ * or by the consumption of a packet, the streams in backoff when their
+ * delay expires. Return the delay in ms until the next backoff expires,
+ * or -1 on error.
+ */
+static
+int schedule_requests(struct lttng_live_conn *conn)
+{
+	struct lttng_live_viewer_stream *stream;
+	uint64_t now;
+	int ret;
+
+	now = get_time_ms();
+	while ((stream = g_queue_peek_head(conn->backoff_streams)) &&
+			stream->retry_time <= now) {
+		g_queue_pop_head(conn->backoff_streams);
+		stream->sched = LTTNG_LIVE_SCHED_IDLE;
+		wake_stream(conn->ctx, stream);
+	}
+
+	while (g_queue_get_length(conn->requests) < LIVE_MAX_REQUESTS &&
+			(stream = g_queue_pop_head(conn->active_streams))) {
+		stream->sched = LTTNG_LIVE_SCHED_IDLE;
+		ret = schedule_stream(conn, stream);
+		if (ret < 0)
+			goto error;
 	}
-	assert(ret_len == len);
-	metadata_stream->metadata_len += len;
-	free(data);
-	ret = len;
-end:
-	return ret;
 
-error_free_data:
-	free(data);
+	stream = g_queue_peek_head(conn->backoff_streams);
+	if (stream)
+		return stream->retry_time - now;
+	return ACTIVE_POLL_DELAY;
+
 error:
 	return -1;
 }
 
 /*
- * Return 0 on success, a negative value on error.
+ * Fetch the indexes and packets of the streams of a connection ahead of
+ * the iterator thread, up to LIVE_PIPELINE_WINDOW packets per stream.
  */
 static
-int get_new_metadata(struct lttng_live_ctx *ctx,
-		struct lttng_live_viewer_stream *viewer_stream,
-		char **metadata_buf)
+void *prefetch_thread(void *data)
 {
-	int ret = 0;
-	struct lttng_live_viewer_stream *metadata_stream;
-	size_t size, len_read = 0;
-
-	metadata_stream = viewer_stream->ctf_trace->metadata_stream;
-	if (!metadata_stream) {
-		fprintf(stderr, "[error] No metadata stream\n");
-		ret = -1;
-		goto error;
-	}
-	metadata_stream->metadata_len = 0;
-	ret = open_metadata_fp_write(metadata_stream, metadata_buf, &size);
-	if (ret < 0) {
-		goto error;
-	}
+	struct lttng_live_conn *conn = data;
+	struct lttng_live_ctx *ctx = conn->ctx;
+	unsigned int resume_count;
+	struct timespec ts;
+	uint64_t stats_time, sessions_time;
+	int ret;
 
-	do {
-		/*
-		 * get_one_metadata_packet returns the number of bytes
-		 * received, 0 when we have received everything, a
-		 * negative value on error.
-		 */
-		ret = get_one_metadata_packet(ctx, metadata_stream);
-		if (ret > 0) {
-			len_read += ret;
+	stats_time = get_time_ms() + LIVE_STATS_INTERVAL;
+	sessions_time = get_time_ms() + LIVE_SESSIONS_INTERVAL;
+	pthread_mutex_lock(&ctx->lock);
+	while (!ctx->prefetch_stop && !lttng_live_should_quit()) {
+		/* the statistics and the sessions are shared */
+		if (babeltrace_verbose && conn == &ctx->conns[0] &&
+				get_time_ms() >= stats_time) {
+			print_poll_stats(ctx);
+			stats_time += LIVE_STATS_INTERVAL;
 		}
-		if (!len_read) {
-			(void) poll(NULL, 0, ACTIVE_POLL_DELAY);
+		if (conn == &ctx->conns[0] && get_time_ms() >= sessions_time) {
+			if (live_waiting_sessions(ctx, get_time_ms())) {
+				ctx->pending_flags |= LTTNG_VIEWER_FLAG_NEW_STREAM;
+				pthread_cond_broadcast(&ctx->cond);
+			}
+			sessions_time = get_time_ms() + LIVE_SESSIONS_INTERVAL;
+		}
+		if (ctx->pending_flags) {
+			if (!g_queue_is_empty(conn->requests)) {
+				ret = recv_response(conn);
+				if (ret < 0)
+					goto error;
+				continue;
+			}
+			/*
+			 * The iterator thread sends the synchronous commands
+			 * once all the connections are paused, all their
+			 * requests are answered so nothing is left in the send
+			 * and receive buffers of the control socket.
+			 */
+			resume_count = ctx->resume_count;
+			ctx->paused_conns++;
+			pthread_cond_broadcast(&ctx->cond);
+			while (ctx->resume_count == resume_count &&
+					!ctx->prefetch_stop)
+				pthread_cond_wait(&ctx->cond, &ctx->lock);
+			continue;
+		}
+
+		ret = schedule_requests(conn);
+		if (ret < 0)
+			goto error;
+		if (g_queue_is_empty(conn->requests)) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += ret / 1000;
+			ts.tv_nsec += (ret % 1000) * 1000000L;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&ctx->cond, &ctx->lock, &ts);
+			continue;
 		}
-	} while (ret > 0 || !len_read);
 
-	if (fclose(metadata_stream->metadata_fp_write))
-		perror("fclose");
-	metadata_stream->metadata_fp_write = NULL;
+		ret = recv_response(conn);
+		if (ret < 0)
+			goto error;
+	}
+	pthread_mutex_unlock(&ctx->lock);
+	return NULL;
 
 error:
-	return ret;
+	ctx->prefetch_error = 1;
+	pthread_cond_broadcast(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+	return NULL;
 }
 
 /*
- * Assign the fields from a lttng_viewer_index to a packet_index.
+ * The additional connections only fetch the indexes and packets: the
+ * relay looks up the viewer streams by id, so they do not attach the
+ * sessions.
  */
 static
-void lttng_index_to_packet_index(struct lttng_viewer_index *lindex,
-		struct packet_index *pindex)
+int open_data_connection(struct lttng_live_ctx *ctx,
+		struct lttng_live_conn *conn)
 {
-	assert(lindex);
-	assert(pindex);
+	int ret, sock;
 
-	pindex->offset = be64toh(lindex->offset);
-	pindex->packet_size = be64toh(lindex->packet_size);
-	pindex->content_size = be64toh(lindex->content_size);
-	pindex->ts_cycles.timestamp_begin = be64toh(lindex->timestamp_begin);
-	pindex->ts_cycles.timestamp_end = be64toh(lindex->timestamp_end);
-	pindex->events_discarded = be64toh(lindex->events_discarded);
+	sock = open_relay_socket(ctx);
+	if (sock < 0)
+		goto error;
+	ret = send_viewer_connect(ctx, sock);
+	if (ret < 0)
+		goto error_close;
+	ret = create_viewer_session(ctx, sock);
+	if (ret < 0)
+		goto error_close;
+	conn->sock = sock;
+	return 0;
+
+error_close:
+	close(sock);
+error:
+	fprintf(stderr, "[error] Opening the live data connections\n");
+	return -1;
+}
+
+static
+int start_prefetch(struct lttng_live_ctx *ctx)
+{
+	struct lttng_live_conn *conn;
+	int i, ret;
+
+	ctx->nr_conns = opt_live_connections;
+	ctx->conns = g_new0(struct lttng_live_conn, ctx->nr_conns);
+	for (i = 0; i < ctx->nr_conns; i++) {
+		conn = &ctx->conns[i];
+		conn->ctx = ctx;
+		conn->active_streams = g_queue_new();
+		conn->backoff_streams = g_queue_new();
+		conn->requests = g_queue_new();
+		conn->send_buf = g_byte_array_new();
+		conn->recv_buf.data = g_malloc(LIVE_RECV_BUFFER_SIZE);
+		conn->sock = -1;
+	}
+
+	ctx->conns[0].sock = ctx->control_sock;
+	for (i = 1; i < ctx->nr_conns; i++) {
+		ret = open_data_connection(ctx, &ctx->conns[i]);
+		if (ret < 0)
+			goto error;
+	}
+	printf_verbose("Fetching the streams on %d connections\n",
+			ctx->nr_conns);
+
+	for (i = 0; i < ctx->nr_conns; i++) {
+		conn = &ctx->conns[i];
+		ret = pthread_create(&conn->thread, NULL, prefetch_thread,
+				conn);
+		if (ret) {
+			fprintf(stderr, "[error] Creating the prefetch thread\n");
+			goto error;
+		}
+		conn->started = 1;
+	}
+	return 0;
+
+error:
+	stop_prefetch(ctx);
+	return -1;
 }
 
 /*
- * Get one index for a stream.
- *
- * Returns 0 on success or a negative value on error.
+ * The relay answers the requests in flight without waiting for data, so
+ * the prefetch threads notice the stop soon after.
  */
 static
-int get_next_index(struct lttng_live_ctx *ctx,
-		struct lttng_live_viewer_stream *viewer_stream,
-		struct packet_index *index, uint64_t *stream_id)
+void stop_prefetch(struct lttng_live_ctx *ctx)
 {
-	struct lttng_viewer_cmd cmd;
-	struct lttng_viewer_get_next_index rq;
-	int ret;
-	ssize_t ret_len;
-	struct lttng_viewer_index *rp = &viewer_stream->current_index;
-
-	cmd.cmd = htobe32(LTTNG_VIEWER_GET_NEXT_INDEX);
-	cmd.data_size = sizeof(rq);
-	cmd.cmd_version = 0;
+	struct lttng_live_conn *conn;
+	int i;
 
-	memset(&rq, 0, sizeof(rq));
-	rq.stream_id = htobe64(viewer_stream->id);
+	if (!ctx->conns)
+		return;
+	pthread_mutex_lock(&ctx->lock);
+	ctx->prefetch_stop = 1;
+	pthread_cond_broadcast(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+
+	for (i = 0; i < ctx->nr_conns; i++) {
+		conn = &ctx->conns[i];
+		if (conn->started)
+			pthread_join(conn->thread, NULL);
+		/* the control socket is closed with the context */
+		if (i > 0 && conn->sock >= 0)
+			close(conn->sock);
+		g_queue_free(conn->active_streams);
+		g_queue_free(conn->backoff_streams);
+		g_queue_free_full(conn->requests, g_free);
+		g_byte_array_free(conn->send_buf, TRUE);
+		g_free(conn->recv_buf.data);
+	}
+	g_free(ctx->conns);
+	ctx->conns = NULL;
+	ctx->nr_conns = 0;
+	print_poll_stats(ctx);
+}
 
-retry:
-	if (lttng_live_should_quit()) {
-		ret = -1;
-		goto end;
+/*
+ * Called by the iterator thread with the lock held once the prefetch
+ * threads are paused. The metadata and the new streams are fetched with
+ * synchronous commands, the prefetch threads resume before the new
+ * traces are added since adding them seeks their streams.
+ */
+static
+int handle_live_flags(struct lttng_live_ctx *ctx)
+{
+	GPtrArray *metadata_streams;
+	uint32_t flags;
+	int i, ret, new_streams = 0;
+
+	flags = ctx->pending_flags;
+	ctx->pending_flags = 0;
+	metadata_streams = ctx->metadata_streams;
+	ctx->metadata_streams = g_ptr_array_new();
+	pthread_mutex_unlock(&ctx->lock);
+
+	for (i = 0; i < metadata_streams->len; i++) {
+		ret = append_metadata(ctx,
+				g_ptr_array_index(metadata_streams, i));
+		if (ret)
+			goto end;
 	}
-	ret_len = lttng_live_send(ctx->control_sock, &cmd, sizeof(cmd));
-	if (ret_len < 0) {
-		perror("[error] Error sending cmd");
-		goto error;
+	if (flags & LTTNG_VIEWER_FLAG_NEW_STREAM) {
+		printf_verbose("get_next_index: need new streams\n");
+		ret = ask_new_streams(ctx);
+		if (ret < 0)
+			goto end;
+		new_streams = ret;
+		if (new_streams)
+			foreach_live_trace(ctx, get_trace_metadata, NULL);
 	}
-	assert(ret_len == sizeof(cmd));
+	ret = 0;
 
-	ret_len = lttng_live_send(ctx->control_sock, &rq, sizeof(rq));
-	if (ret_len < 0) {
-		perror("[error] Error sending get_next_index request");
-		goto error;
+end:
+	g_ptr_array_free(metadata_streams, TRUE);
+	pthread_mutex_lock(&ctx->lock);
+	ctx->paused_conns = 0;
+	ctx->resume_count++;
+	pthread_cond_broadcast(&ctx->cond);
+	if (ret == 0 && new_streams) {
+		pthread_mutex_unlock(&ctx->lock);
+		foreach_live_trace(ctx, add_traces, ctx->bt_ctx);
+		pthread_mutex_lock(&ctx->lock);
 	}
-	assert(ret_len == sizeof(rq));
+	return ret;
+}
 
-	ret_len = lttng_live_recv(ctx->control_sock, rp, sizeof(*rp));
-	if (ret_len == 0) {
-		fprintf(stderr, "[error] Remote side has closed connection\n");
-		goto error;
-	}
-	if (ret_len < 0) {
-		perror("[error] Error receiving index response");
-		goto error;
-	}
-	assert(ret_len == sizeof(*rp));
+static
+struct live_stream_stats *new_stream_stats(
+		struct lttng_live_viewer_stream *stream)
+{
+	char name[LIVE_STATS_NAME_LEN];
 
-	rp->flags = be32toh(rp->flags);
+	snprintf(name, sizeof(name), "%" PRIu64 "/%s", stream->session->id,
+			stream->channel_name);
+	return live_stats_new(name);
+}
 
-	switch (be32toh(rp->status)) {
-	case LTTNG_VIEWER_INDEX_INACTIVE:
-		printf_verbose("get_next_index: inactive\n");
-		memset(index, 0, sizeof(struct packet_index));
-		index->ts_cycles.timestamp_end = be64toh(rp->timestamp_end);
-		*stream_id = be64toh(rp->stream_id);
-		break;
-	case LTTNG_VIEWER_INDEX_OK:
-		printf_verbose("get_next_index: Ok, need metadata update : %u\n",
-				rp->flags & LTTNG_VIEWER_FLAG_NEW_METADATA);
-		lttng_index_to_packet_index(rp, index);
-		*stream_id = be64toh(rp->stream_id);
-		viewer_stream->data_pending = 1;
+/*
+ * Wait for the next packet of the stream to be fetched by the prefetch
+ * thread. The stream is read ahead from its first seek. Returns NULL on
+ * error.
+ */
+static
+struct live_packet *get_live_packet(struct lttng_live_ctx *ctx,
+		struct lttng_live_viewer_stream *stream)
+{
+	struct live_packet *packet = NULL;
+	int ret;
 
-		if (rp->flags & LTTNG_VIEWER_FLAG_NEW_METADATA) {
-			ret = append_metadata(ctx, viewer_stream);
-			if (ret)
-				goto error;
-		}
-		if (rp->flags & LTTNG_VIEWER_FLAG_NEW_STREAM) {
-			printf_verbose("get_next_index: need new streams\n");
-			ret = ask_new_streams(ctx);
+	pthread_mutex_lock(&ctx->lock);
+	if (!stream->packets) {
+		stream->packets = g_queue_new();
+		stream->conn = &ctx->conns[stream->id % ctx->nr_conns];
+		stream->stats = new_stream_stats(stream);
+		wake_stream(ctx, stream);
+	}
+
+	for (;;) {
+		if (lttng_live_should_quit() || ctx->prefetch_error)
+			goto error;
+		if (ctx->pending_flags &&
+				ctx->paused_conns == ctx->nr_conns) {
+			ret = handle_live_flags(ctx);
 			if (ret < 0)
 				goto error;
-			else if (ret > 0)
-				g_hash_table_foreach(ctx->session->ctf_traces,
-						add_traces, ctx->bt_ctx);
+			continue;
 		}
-		break;
-	case LTTNG_VIEWER_INDEX_RETRY:
-		printf_verbose("get_next_index: retry\n");
-		(void) poll(NULL, 0, ACTIVE_POLL_DELAY);
-		goto retry;
-	case LTTNG_VIEWER_INDEX_HUP:
-		printf_verbose("get_next_index: stream hung up\n");
-		viewer_stream->id = -1ULL;
-		index->offset = EOF;
-		ctx->session->stream_count--;
-		break;
-	case LTTNG_VIEWER_INDEX_ERR:
-		fprintf(stderr, "[error] get_next_index: error\n");
-		goto error;
-	default:
-		fprintf(stderr, "[error] get_next_index: unkwown value\n");
-		goto error;
+
+		packet = g_queue_peek_head(stream->packets);
+		if (packet && packet->state == LIVE_PACKET_READY)
+			break;
+		/* nothing after the hang up */
+		if (!packet && stream->id == -1ULL)
+			goto error;
+		pthread_cond_wait(&ctx->cond, &ctx->lock);
 	}
-	ret = 0;
-end:
-	return ret;
+	pthread_mutex_unlock(&ctx->lock);
+	return packet;
 
 error:
-	return -1;
+	pthread_mutex_unlock(&ctx->lock);
+	return NULL;
+}
+
+static
+void put_live_packet(struct lttng_live_ctx *ctx,
+		struct lttng_live_viewer_stream *stream)
+{
+	struct live_packet *packet;
+
+	pthread_mutex_lock(&ctx->lock);
+	packet = g_queue_pop_head(stream->packets);
+	/* room in the window */
+	wake_stream(ctx, stream);
+	pthread_mutex_unlock(&ctx->lock);
+
+	if (packet->mma)
+		packet_pool_put(packet->mma);
+	g_free(packet);
 }
 
 static
@@ -1141,6 +2014,26 @@ end:
 	return ret;
 }
 
+/*
+ * The newest index received is converted with the clock of the stream,
+ * only known by the iterator.
+ */
+static
+void update_newest_ts(struct lttng_live_ctx *ctx,
+		struct lttng_live_viewer_stream *stream,
+		struct ctf_file_stream *file_stream)
+{
+	uint64_t cycles;
+
+	if (!file_stream->parent.stream_class)
+		return;
+	pthread_mutex_lock(&ctx->lock);
+	cycles = stream->newest_ts_cycles;
+	pthread_mutex_unlock(&ctx->lock);
+	live_stats_newest(stream->stats,
+			ctf_get_real_timestamp(&file_stream->parent, cycles));
+}
+
 static
 void ctf_live_packet_seek(struct bt_stream_pos *stream_pos, size_t index,
 		int whence)
@@ -1150,6 +2043,7 @@ void ctf_live_packet_seek(struct bt_stream_pos *stream_pos, size_t index,
 	struct packet_index *prev_index = NULL, *cur_index;
 	struct lttng_live_viewer_stream *viewer_stream;
 	struct lttng_live_session *session;
+	struct live_packet *packet;
 	uint64_t stream_id = -1ULL;
 	int ret;
 
@@ -1164,7 +2058,6 @@ void ctf_live_packet_seek(struct bt_stream_pos *stream_pos, size_t index,
 		return;
 	}
 
-retry:
 	switch (pos->packet_index->len) {
 	case 0:
 		g_array_set_size(pos->packet_index, 1);
@@ -1193,25 +2086,34 @@ retry:
 		break;
 	}
 
-	if (viewer_stream->data_pending) {
-		lttng_index_to_packet_index(&viewer_stream->current_index, cur_index);
-	} else {
-		printf_verbose("get_next_index for stream %" PRIu64 "\n", viewer_stream->id);
-		ret = get_next_index(session->ctx, viewer_stream, cur_index, &stream_id);
-		if (ret < 0) {
-			pos->offset = EOF;
-			if (!lttng_live_should_quit()) {
-				fprintf(stderr, "[error] get_next_index failed\n");
-			}
-			return;
+	packet = get_live_packet(session->ctx, viewer_stream);
+	if (!packet) {
+		pos->offset = EOF;
+		if (!lttng_live_should_quit()) {
+			fprintf(stderr, "[error] get_live_packet failed\n");
 		}
+		return;
+	}
+	switch (packet->status) {
+	case LTTNG_VIEWER_INDEX_INACTIVE:
+		memset(cur_index, 0, sizeof(struct packet_index));
+		cur_index->ts_cycles.timestamp_end =
+			be64toh(packet->index.timestamp_end);
+		stream_id = be64toh(packet->index.stream_id);
+		break;
+	case LTTNG_VIEWER_INDEX_OK:
+		lttng_index_to_packet_index(&packet->index, cur_index);
+		stream_id = be64toh(packet->index.stream_id);
 		printf_verbose("Index received : packet_size : %" PRIu64
 				", offset %" PRIu64 ", content_size %" PRIu64
 				", timestamp_end : %" PRIu64 "\n",
 				cur_index->packet_size, cur_index->offset,
 				cur_index->content_size,
 				cur_index->ts_cycles.timestamp_end);
-
+		break;
+	case LTTNG_VIEWER_INDEX_HUP:
+		cur_index->offset = EOF;
+		break;
 	}
 
 	/*
@@ -1232,6 +2134,7 @@ retry:
 		file_stream->parent.stream_id = stream_id;
 		viewer_stream->ctf_stream_id = stream_id;
 
+		/* the packet is read on the next seek */
 		return;
 	}
 
@@ -1272,33 +2175,32 @@ retry:
 				cur_index->ts_real.timestamp_begin;
 	}
 
+	if (pos->offset == EOF && pos->base_mma) {
+		packet_pool_put(pos->base_mma);
+		pos->base_mma = NULL;
+	}
 	if (pos->packet_size == 0 || pos->offset == EOF) {
 		goto end;
 	}
 
-	printf_verbose("get_data_packet for stream %" PRIu64 "\n",
-			viewer_stream->id);
-	ret = get_data_packet(session->ctx, pos, viewer_stream,
-			cur_index->offset,
-			cur_index->packet_size / CHAR_BIT);
-	if (ret == -2) {
-		goto retry;
-	} else if (ret < 0) {
-		pos->offset = EOF;
-		if (!lttng_live_should_quit()) {
-			fprintf(stderr, "[error] get_data_packet failed\n");
-		}
-		return;
-	}
-	viewer_stream->data_pending = 0;
+	record_packet(viewer_stream, packet);
+	update_newest_ts(session->ctx, viewer_stream, file_stream);
+
+	/* the previous packet of the stream is no longer needed */
+	if (pos->base_mma)
+		packet_pool_put(pos->base_mma);
+	pos->base_mma = packet->mma;
+	packet->mma = NULL;
 
 	read_packet_header(pos, file_stream);
 
 end:
+	put_live_packet(session->ctx, viewer_stream);
 	return;
 }
 
-int lttng_live_create_viewer_session(struct lttng_live_ctx *ctx)
+static
+int create_viewer_session(struct lttng_live_ctx *ctx, int sock)
 {
 	struct lttng_viewer_cmd cmd;
 	struct lttng_viewer_create_session_response resp;
@@ -1314,14 +2216,14 @@ int lttng_live_create_viewer_session(struct lttng_live_ctx *ctx)
 	cmd.data_size = 0;
 	cmd.cmd_version = 0;
 
-	ret_len = lttng_live_send(ctx->control_sock, &cmd, sizeof(cmd));
+	ret_len = lttng_live_send(sock, &cmd, sizeof(cmd));
 	if (ret_len < 0) {
 		perror("[error] Error sending cmd");
 		goto error;
 	}
 	assert(ret_len == sizeof(cmd));
 
-	ret_len = lttng_live_recv(ctx->control_sock, &resp, sizeof(resp));
+	ret_len = lttng_live_recv(sock, &resp, sizeof(resp));
 	if (ret_len == 0) {
 		fprintf(stderr, "[error] Remote side has closed connection\n");
 		goto error;
@@ -1344,21 +2246,67 @@ error:
 	return -1;
 }
 
+int lttng_live_create_viewer_session(struct lttng_live_ctx *ctx)
+{
+	return create_viewer_session(ctx, ctx->control_sock);
+}
+
 static
 int del_traces(gpointer key, gpointer value, gpointer user_data)
 {
 	struct bt_context *bt_ctx = user_data;
 	struct lttng_live_ctf_trace *trace = value;
-	int ret;
+	struct lttng_live_viewer_stream *stream;
+	int i, ret;
 
 	ret = bt_context_remove_trace(bt_ctx, trace->trace_id);
 	if (ret < 0)
 		fprintf(stderr, "[error] removing trace from context\n");
+	invalidate_field_cache();
+
+	for (i = 0; i < trace->streams->len; i++) {
+		stream = g_ptr_array_index(trace->streams, i);
+		live_record_close(stream->record);
+		stream->record = NULL;
+		if (stream->metadata_buf) {
+			g_byte_array_free(stream->metadata_buf, TRUE);
+			stream->metadata_buf = NULL;
+		}
+	}
 
 	/* remove the key/value pair from the HT. */
 	return 1;
 }
 
+/*
+ * Get all possible metadata of the traces not added yet, before the
+ * prefetch thread uses the control socket for their streams.
+ */
+static
+void get_trace_metadata(gpointer key, gpointer value, gpointer user_data)
+{
+	struct lttng_live_ctf_trace *trace = value;
+	struct lttng_live_viewer_stream *stream = trace->metadata_stream;
+	int ret;
+
+	if (trace->in_use || trace->metadata_fp || !stream)
+		return;
+
+	ret = get_new_metadata(stream->session->ctx, stream);
+	if (ret)
+		return;
+	if (!stream->metadata_buf->len) {
+		fprintf(stderr, "[error] empty metadata\n");
+		return;
+	}
+
+	/* parsed from the receive buffer when the trace is added */
+	trace->metadata_fp = babeltrace_fmemopen(stream->metadata_buf->data,
+			stream->metadata_buf->len, "rb");
+	if (!trace->metadata_fp)
+		perror("Metadata fmemopen2");
+}
+
 static
 void add_traces(gpointer key, gpointer value, gpointer user_data)
 {
@@ -1368,7 +2316,6 @@ void add_traces(gpointer key, gpointer value, gpointer user_data)
 	struct lttng_live_viewer_stream *stream;
 	struct bt_mmap_stream *new_mmap_stream;
 	struct bt_mmap_stream_list mmap_list;
-	struct lttng_live_ctx *ctx = NULL;
 	struct bt_trace_descriptor *td;
 	struct bt_trace_handle *handle;
 
@@ -1388,37 +2335,13 @@ void add_traces(gpointer key, gpointer value, gpointer user_data)
 
 	for (i = 0; i < trace->streams->len; i++) {
 		stream = g_ptr_array_index(trace->streams, i);
-		ctx = stream->session->ctx;
 
+		/* the metadata is fetched by get_trace_metadata() */
 		if (!stream->metadata_flag) {
 			new_mmap_stream = zmalloc(sizeof(struct bt_mmap_stream));
 			new_mmap_stream->priv = (void *) stream;
 			new_mmap_stream->fd = -1;
 			bt_list_add(&new_mmap_stream->list, &mmap_list.head);
-		} else {
-			char *metadata_buf = NULL;
-
-			/* Get all possible metadata before starting */
-			ret = get_new_metadata(ctx, stream, &metadata_buf);
-			if (ret) {
-				free(metadata_buf);
-				goto end_free;
-			}
-			if (!stream->metadata_len) {
-				fprintf(stderr, "[error] empty metadata\n");
-				ret = -1;
-				free(metadata_buf);
-				goto end_free;
-			}
-
-			trace->metadata_fp = babeltrace_fmemopen(metadata_buf,
-					stream->metadata_len, "rb");
-			if (!trace->metadata_fp) {
-				perror("Metadata fmemopen2");
-				ret = -1;
-				free(metadata_buf);
-				goto end_free;
-			}
 		}
 	}
 
@@ -1429,11 +2352,13 @@ void add_traces(gpointer key, gpointer value, gpointer user_data)
 
 	ret = bt_context_add_trace(bt_ctx, NULL, "ctf",
 			ctf_live_packet_seek, &mmap_list, trace->metadata_fp);
+	/* closed by babeltrace */
+	trace->metadata_fp = NULL;
+	g_byte_array_set_size(trace->metadata_stream->metadata_buf, 0);
 	if (ret < 0) {
 		fprintf(stderr, "[error] Error adding trace\n");
 		goto end_free;
 	}
-	trace->metadata_stream->metadata_len = 0;
 
 	handle = (struct bt_trace_handle *) g_hash_table_lookup(
 			bt_ctx->trace_handles,
@@ -1459,7 +2384,8 @@ end:
  * Request new streams for a session.
  * Returns the number of streams received or a negative value on error.
  */
-int lttng_live_get_new_streams(struct lttng_live_ctx *ctx, uint64_t id)
+int lttng_live_get_new_streams(struct lttng_live_ctx *ctx,
+		struct lttng_live_session *session)
 {
 	struct lttng_viewer_cmd cmd;
 	struct lttng_viewer_new_streams_request rq;
@@ -1468,6 +2394,7 @@ int lttng_live_get_new_streams(struct lttng_live_ctx *ctx, uint64_t id)
 	int ret, i, nb_streams = 0;
 	ssize_t ret_len;
 	uint32_t stream_count;
+	uint64_t total_count;
 
 	if (lttng_live_should_quit()) {
 		ret = -1;
@@ -1479,21 +2406,14 @@ int lttng_live_get_new_streams(struct lttng_live_ctx *ctx, uint64_t id)
 	cmd.cmd_version = 0;
 
 	memset(&rq, 0, sizeof(rq));
-	rq.session_id = htobe64(id);
-
-	ret_len = lttng_live_send(ctx->control_sock, &cmd, sizeof(cmd));
-	if (ret_len < 0) {
-		perror("[error] Error sending cmd");
-		goto error;
-	}
-	assert(ret_len == sizeof(cmd));
+	rq.session_id = htobe64(session->id);
 
-	ret_len = lttng_live_send(ctx->control_sock, &rq, sizeof(rq));
+	ret_len = lttng_live_send_cmd(ctx->control_sock, &cmd, &rq, sizeof(rq));
 	if (ret_len < 0) {
 		perror("[error] Error sending get_new_streams request");
 		goto error;
 	}
-	assert(ret_len == sizeof(rq));
+	assert(ret_len == sizeof(cmd) + sizeof(rq));
 
 	ret_len = lttng_live_recv(ctx->control_sock, &rp, sizeof(rp));
 	if (ret_len == 0) {
@@ -1525,20 +2445,23 @@ int lttng_live_get_new_streams(struct lttng_live_ctx *ctx, uint64_t id)
 	}
 
 	stream_count = be32toh(rp.streams_count);
-	ctx->session->stream_count += stream_count;
+	/* the prefetch threads decrement it on the hangups */
+	pthread_mutex_lock(&ctx->lock);
+	session->stream_count += stream_count;
+	total_count = session->stream_count;
+	pthread_mutex_unlock(&ctx->lock);
 	/*
 	 * When the session is created but not started, we do an active wait
 	 * until it starts. It allows the viewer to start processing the trace
 	 * as soon as the session starts.
 	 */
-	if (ctx->session->stream_count == 0) {
+	if (total_count == 0) {
 		ret = 0;
 		goto end;
 	}
-	printf_verbose("Waiting for %" PRIu64 " streams:\n",
-		ctx->session->stream_count);
-	ctx->session->streams = g_new0(struct lttng_live_viewer_stream,
-			ctx->session->stream_count);
+	printf_verbose("Waiting for %" PRIu64 " streams:\n", total_count);
+	session->streams = g_new0(struct lttng_live_viewer_stream,
+			total_count);
 	for (i = 0; i < stream_count; i++) {
 		ret_len = lttng_live_recv(ctx->control_sock, &stream, sizeof(stream));
 		if (ret_len == 0) {
@@ -1556,16 +2479,19 @@ int lttng_live_get_new_streams(struct lttng_live_ctx *ctx, uint64_t id)
 		printf_verbose("    stream %" PRIu64 " : %s/%s\n",
 				be64toh(stream.id), stream.path_name,
 				stream.channel_name);
-		ctx->session->streams[i].id = be64toh(stream.id);
-		ctx->session->streams[i].session = ctx->session;
+		session->streams[i].id = be64toh(stream.id);
+		session->streams[i].session = session;
 
-		ctx->session->streams[i].mmap_size = 0;
-		ctx->session->streams[i].ctf_stream_id = -1ULL;
+		session->streams[i].ctf_stream_id = -1ULL;
+		strncpy(session->streams[i].path, stream.path_name,
+				sizeof(session->streams[i].path) - 1);
+		strcpy(session->streams[i].channel_name,
+				stream.channel_name);
 
 		if (be32toh(stream.metadata_flag)) {
-			ctx->session->streams[i].metadata_flag = 1;
+			session->streams[i].metadata_flag = 1;
 		}
-		ret = lttng_live_ctf_trace_assign(&ctx->session->streams[i],
+		ret = lttng_live_ctf_trace_assign(&session->streams[i],
 				be64toh(stream.ctf_trace_id));
 		if (ret < 0) {
 			goto error;
@@ -1592,7 +2518,7 @@ int lttng_live_read(struct lttng_live_ctx *ctx)
 	struct bt_format *fmt_write;
 	struct ctf_text_stream_pos *sout;
 #endif
-	uint64_t id;
+	struct lttng_live_session *session;
 
 	ctx->bt_ctx = bt_context_create();
 	if (!ctx->bt_ctx) {
@@ -1625,10 +2551,11 @@ int lttng_live_read(struct lttng_live_ctx *ctx)
 		goto end_free;
 	}
 
-	for (i = 0; i < ctx->session_ids->len; i++) {
-		id = g_array_index(ctx->session_ids, uint64_t, i);
-		printf_verbose("Attaching to session %lu\n", id);
-		ret = lttng_live_attach_session(ctx, id);
+	for (i = 0; i < ctx->sessions->len; i++) {
+		session = g_ptr_array_index(ctx->sessions, i);
+		printf_verbose("Attaching to session %" PRIu64 "\n",
+				session->id);
+		ret = lttng_live_attach_session(ctx, session);
 		printf_verbose("Attaching session returns %d\n", ret);
 		if (ret < 0) {
 			if (ret == -LTTNG_VIEWER_ATTACH_UNK) {
@@ -1650,9 +2577,9 @@ int lttng_live_read(struct lttng_live_ctx *ctx)
 			goto end_free;
 		}
 
-		while (!ctx->session->stream_count) {
+		while (!live_stream_count(ctx)) {
 			if (lttng_live_should_quit()
-					|| ctx->session_ids->len == 0) {
+					|| !live_open_sessions(ctx)) {
 				ret = 0;
 				goto end_free;
 			}
@@ -1660,13 +2587,22 @@ int lttng_live_read(struct lttng_live_ctx *ctx)
 			if (ret < 0) {
 				goto end_free;
 			}
-			if (!ctx->session->stream_count) {
+			if (!live_stream_count(ctx)) {
 				(void) poll(NULL, 0, ACTIVE_POLL_DELAY);
 			}
 		}
 
-		g_hash_table_foreach(ctx->session->ctf_traces, add_traces,
-				ctx->bt_ctx);
+		ret = live_record_init(opt_live_record);
+		if (ret < 0) {
+			goto end_free;
+		}
+		foreach_live_trace(ctx, get_trace_metadata, NULL);
+		packet_pool_init(opt_live_buffer_mem, opt_live_hugepages);
+		ret = start_prefetch(ctx);
+		if (ret < 0) {
+			goto end_free;
+		}
+		foreach_live_trace(ctx, add_traces, ctx->bt_ctx);
 
 #if 0
 		begin_pos.type = BT_SEEK_BEGIN;
@@ -1726,9 +2662,14 @@ int lttng_live_read(struct lttng_live_ctx *ctx)
 #endif
 		}
 		iter_trace(ctx->bt_ctx);
-		g_hash_table_foreach_remove(ctx->session->ctf_traces,
-				del_traces, ctx->bt_ctx);
-		ctx->session->stream_count = 0;
+		for (i = 0; i < ctx->sessions->len; i++) {
+			session = g_ptr_array_index(ctx->sessions, i);
+			g_hash_table_foreach_remove(session->ctf_traces,
+					del_traces, ctx->bt_ctx);
+			pthread_mutex_lock(&ctx->lock);
+			session->stream_count = 0;
+			pthread_mutex_unlock(&ctx->lock);
+		}
 #if 0
 	}
 #endif
@@ -1736,6 +2677,7 @@ int lttng_live_read(struct lttng_live_ctx *ctx)
 end_free:
 	bt_context_put(ctx->bt_ctx);
 end:
+	stop_prefetch(ctx);
 	ret = 0;
 	if (lttng_live_should_quit()) {
 		ret = 0;
@@ -25,6 +25,7 @@
  */
 
 #include <stdint.h>
+#include <pthread.h>
 #include "lttng-viewer-abi.h"
 
 #define LTTNG_DEFAULT_NETWORK_VIEWER_PORT	5344
@@ -32,6 +33,56 @@
 #define LTTNG_LIVE_MAJOR			2
 #define LTTNG_LIVE_MINOR			4
 
+enum lttng_live_sched {
+	LTTNG_LIVE_SCHED_IDLE = 0,
+	/* in the round-robin of the prefetch thread */
+	LTTNG_LIVE_SCHED_ACTIVE,
+	/* waiting for its retry delay */
+	LTTNG_LIVE_SCHED_BACKOFF,
+};
+
+/* Responses read ahead by the prefetch thread. */
+struct lttng_live_recv_buffer {
+	char *data;
+	size_t start;
+	size_t end;
+};
+
+/* Cost of the index polling and metadata updates, printed in verbose mode. */
+struct lttng_live_poll_stats {
+	uint64_t index_requests;
+	uint64_t index_retries;
+	uint64_t inactive;
+	uint64_t packets;
+	uint64_t backoff_ms;
+	uint64_t metadata_updates;
+	uint64_t metadata_bytes;
+	uint64_t metadata_parse_us;
+};
+
+/*
+ * Connection to the relay of a prefetch thread, the streams are sharded
+ * between the connections so a large packet only delays the streams
+ * sharing its connection. The first one is the control socket, the
+ * synchronous commands are sent on it while the prefetch threads are
+ * paused. The fields below are protected by the lock of the context.
+ */
+struct lttng_live_conn {
+	struct lttng_live_ctx *ctx;
+	int sock;
+	pthread_t thread;
+	int started;
+	/* streams with a request to send, in round-robin */
+	GQueue *active_streams;
+	/* streams waiting for their retry delay, by retry time */
+	GQueue *backoff_streams;
+	/* GET_NEXT_INDEX and GET_PACKET requests in flight, in order */
+	GQueue *requests;
+	/* requests not sent yet */
+	GByteArray *send_buf;
+	struct lttng_live_recv_buffer recv_buf;
+};
+
 struct lttng_live_ctx {
 	char traced_hostname[NAME_MAX];
 	char session_name[NAME_MAX];
@@ -41,28 +92,75 @@ struct lttng_live_ctx {
 	/* Protocol version to use for this connection. */
 	uint32_t major;
 	uint32_t minor;
-	struct lttng_live_session *session;
+	/*
+	 * struct lttng_live_session, the sessions matching the URL. Their
+	 * traces are all added to bt_ctx, so their events are merged by
+	 * timestamp.
+	 */
+	GPtrArray *sessions;
 	struct bt_context *bt_ctx;
-	GArray *session_ids;
+	/*
+	 * The prefetch threads read the streams ahead, the lock protects
+	 * the fields below, the connections and the packet queues of the
+	 * streams.
+	 */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct lttng_live_conn *conns;
+	int nr_conns;
+	int prefetch_stop;
+	int prefetch_error;
+	/*
+	 * The prefetch threads are paused while the iterator thread sends
+	 * synchronous commands, they resume when resume_count changes.
+	 */
+	int paused_conns;
+	unsigned int resume_count;
+	struct lttng_live_poll_stats poll_stats;
+	/* LTTNG_VIEWER_FLAG_* received, handled by the iterator thread */
+	uint32_t pending_flags;
+	/* one stream for each trace needing a metadata update */
+	GPtrArray *metadata_streams;
 };
 
 struct lttng_live_viewer_stream {
 	uint64_t id;
-	uint64_t mmap_size;
 	uint64_t ctf_stream_id;
-	FILE *metadata_fp_write;
-	ssize_t metadata_len;
+	/* metadata received and not parsed yet, reused by the updates */
+	GByteArray *metadata_buf;
 	int metadata_flag;
-	int data_pending;
+	/* indexes and packets read ahead */
+	GQueue *packets;
+	int index_requested;
+	enum lttng_live_sched sched;
+	/* connection of its requests, set on its first seek */
+	struct lttng_live_conn *conn;
+	/* backoff after LTTNG_VIEWER_INDEX_RETRY, in ms */
+	uint64_t retry_delay;
+	uint64_t retry_time;
 	struct lttng_live_session *session;
 	struct lttng_live_ctf_trace *ctf_trace;
-	struct lttng_viewer_index current_index;
 	char path[PATH_MAX];
+	char channel_name[LTTNG_VIEWER_NAME_MAX];
+	/* local copy of the packets, with --live-record */
+	struct live_record *record;
+	/* throughput and lag, set on its first seek */
+	struct live_stream_stats *stats;
+	/* timestamp_end of the newest index received */
+	uint64_t newest_ts_cycles;
 };
 
 struct lttng_live_session {
+	uint64_t id;
+	/* no more streams to ask after LTTNG_VIEWER_NEW_STREAMS_HUP */
+	int closed;
+	/* in us, bounds the backoff of its streams */
 	uint64_t live_timer_interval;
+	/* updated under ctx->lock, the prefetch threads count the hangups */
 	uint64_t stream_count;
+	/* in ms, when a session without streams is asked again */
+	uint64_t new_streams_time;
+	uint64_t new_streams_delay;
 	struct lttng_live_ctx *ctx;
 	struct lttng_live_viewer_stream *streams;
 	GHashTable *ctf_traces;
@@ -90,9 +188,12 @@ struct lttng_live_relay_session {
 int lttng_live_connect_viewer(struct lttng_live_ctx *ctx);
 int lttng_live_establish_connection(struct lttng_live_ctx *ctx);
 int lttng_live_list_sessions(struct lttng_live_ctx *ctx, const char *path);
-int lttng_live_attach_session(struct lttng_live_ctx *ctx, uint64_t id);
+int lttng_live_attach_session(struct lttng_live_ctx *ctx,
+		struct lttng_live_session *session);
 int lttng_live_read(struct lttng_live_ctx *ctx);
-int lttng_live_get_new_streams(struct lttng_live_ctx *ctx, uint64_t id);
+int lttng_live_get_new_streams(struct lttng_live_ctx *ctx,
+		struct lttng_live_session *session);
+void lttng_live_session_free(struct lttng_live_session *session);
 int lttng_live_should_quit(void);
 
 #endif /* _LTTNG_LIVE_FUNCTIONS_H */
@@ -37,6 +37,9 @@
 #include <assert.h>
 #include <sys/mman.h>
 #include <sys/wait.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <time.h>
 
 #define LTTNG_SYMBOL_NAME_LEN 256
 
@@ -50,8 +53,15 @@
 #include "cputop.h"
 #include "iostreamtop.h"
 #include "common.h"
+#include "field-cache.h"
+#include "history.h"
+#include "packet-pool.h"
 #include "network-live.h"
 #include "lttng-session.h"
+#include "live-stats.h"
+#include "shard.h"
+#include "decoders.h"
+#include "batch.h"
 
 #ifdef HAVE_LIBNCURSES
 #include "cursesdisplay.h"
@@ -68,12 +78,33 @@ int opt_textdump;
 int opt_child;
 int opt_begin;
 int opt_all;
+unsigned int opt_history_size = DEFAULT_HISTORY_SIZE;
+unsigned long opt_history_mem;
+unsigned long opt_live_buffer_mem = DEFAULT_LIVE_BUFFER_MEM;
+int opt_live_hugepages;
+int opt_live_connections = DEFAULT_LIVE_CONNECTIONS;
+const char *opt_live_record;
+int opt_stats;
+int opt_jobs = DEFAULT_JOBS;
+unsigned int opt_decoders = 1;
+int opt_batch;
+enum batch_format opt_batch_format = BATCH_FORMAT_JSON;
+unsigned int opt_batch_top = DEFAULT_BATCH_TOP;
+
+/* time given on the command line or from the display */
+struct trace_time {
+	int set;
+	/* from the beginning of the trace */
+	int relative;
+	uint64_t value;
+};
+
+static struct trace_time opt_begin_time, opt_end_time;
 
 int quit = 0;
 /* We need at least one valid trace to start processing. */
 int valid_trace = 0;
 
-struct lttngtop *copy;
 pthread_t display_thread;
 pthread_t timer_thread;
 
@@ -110,6 +141,20 @@ enum {
 	OPT_GUI_TEST,
 	OPT_CREATE_LOCAL_SESSION,
 	OPT_CREATE_LIVE_SESSION,
+	OPT_HISTORY_SIZE,
+	OPT_HISTORY_MEM,
+	OPT_LIVE_BUFFER_MEM,
+	OPT_LIVE_HUGEPAGES,
+	OPT_LIVE_CONNECTIONS,
+	OPT_LIVE_RECORD,
+	OPT_STATS,
+	OPT_JOBS,
+	OPT_DECODERS,
+	OPT_BATCH,
+	OPT_BATCH_FORMAT,
+	OPT_BATCH_TOP,
+	OPT_BEGIN_TIME,
+	OPT_END_TIME,
 };
 
 static struct poptOption long_options[] = {
@@ -129,6 +174,20 @@ static struct poptOption long_options[] = {
 	{ "gui-test", 'g', POPT_ARG_NONE, NULL, OPT_GUI_TEST, NULL, NULL },
 	{ "create-local-session", 0, POPT_ARG_NONE, NULL, OPT_CREATE_LOCAL_SESSION, NULL, NULL },
 	{ "create-live-session", 0, POPT_ARG_NONE, NULL, OPT_CREATE_LIVE_SESSION, NULL, NULL },
+	{ "history-size", 0, POPT_ARG_STRING, NULL, OPT_HISTORY_SIZE, NULL, NULL },
+	{ "history-mem", 0, POPT_ARG_STRING, NULL, OPT_HISTORY_MEM, NULL, NULL },
+	{ "live-buffer-mem", 0, POPT_ARG_STRING, NULL, OPT_LIVE_BUFFER_MEM, NULL, NULL },
+	{ "live-hugepages", 0, POPT_ARG_NONE, NULL, OPT_LIVE_HUGEPAGES, NULL, NULL },
+	{ "live-connections", 0, POPT_ARG_STRING, NULL, OPT_LIVE_CONNECTIONS, NULL, NULL },
+	{ "live-record", 0, POPT_ARG_STRING, &opt_live_record, OPT_LIVE_RECORD, NULL, NULL },
+	{ "stats", 0, POPT_ARG_NONE, NULL, OPT_STATS, NULL, NULL },
+	{ "jobs", 'j', POPT_ARG_STRING, NULL, OPT_JOBS, NULL, NULL },
+	{ "decoders", 0, POPT_ARG_STRING, NULL, OPT_DECODERS, NULL, NULL },
+	{ "batch", 0, POPT_ARG_NONE, NULL, OPT_BATCH, NULL, NULL },
+	{ "batch-format", 0, POPT_ARG_STRING, NULL, OPT_BATCH_FORMAT, NULL, NULL },
+	{ "batch-top", 0, POPT_ARG_STRING, NULL, OPT_BATCH_TOP, NULL, NULL },
+	{ "begin-time", 0, POPT_ARG_STRING, NULL, OPT_BEGIN_TIME, NULL, NULL },
+	{ "end-time", 0, POPT_ARG_STRING, NULL, OPT_END_TIME, NULL, NULL },
 	{ NULL, 0, 0, NULL, 0, NULL, NULL },
 };
 
@@ -140,15 +199,20 @@ static void handle_textdump_sigterm(int signal)
 }
 #endif
 
+/* an offline trace is analysed at the pace of the display */
+static int pace_snapshots;
+/* the shards merged by merge_trace(), stopped when quitting */
+static GArray *merged_shards;
+
 void *refresh_thread(void *p)
 {
 	while (1) {
 		if (quit) {
-			sem_post(&pause_sem);
+			if (merged_shards)
+				stop_shards(merged_shards);
+			sem_post(&goodtoupdate);
 			sem_post(&timer);
 			sem_post(&end_trace_sem);
-			sem_post(&goodtodisplay);
-			sem_post(&goodtoupdate);
 			pthread_exit(0);
 		}
 		if (!opt_input_path) {
@@ -156,43 +220,50 @@ void *refresh_thread(void *p)
 			mmap_live_flush(mmap_list);
 #endif
 		}
-		sem_wait(&pause_sem);
-		sem_post(&pause_sem);
 		sem_post(&timer);
 		sleep(refresh_display/NSEC_PER_SEC);
 	}
 }
 
 #ifdef HAVE_LIBNCURSES
+/*
+ * At each tick, show the last snapshot published by the tracing thread,
+ * the ones added in between stay in the history. A live trace is never
+ * held back by the display, a pause only freezes the screen. An offline
+ * trace is paused with the screen and publishes a new snapshot once the
+ * previous one is shown.
+ */
 void *ncurses_display(void *p)
 {
-	unsigned int current_display_index = 0;
-
-	sem_wait(&bootstrap);
-	/*
-	 * Prevent the 1 second delay when we hit ESC
-	 */
-	ESCDELAY = 0;
-	init_ncurses();
+	int started = 0;
 
+	register_history_thread();
 	while (1) {
 		sem_wait(&timer);
-		sem_wait(&goodtodisplay);
-		sem_wait(&pause_sem);
 
 		if (quit) {
-			sem_post(&pause_sem);
+			sem_post(&goodtoupdate);
 			sem_post(&timer);
-			reset_ncurses();
+			if (started)
+				reset_ncurses();
+			unregister_history_thread();
 			pthread_exit(0);
 		}
 
-		copy = g_ptr_array_index(copies, current_display_index);
-		assert(copy);
-		display(current_display_index++);
+		/* the screen is taken once there is something to show */
+		if (!started) {
+			if (history_empty())
+				continue;
+			/*
+			 * Prevent the 1 second delay when we hit ESC
+			 */
+			ESCDELAY = 0;
+			init_ncurses();
+			started = 1;
+		}
 
-		sem_post(&goodtoupdate);
-		sem_post(&pause_sem);
+		if (display() && pace_snapshots)
+			sem_post(&goodtoupdate);
 	}
 }
 #endif /* HAVE_LIBNCURSES */
@@ -250,6 +321,37 @@ void print_fields(struct bt_ctf_event *event, const char *procname,
 	}
 }
 
+/*
+ * Aggregate of the live streams since the previous line, at most once per
+ * second of wall clock time.
+ */
+static void textdump_live_stats(void)
+{
+	static time_t last_stats;
+	struct live_stats_sample *all;
+	GArray *samples;
+	uint64_t lag = 0;
+	time_t now;
+
+	now = time(NULL);
+	if (now == last_stats)
+		return;
+	last_stats = now;
+
+	samples = live_stats_sample();
+	if (!samples)
+		return;
+	all = &g_array_index(samples, struct live_stats_sample, 0);
+	if (all->newest_ts > last_event_ts)
+		lag = all->newest_ts - last_event_ts;
+	fprintf(output, "[live] %.0f bytes/s, %.1f packets/s, latency %"
+			PRIu64 " us, %" PRIu64 " retries, lag %" PRIu64
+			" ms\n", all->bytes_per_sec, all->packets_per_sec,
+			all->latency_us, all->retries,
+			lag / (1000 * NSEC_PER_USEC));
+	g_array_free(samples, TRUE);
+}
+
 /*
  * hook on each event to check the timestamp and refresh the display if
  * necessary
@@ -261,11 +363,10 @@ enum bt_cb_ret textdump(struct bt_ctf_event *call_data, void *private_data)
 	struct tm start;
 	uint64_t ts_nsec_start;
 	int pid, cpu_id, tid, ret, lookup, current_syscall = 0;
-	const struct bt_definition *scope;
 	const char *hostname, *procname;
 	struct cputime *cpu;
 	char *from_syscall = NULL;
-	int syscall_exit = 0;
+	enum lttngtop_event_kind kind;
 
 	timestamp = bt_ctf_get_timestamp(call_data);
 
@@ -275,6 +376,9 @@ enum bt_cb_ret textdump(struct bt_ctf_event *call_data, void *private_data)
 
 	last_event_ts = timestamp;
 
+	if (opt_stats)
+		textdump_live_stats();
+
 	start = format_timestamp(timestamp);
 	ts_nsec_start = timestamp % NSEC_PER_SEC;
 
@@ -286,6 +390,7 @@ enum bt_cb_ret textdump(struct bt_ctf_event *call_data, void *private_data)
 	tid = get_context_tid(call_data);
 	
 	hostname = get_context_hostname(call_data);
+	kind = get_event_kind(call_data);
 	if (opt_child)
 		lookup = pid;
 	else
@@ -293,14 +398,12 @@ enum bt_cb_ret textdump(struct bt_ctf_event *call_data, void *private_data)
 	if (opt_tid || opt_procname || opt_exec_name) {
 		if (!lookup_filter_tid_list(lookup)) {
 			/* To display when a process of ours in getting scheduled in */
-			if (strcmp(bt_ctf_event_name(call_data), "sched_switch") == 0) {
+			if (kind == EVENT_KIND_SCHED_SWITCH) {
 				int next_tid;
 
-				scope = bt_ctf_get_top_level_scope(call_data,
-						BT_EVENT_FIELDS);
-				next_tid = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-							scope, "_next_tid"));
-				if (bt_ctf_field_get_error()) {
+				next_tid = get_field_int64(call_data,
+							FIELD_NEXT_TID);
+				if (get_field_error()) {
 					fprintf(stderr, "Missing next_tid field\n");
 					goto error;
 				}
@@ -320,22 +423,14 @@ enum bt_cb_ret textdump(struct bt_ctf_event *call_data, void *private_data)
 		}
 	}
 
-	if (((strncmp(bt_ctf_event_name(call_data),
-						"exit_syscall", 12)) == 0) ||
-			((strncmp(bt_ctf_event_name(call_data),
-				 "syscall_exit", 12)) == 0)) {
-		syscall_exit = 1;
-	}
-
-	if (last_syscall && !syscall_exit) {
+	if (last_syscall && kind != EVENT_KIND_SYSCALL_EXIT) {
 		last_syscall = NULL;
 		fprintf(output, " ...interrupted...\n");
 	}
 
 	cpu_id = get_cpu_id(call_data);
 	procname = get_context_comm(call_data);
-	if ((strncmp(bt_ctf_event_name(call_data), "sys_", 4) == 0) ||
-			(strncmp(bt_ctf_event_name(call_data), "syscall_entry", 13) == 0)){
+	if (kind == EVENT_KIND_SYSCALL_ENTRY) {
 		cpu = get_cpu(cpu_id);
 		cpu->current_syscall = g_new0(struct syscall, 1);
 		cpu->current_syscall->name = strdup(bt_ctf_event_name(call_data));
@@ -343,7 +438,7 @@ enum bt_cb_ret textdump(struct bt_ctf_event *call_data, void *private_data)
 		cpu->current_syscall->cpu_id = cpu_id;
 		last_syscall = cpu->current_syscall;
 		current_syscall = 1;
-	} else if (syscall_exit) {
+	} else if (kind == EVENT_KIND_SYSCALL_EXIT) {
 		struct tm start_ts;
 
 		/* Return code of a syscall if it was the last displayed event. */
@@ -352,10 +447,8 @@ enum bt_cb_ret textdump(struct bt_ctf_event *call_data, void *private_data)
 				int64_t syscall_ret;
 
 				delta = timestamp - last_syscall->ts_start;
-				scope = bt_ctf_get_top_level_scope(call_data,
-						BT_EVENT_FIELDS);
-				syscall_ret = bt_ctf_get_int64(bt_ctf_get_field(call_data,
-							scope, "_ret"));
+				syscall_ret = get_field_int64(call_data,
+							FIELD_RET);
 
 				fprintf(output, "= %" PRId64 " (%" PRIu64 ".%09" PRIu64 "s)\n",
 						syscall_ret, delta / NSEC_PER_SEC,
@@ -416,22 +509,71 @@ end_stop:
 	return BT_CB_OK_STOP;
 }
 
+/*
+ * Each kprobe callback is registered with its own struct kprobes as
+ * private data.
+ */
 enum bt_cb_ret handle_kprobes(struct bt_ctf_event *call_data, void *private_data)
 {
-	int i;
-	struct kprobes *kprobe;
+	struct kprobes *kprobe = private_data;
 
-	/* for kprobes */
-	for (i = 0; i < lttngtop.kprobes_table->len; i++) {
-		kprobe = g_ptr_array_index(lttngtop.kprobes_table, i);
-		if (strcmp(bt_ctf_event_name(call_data), kprobe->probe_name) == 0) {
-			kprobe->count++;
-		}
-	}
+	kprobe->count++;
 
 	return BT_CB_OK;
 }
 
+/* publish a snapshot for the display, or write it in batch */
+static void add_snapshot(struct lttngtop *snapshot)
+{
+	if (opt_batch) {
+		batch_print_snapshot(output, snapshot, opt_batch_format,
+				opt_batch_top);
+		free_lttngtop_snapshot(snapshot);
+		return;
+	}
+	/* the display threads post it once more when quitting */
+	if (pace_snapshots && !quit)
+		sem_wait(&goodtoupdate);
+	add_history(snapshot);
+}
+
+static int add_interval(unsigned long start, unsigned long end)
+{
+	add_snapshot(get_copy_lttngtop(start, end));
+	return 0;
+}
+
+/*
+ * Time window of the analysis, the whole trace by default. The events
+ * before the window only rebuild the state, the snapshots cover the
+ * refresh intervals from the beginning of the window to its end.
+ */
+static uint64_t window_begin, window_end = -1ULL;
+static int window_done;
+static int (*publish_interval)(unsigned long start, unsigned long end) =
+	add_interval;
+static int publish_error;
+
+/* time requested from the display, handled by iter_trace() */
+static uint64_t trace_begin;
+static uint64_t jump_target;
+static int jump_requested, jump_allowed;
+
+/* only set in the worker processes of the shards */
+static struct shard *current_shard;
+
+static int write_shard_interval(unsigned long start, unsigned long end)
+{
+	struct lttngtop *snapshot;
+	int ret;
+
+	snapshot = get_copy_lttngtop(start, end);
+	ret = write_shard_snapshot(current_shard, snapshot);
+	free_lttngtop_snapshot(snapshot);
+
+	return ret;
+}
+
 /*
  * hook on each event to check the timestamp and refresh the display if
  * necessary
@@ -440,7 +582,7 @@ enum bt_cb_ret check_timestamp(struct bt_ctf_event *call_data, void *private_dat
 {
 	unsigned long timestamp;
 
-	timestamp = bt_ctf_get_timestamp(call_data);
+	timestamp = get_event_timestamp(call_data);
 	if (timestamp == -1ULL)
 		goto error;
 
@@ -450,15 +592,31 @@ enum bt_cb_ret check_timestamp(struct bt_ctf_event *call_data, void *private_dat
 
 	last_event_ts = timestamp;
 
+	if (window_done)
+		goto end_stop;
+	if (timestamp < window_begin)
+		return BT_CB_OK;
+	if (last_display_update < window_begin) {
+		/* the counters of the warm-up are dropped */
+		free_lttngtop_snapshot(get_copy_lttngtop(window_begin,
+					window_begin));
+		if (carried_state)
+			restart_live_state(window_begin);
+		last_display_update = window_begin;
+	}
+
 	if (last_display_update == 0)
 		last_display_update = timestamp;
 
+	if (timestamp >= window_end) {
+		if (publish_interval(last_display_update, window_end) < 0)
+			goto error_publish;
+		window_done = 1;
+		goto end_stop;
+	}
 	if (timestamp - last_display_update >= refresh_display) {
-		sem_wait(&goodtoupdate);
-		g_ptr_array_add(copies, get_copy_lttngtop(last_display_update,
-					timestamp));
-		sem_post(&goodtodisplay);
-		sem_post(&bootstrap);
+		if (publish_interval(last_display_update, timestamp) < 0)
+			goto error_publish;
 		last_display_update = timestamp;
 	}
 	return BT_CB_OK;
@@ -467,154 +625,112 @@ error:
 	fprintf(stderr, "check_timestamp callback error\n");
 	return BT_CB_ERROR_STOP;
 
+error_publish:
+	publish_error = 1;
+	quit = 1;
+	return BT_CB_ERROR_STOP;
+
 end_stop:
 	return BT_CB_OK_STOP;
 }
 
 /*
- * get_perf_counter : get or create and return a perf_counter struct for
- * either a process or a cpu (only one of the 2 parameters mandatory)
+ * The cpu counters hold the last value read on the cpu, the process
+ * gets the difference.
  */
-struct perfcounter *get_perf_counter(const char *name, struct processtop *proc,
-		struct cputime *cpu)
-{
-	struct perfcounter *ret;
-	GHashTable *table;
-
-	if (proc)
-		table = proc->perf;
-	else if (cpu)
-		table = cpu->perf;
-	else
-		goto error;
-
-	ret = g_hash_table_lookup(table, (gpointer) name);
-	if (ret)
-		goto end;
-
-	ret = g_new0(struct perfcounter, 1);
-	/* by default, make it visible in the UI */
-	ret->visible = 1;
-	g_hash_table_insert(table, (gpointer) strdup(name), ret);
-
-end:
-	return ret;
-
-error:
-	return NULL;
-}
-
 void update_perf_value(struct processtop *proc, struct cputime *cpu,
-		const char *name, int value)
+		unsigned int slot, uint64_t value)
 {
-	struct perfcounter *cpu_perf, *process_perf;
+	uint64_t *cpu_count;
 
-	cpu_perf = get_perf_counter(name, NULL, cpu);
-	if (cpu_perf->count < value) {
-		process_perf = get_perf_counter(name, proc, NULL);
-		process_perf->count += value - cpu_perf->count;
-		cpu_perf->count = value;
+	cpu_count = get_perf_value_ptr(&cpu->perf, slot);
+	if (*cpu_count < value) {
+		*get_perf_value_ptr(&proc->perf, slot) += value - *cpu_count;
+		*cpu_count = value;
 	}
 }
 
-void extract_perf_counter_scope(const struct bt_ctf_event *event,
-		const struct bt_definition *scope,
-		struct processtop *proc,
-		struct cputime *cpu)
+void update_perf_counter(struct processtop *proc, const struct bt_ctf_event *event)
 {
-	struct bt_definition const * const *list = NULL;
+	const struct perf_field *fields;
 	const struct bt_definition *field;
-	unsigned int count;
-	struct perfcounter *perfcounter;
-	GHashTableIter iter;
-	gpointer key;
-	int ret;
-
-	if (!scope)
-		goto end;
-
-	ret = bt_ctf_get_field_list(event, scope, &list, &count);
-	if (ret < 0)
-		goto end;
-
-	if (count == 0)
-		goto end;
-
-	g_hash_table_iter_init(&iter, global_perf_liszt);
-	while (g_hash_table_iter_next (&iter, &key, (gpointer) &perfcounter)) {
-		field = bt_ctf_get_field(event, scope, (char *) key);
-		if (field) {
-			int value = bt_ctf_get_uint64(field);
-			if (bt_ctf_field_get_error())
-				continue;
-			update_perf_value(proc, cpu, (char *) key, value);
-		}
+	struct event_record *record;
+	struct cputime *cpu;
+	unsigned int i, count;
+	uint64_t value;
+
+	/* the decoder kept the registered counters of the event */
+	record = get_event_record(event);
+	if (record) {
+		if (record->nr_perf == 0)
+			return;
+		cpu = get_cpu(get_cpu_id(event));
+		for (i = 0; i < record->nr_perf; i++)
+			update_perf_value(proc, cpu, record->perf[i].slot,
+					record->perf[i].value);
+		return;
 	}
 
-end:
-	return;
-}
-
-void update_perf_counter(struct processtop *proc, const struct bt_ctf_event *event)
-{
-	struct cputime *cpu;
-	const struct bt_definition *scope;
+	count = get_cached_perf_fields(event, &fields);
+	if (count == 0)
+		return;
 
 	cpu = get_cpu(get_cpu_id(event));
-
-	scope = bt_ctf_get_top_level_scope(event, BT_STREAM_EVENT_CONTEXT);
-	extract_perf_counter_scope(event, scope, proc, cpu);
-
-	scope = bt_ctf_get_top_level_scope(event, BT_STREAM_PACKET_CONTEXT);
-	extract_perf_counter_scope(event, scope, proc, cpu);
-
-	scope = bt_ctf_get_top_level_scope(event, BT_EVENT_CONTEXT);
-	extract_perf_counter_scope(event, scope, proc, cpu);
+	for (i = 0; i < count; i++) {
+		field = get_perf_field(event, &fields[i]);
+		if (!field)
+			continue;
+		value = bt_ctf_get_uint64(field);
+		if (bt_ctf_field_get_error())
+			continue;
+		update_perf_value(proc, cpu, fields[i].slot, value);
+	}
 }
 
 enum bt_cb_ret fix_process_table(struct bt_ctf_event *call_data,
 		void *private_data)
 {
+	const struct event_context *ctx;
 	int pid, tid, ppid, vpid, vtid, vppid;
 	char *comm, *hostname;
 	struct processtop *parent, *child;
 	unsigned long timestamp;
 
-	timestamp = bt_ctf_get_timestamp(call_data);
+	timestamp = get_event_timestamp(call_data);
 	if (timestamp == -1ULL)
 		goto error;
 
-	pid = get_context_pid(call_data);
-	if (pid == -1ULL) {
+	/*
+	 * First callback of every event: decode the context once for all
+	 * the following callbacks.
+	 */
+	ctx = decode_event_context(call_data);
+
+	pid = ctx->pid;
+	if (ctx->pid == -1ULL) {
+		fprintf(stderr, "Missing pid context info\n");
 		goto error;
 	}
 
-	tid = get_context_tid(call_data);
-	if (tid == -1ULL) {
+	tid = ctx->tid;
+	if (ctx->tid == -1ULL) {
+		fprintf(stderr, "Missing tid context info\n");
 		goto error;
 	}
-	ppid = get_context_ppid(call_data);
-	if (ppid == -1ULL) {
+	ppid = ctx->ppid;
+	if (ctx->ppid == -1ULL) {
 		goto end;
 	}
-	vpid = get_context_vpid(call_data);
-	if (pid == -1ULL) {
-		vpid = -1;
-	}
-	vtid = get_context_vtid(call_data);
-	if (tid == -1ULL) {
-		vtid = -1;
-	}
-	vppid = get_context_vppid(call_data);
-	if (ppid == -1ULL) {
-		vppid = -1;
-	}
-	comm = get_context_comm(call_data);
+	vpid = ctx->vpid;
+	vtid = ctx->vtid;
+	vppid = ctx->vppid;
+	comm = ctx->comm;
 	if (!comm) {
+		fprintf(stderr, "Missing comm context info\n");
 		goto error;
 	}
 	/* optional */
-	hostname = get_context_hostname(call_data);
+	hostname = ctx->hostname;
 
 	/* find or create the current process */
 	child = find_process_tid(&lttngtop, tid, comm);
@@ -660,7 +776,8 @@ error:
 
 void init_lttngtop()
 {
-	copies = g_ptr_array_new();
+	long nr_cpus;
+
 	global_perf_liszt = g_hash_table_new(g_str_hash, g_str_equal);
 	global_filter_list = g_hash_table_new(g_str_hash, g_str_equal);
 	global_host_list = g_hash_table_new(g_str_hash, g_str_equal);
@@ -668,11 +785,8 @@ void init_lttngtop()
 	tid_filter_list = g_hash_table_new(g_str_hash,
 			g_str_equal);
 
-	sem_init(&goodtodisplay, 0, 0);
 	sem_init(&goodtoupdate, 0, 1);
 	sem_init(&timer, 0, 1);
-	sem_init(&bootstrap, 0, 0);
-	sem_init(&pause_sem, 0, 1);
 	sem_init(&end_trace_sem, 0, 0);
 
 	reset_global_counters();
@@ -684,7 +798,9 @@ void init_lttngtop()
 			g_direct_equal);
 	lttngtop.process_table = g_ptr_array_new();
 	lttngtop.files_table = g_ptr_array_new();
-	lttngtop.cpu_table = g_ptr_array_new();
+	/* the trace cpus are only known once read, start from the host */
+	nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	init_cpu_table(nr_cpus > 0 ? nr_cpus : 1);
 
 	toggle_filter = -1;
 }
@@ -703,10 +819,24 @@ void usage(FILE *fp)
 	fprintf(fp, "  -k, --kprobes            Comma-separated list of kprobes to insert (same format as lttng enable-event)\n");
 	fprintf(fp, "  -r, --relay-hostname     Network live streaming : hostname of the lttng-relayd (default port)\n");
 	fprintf(fp, "  -b, --begin              Network live streaming : read the trace for the beginning of the recording\n");
-	fprintf(fp, "  -o, --output <filename>  In textdump, output the log in <filename>\n");
+	fprintf(fp, "  -o, --output <filename>  In textdump or batch, output the log in <filename>\n");
+	fprintf(fp, "  -j, --jobs <n>           Offline traces : analyse the trace in <n> time ranges in parallel, not in textdump (default %d)\n", DEFAULT_JOBS);
+	fprintf(fp, "  --begin-time <time>      Offline traces : start the analysis at <time>, a timestamp in ns or +<seconds> from the beginning of the trace\n");
+	fprintf(fp, "  --end-time <time>        Offline traces : stop the analysis at <time>, same format as --begin-time\n");
+	fprintf(fp, "  --batch                  Offline traces : no display, write a summary of each refresh interval to the output\n");
+	fprintf(fp, "  --batch-format <format>  Format of the batch summaries : json (one object per line, default) or csv\n");
+	fprintf(fp, "  --batch-top <n>          Number of processes in each top of the batch summaries (default %d)\n", DEFAULT_BATCH_TOP);
+	fprintf(fp, "  --decoders <n>           Offline traces : decode the streams in <n> threads, not in textdump (default 1, at most %d)\n", MAX_DECODERS);
 	fprintf(fp, "  -g, --gui-test           Test if the ncurses support is compiled in (return 0 if it is)\n");
 	fprintf(fp, "  --create-local-session   Setup a LTTng local session with all the right parameters\n");
 	fprintf(fp, "  --create-live-session    Setup a LTTng live session on localhost with all the right parameters\n");
+	fprintf(fp, "  --history-size <count>   Number of refreshes kept in the history (default %d)\n", DEFAULT_HISTORY_SIZE);
+	fprintf(fp, "  --history-mem <size>     Maximum memory used by the history, with an optional k, M or G suffix (default unlimited)\n");
+	fprintf(fp, "  --live-buffer-mem <size> Network live streaming : memory of the packets read ahead, with an optional k, M or G suffix, 0 for unlimited (default %luM)\n", DEFAULT_LIVE_BUFFER_MEM >> 20);
+	fprintf(fp, "  --live-hugepages         Network live streaming : back the large packet buffers with huge pages when available\n");
+	fprintf(fp, "  --live-connections <n>   Network live streaming : number of connections to the relay the streams are spread on (default %d, at most %d)\n", DEFAULT_LIVE_CONNECTIONS, MAX_LIVE_CONNECTIONS);
+	fprintf(fp, "  --live-record <dir>      Network live streaming : copy the trace as it is analysed in <dir>, to read it again offline\n");
+	fprintf(fp, "  --stats                  Network live streaming : in textdump, print the throughput and the lag behind the relay every second\n");
 }
 
 /*
@@ -788,10 +918,114 @@ end:
  * Return 0 if caller should continue, < 0 if caller should return
  * error, > 0 if caller should exit without reporting error.
  */
+/*
+ * Parse a positive number, with a k, M or G suffix if allow_suffix is set.
+ */
+static int parse_size(const char *str, unsigned long *size, int allow_suffix)
+{
+	char *end;
+	unsigned long value;
+
+	if (!str || *str == '\0' || *str == '-')
+		return -1;
+
+	errno = 0;
+	value = strtoul(str, &end, 0);
+	if (errno != 0)
+		return -1;
+
+	if (allow_suffix) {
+		switch (*end) {
+		case 'G':
+			value <<= 10;
+			/* fall-through */
+		case 'M':
+			value <<= 10;
+			/* fall-through */
+		case 'k':
+		case 'K':
+			value <<= 10;
+			end++;
+			break;
+		default:
+			break;
+		}
+	}
+	if (*end != '\0')
+		return -1;
+
+	*size = value;
+	return 0;
+}
+
+/*
+ * Parse a time of the trace: a timestamp in nanoseconds, or a number of
+ * seconds from the beginning of the trace with a '+' prefix, decimals
+ * allowed.
+ */
+static int parse_time(const char *str, struct trace_time *time)
+{
+	unsigned long long sec, nsec = 0;
+	unsigned int digits = 0;
+	char *end;
+
+	if (!str)
+		return -1;
+	time->relative = (*str == '+');
+	if (time->relative)
+		str++;
+	if (*str < '0' || *str > '9')
+		return -1;
+
+	errno = 0;
+	sec = strtoull(str, &end, 10);
+	if (errno != 0)
+		return -1;
+	if (time->relative && *end == '.') {
+		for (end++; *end >= '0' && *end <= '9'; end++) {
+			if (digits++ < 9)
+				nsec = nsec * 10 + *end - '0';
+		}
+		for (; digits < 9; digits++)
+			nsec *= 10;
+	}
+	if (*end != '\0')
+		return -1;
+
+	time->value = time->relative ? sec * NSEC_PER_SEC + nsec : sec;
+	time->set = 1;
+	return 0;
+}
+
+static uint64_t resolve_time(const struct trace_time *time)
+{
+	return time->relative ? trace_begin + time->value : time->value;
+}
+
+int request_jump(const char *str)
+{
+	struct trace_time time;
+	uint64_t target;
+
+	if (!jump_allowed || parse_time(str, &time) < 0)
+		return -1;
+	target = resolve_time(&time);
+	if (target >= window_end)
+		return -1;
+
+	jump_target = target;
+	g_atomic_int_set(&jump_requested, 1);
+	/* the analysis may wait at the end of the trace */
+	sem_post(&end_trace_sem);
+
+	return 0;
+}
+
 static int parse_options(int argc, char **argv)
 {
 	poptContext pc;
 	int opt, ret = 0;
+	unsigned long size;
 	char *tmp_str;
 	int *tid;
 	int i;
@@ -878,6 +1112,117 @@ static int parse_options(int argc, char **argv)
 			case OPT_VERBOSE:
 				babeltrace_verbose = 1;
 				break;
+			case OPT_HISTORY_SIZE:
+				tmp_str = (char *) poptGetOptArg(pc);
+				ret = parse_size(tmp_str, &size, 0);
+				free(tmp_str);
+				if (ret < 0 || size == 0 || size > UINT_MAX) {
+					fprintf(stderr, "[error] Invalid history size\n");
+					ret = -EINVAL;
+					goto end;
+				}
+				opt_history_size = size;
+				break;
+			case OPT_HISTORY_MEM:
+				tmp_str = (char *) poptGetOptArg(pc);
+				ret = parse_size(tmp_str, &size, 1);
+				free(tmp_str);
+				if (ret < 0) {
+					fprintf(stderr, "[error] Invalid history memory size\n");
+					ret = -EINVAL;
+					goto end;
+				}
+				opt_history_mem = size;
+				break;
+			case OPT_LIVE_BUFFER_MEM:
+				tmp_str = (char *) poptGetOptArg(pc);
+				ret = parse_size(tmp_str, &size, 1);
+				free(tmp_str);
+				if (ret < 0) {
+					fprintf(stderr, "[error] Invalid live buffer memory size\n");
+					ret = -EINVAL;
+					goto end;
+				}
+				opt_live_buffer_mem = size;
+				break;
+			case OPT_LIVE_HUGEPAGES:
+				opt_live_hugepages = 1;
+				break;
+			case OPT_LIVE_CONNECTIONS:
+				tmp_str = (char *) poptGetOptArg(pc);
+				ret = parse_size(tmp_str, &size, 0);
+				free(tmp_str);
+				if (ret < 0 || size == 0 ||
+						size > MAX_LIVE_CONNECTIONS) {
+					fprintf(stderr, "[error] Invalid number of live connections\n");
+					ret = -EINVAL;
+					goto end;
+				}
+				opt_live_connections = size;
+				break;
+			case OPT_LIVE_RECORD:
+				break;
+			case OPT_STATS:
+				opt_stats = 1;
+				break;
+			case OPT_JOBS:
+				tmp_str = (char *) poptGetOptArg(pc);
+				ret = parse_size(tmp_str, &size, 0);
+				free(tmp_str);
+				if (ret < 0 || size == 0 || size > MAX_JOBS) {
+					fprintf(stderr, "[error] Invalid number of jobs\n");
+					ret = -EINVAL;
+					goto end;
+				}
+				opt_jobs = size;
+				break;
+			case OPT_DECODERS:
+				tmp_str = (char *) poptGetOptArg(pc);
+				ret = parse_size(tmp_str, &size, 0);
+				free(tmp_str);
+				if (ret < 0 || size == 0 || size > MAX_DECODERS) {
+					fprintf(stderr, "[error] Invalid number of decoders\n");
+					ret = -EINVAL;
+					goto end;
+				}
+				opt_decoders = size;
+				break;
+			case OPT_BATCH:
+				opt_batch = 1;
+				break;
+			case OPT_BATCH_FORMAT:
+				tmp_str = (char *) poptGetOptArg(pc);
+				ret = parse_batch_format(tmp_str, &opt_batch_format);
+				free(tmp_str);
+				if (ret < 0) {
+					fprintf(stderr, "[error] Unknown batch format, json or csv expected\n");
+					ret = -EINVAL;
+					goto end;
+				}
+				break;
+			case OPT_BATCH_TOP:
+				tmp_str = (char *) poptGetOptArg(pc);
+				ret = parse_size(tmp_str, &size, 0);
+				free(tmp_str);
+				if (ret < 0 || size == 0 || size > UINT_MAX) {
+					fprintf(stderr, "[error] Invalid number of processes in the batch summaries\n");
+					ret = -EINVAL;
+					goto end;
+				}
+				opt_batch_top = size;
+				break;
+			case OPT_BEGIN_TIME:
+			case OPT_END_TIME:
+				tmp_str = (char *) poptGetOptArg(pc);
+				ret = parse_time(tmp_str, opt == OPT_BEGIN_TIME ?
+						&opt_begin_time : &opt_end_time);
+				free(tmp_str);
+				if (ret < 0) {
+					fprintf(stderr, "[error] Invalid time, a timestamp in ns or +<seconds> expected\n");
+					ret = -EINVAL;
+					goto end;
+				}
+				break;
 			default:
 				ret = -EINVAL;
 				goto end;
@@ -896,6 +1241,18 @@ static int parse_options(int argc, char **argv)
 	if (!opt_exec_name) {
 		opt_input_path = poptGetArg(pc);
 	}
+	if ((opt_begin_time.set || opt_end_time.set) && !opt_input_path) {
+		fprintf(stderr, "[error] The time window only applies to "
+				"offline traces\n");
+		ret = -EINVAL;
+		goto end;
+	}
+	if (opt_batch && (!opt_input_path || opt_textdump)) {
+		fprintf(stderr, "[error] The batch mode only reads offline "
+				"traces, without textdump\n");
+		ret = -EINVAL;
+		goto end;
+	}
 	if (!opt_output) {
 		opt_output = strdup("/dev/stdout");
 	}
@@ -913,31 +1270,244 @@ end:
 	return ret;
 }
 
-void iter_trace(struct bt_context *bt_ctx)
+static void add_analysis_callback(GArray *callbacks, const char *event,
+		enum bt_cb_ret (*callback)(struct bt_ctf_event *event,
+			void *private_data),
+		void *private_data)
+{
+	struct event_callback cb;
+
+	cb.event = event ? g_quark_from_static_string(event) : 0;
+	cb.callback = callback;
+	cb.private_data = private_data;
+	g_array_append_val(callbacks, cb);
+}
+
+/* the callbacks of the analysis, in the order they run on an event */
+static GArray *analysis_callbacks(void)
+{
+	GArray *callbacks;
+	struct kprobes *kprobe;
+	int i;
+
+	callbacks = g_array_new(FALSE, FALSE, sizeof(struct event_callback));
+
+	/* at each event, verify the status of the process table */
+	add_analysis_callback(callbacks, NULL, fix_process_table, NULL);
+	/* to handle the follow child option */
+	add_analysis_callback(callbacks, "sched_process_fork",
+			handle_sched_process_fork, NULL);
+	/* to clean up the process table */
+	add_analysis_callback(callbacks, "sched_process_free",
+			handle_sched_process_free, NULL);
+	/* to get all the process from the statedumps */
+	add_analysis_callback(callbacks, "lttng_statedump_process_state",
+			handle_statedump_process_state, NULL);
+	add_analysis_callback(callbacks, "lttng_statedump_file_descriptor",
+			handle_statedump_file_descriptor, NULL);
+	add_analysis_callback(callbacks, "sys_open", handle_sys_open, NULL);
+	add_analysis_callback(callbacks, "syscall_entry_open",
+			handle_sys_open, NULL);
+
+	add_analysis_callback(callbacks, "sys_socket", handle_sys_socket, NULL);
+	add_analysis_callback(callbacks, "syscall_entry_socket",
+			handle_sys_socket, NULL);
+
+	add_analysis_callback(callbacks, "sys_close", handle_sys_close, NULL);
+	add_analysis_callback(callbacks, "syscall_entry_close",
+			handle_sys_close, NULL);
+
+	add_analysis_callback(callbacks, "exit_syscall",
+			handle_exit_syscall, NULL);
+	add_analysis_callback(callbacks, "syscall_exit_open",
+			handle_exit_syscall, NULL);
+	add_analysis_callback(callbacks, "syscall_exit_socket",
+			handle_exit_syscall, NULL);
+	add_analysis_callback(callbacks, "syscall_exit_close",
+			handle_exit_syscall, NULL);
+	if (opt_textdump) {
+		add_analysis_callback(callbacks, NULL, textdump, NULL);
+		return callbacks;
+	}
+
+	/* at each event check if we need to refresh */
+	add_analysis_callback(callbacks, NULL, check_timestamp, NULL);
+	/* to handle the scheduling events */
+	add_analysis_callback(callbacks, "sched_switch",
+			handle_sched_switch, NULL);
+	/* for IO top */
+	add_analysis_callback(callbacks, "sys_write", handle_sys_write, NULL);
+	add_analysis_callback(callbacks, "syscall_entry_write",
+			handle_sys_write, NULL);
+	add_analysis_callback(callbacks, "syscall_exit_write",
+			handle_exit_syscall, NULL);
+
+	add_analysis_callback(callbacks, "sys_read", handle_sys_read, NULL);
+	add_analysis_callback(callbacks, "syscall_entry_read",
+			handle_sys_read, NULL);
+	add_analysis_callback(callbacks, "syscall_exit_read",
+			handle_exit_syscall, NULL);
+
+	/* for kprobes */
+	if (lttngtop.kprobes_table) {
+		for (i = 0; i < lttngtop.kprobes_table->len; i++) {
+			kprobe = g_ptr_array_index(lttngtop.kprobes_table, i);
+			add_analysis_callback(callbacks, kprobe->probe_name,
+					handle_kprobes, kprobe);
+		}
+	}
+
+	return callbacks;
+}
+
+/*
+ * The analysis reads the trace with a babeltrace iterator, or with the
+ * decoders when the streams of an offline trace are decoded in threads.
+ */
+struct analysis_iter {
+	struct bt_ctf_iter *iter;
+	struct decoders *decoders;
+};
+
+/* opened with the first iterator, after the perf counters are known */
+static struct decoders *decoders;
+
+int bt_context_add_traces_recursive(struct bt_context *ctx, const char *path,
+		const char *format_str,
+		void (*packet_seek)(struct bt_stream_pos *pos,
+			size_t offset, int whence));
+
+static int open_decoder_trace(struct bt_context *bt_ctx)
+{
+	return bt_context_add_traces_recursive(bt_ctx, opt_input_path, "ctf",
+			NULL);
+}
+
+/* iterator from pos with the callbacks of the analysis */
+static struct analysis_iter *create_analysis_iter(struct bt_context *bt_ctx,
+		struct bt_iter_pos *pos)
+{
+	struct analysis_iter *iter;
+	struct event_callback *cb;
+	GArray *callbacks;
+	int i;
+
+	iter = g_new0(struct analysis_iter, 1);
+	callbacks = analysis_callbacks();
+	if (opt_decoders > 1 && opt_input_path && !opt_textdump) {
+		if (!decoders)
+			decoders = open_decoders(opt_decoders,
+					open_decoder_trace);
+		if (!decoders || start_decoders(decoders, pos, callbacks) < 0)
+			goto error;
+		iter->decoders = decoders;
+		goto end;
+	}
+
+	iter->iter = bt_ctf_iter_create(bt_ctx, pos, NULL);
+	if (!iter->iter)
+		goto error;
+	for (i = 0; i < callbacks->len; i++) {
+		cb = &g_array_index(callbacks, struct event_callback, i);
+		bt_ctf_iter_add_callback(iter->iter, cb->event,
+				cb->private_data, 0, cb->callback,
+				NULL, NULL, NULL);
+	}
+
+end:
+	g_array_free(callbacks, TRUE);
+	return iter;
+
+error:
+	g_array_free(callbacks, TRUE);
+	g_free(iter);
+	return NULL;
+}
+
+static void destroy_analysis_iter(struct analysis_iter *iter)
+{
+	if (iter->decoders)
+		stop_decoders(iter->decoders);
+	else
+		bt_ctf_iter_destroy(iter->iter);
+	g_free(iter);
+}
+
+/* same as bt_ctf_iter_read_event(), NULL at the end of the trace */
+static struct bt_ctf_event *read_analysis_event(struct analysis_iter *iter)
+{
+	if (iter->decoders)
+		return read_decoded_event(iter->decoders);
+
+	return bt_ctf_iter_read_event(iter->iter);
+}
+
+static int next_analysis_event(struct analysis_iter *iter)
+{
+	if (iter->decoders)
+		return next_decoded_event(iter->decoders);
+
+	return bt_iter_next(bt_ctf_get_iter(iter->iter));
+}
+
+/* iterator from the time from, from the beginning of the trace if 0 */
+static struct analysis_iter *seek_analysis_from(struct bt_context *bt_ctx,
+		uint64_t from)
+{
+	struct bt_iter_pos pos;
+
+	pos.type = BT_SEEK_BEGIN;
+	if (from) {
+		pos.type = BT_SEEK_TIME;
+		pos.u.seek_time = from;
+	}
+
+	return create_analysis_iter(bt_ctx, &pos);
+}
+
+static int statedump_started, statedump_done;
+
+static enum bt_cb_ret handle_statedump_start(struct bt_ctf_event *call_data,
+		void *private_data)
+{
+	statedump_started = 1;
+	return BT_CB_OK;
+}
+
+static enum bt_cb_ret handle_statedump_end(struct bt_ctf_event *call_data,
+		void *private_data)
+{
+	statedump_done = 1;
+	return BT_CB_OK;
+}
+
+/*
+ * The processes and their files known before begin are rebuilt from the
+ * statedump at the beginning of the trace, the trace is not read further
+ * than the end of the statedump, begin or the first refresh interval
+ * without statedump.
+ */
+static int bootstrap_state(struct bt_context *bt_ctx, uint64_t begin)
 {
 	struct bt_ctf_iter *iter;
 	struct bt_iter_pos begin_pos;
-	struct kprobes *kprobe;
 	const struct bt_ctf_event *event;
-	int i;
-	int ret = 0;
+	uint64_t timestamp, first = 0;
+	int ret;
 
+	statedump_started = 0;
+	statedump_done = 0;
 	begin_pos.type = BT_SEEK_BEGIN;
 	iter = bt_ctf_iter_create(bt_ctx, &begin_pos, NULL);
+	if (!iter)
+		return -1;
 
-	/* at each event, verify the status of the process table */
-	bt_ctf_iter_add_callback(iter, 0, NULL, 0,
-			fix_process_table,
-			NULL, NULL, NULL);
-	/* to handle the follow child option */
 	bt_ctf_iter_add_callback(iter,
-			g_quark_from_static_string("sched_process_fork"),
-			NULL, 0, handle_sched_process_fork, NULL, NULL, NULL);
-	/* to clean up the process table */
+			g_quark_from_static_string("lttng_statedump_start"),
+			NULL, 0, handle_statedump_start, NULL, NULL, NULL);
 	bt_ctf_iter_add_callback(iter,
-			g_quark_from_static_string("sched_process_free"),
-			NULL, 0, handle_sched_process_free, NULL, NULL, NULL);
-	/* to get all the process from the statedumps */
+			g_quark_from_static_string("lttng_statedump_end"),
+			NULL, 0, handle_statedump_end, NULL, NULL, NULL);
 	bt_ctf_iter_add_callback(iter,
 			g_quark_from_static_string(
 				"lttng_statedump_process_state"),
@@ -948,84 +1518,109 @@ void iter_trace(struct bt_context *bt_ctx)
 				"lttng_statedump_file_descriptor"),
 			NULL, 0, handle_statedump_file_descriptor,
 			NULL, NULL, NULL);
-	bt_ctf_iter_add_callback(iter,
-			g_quark_from_static_string("sys_open"),
-			NULL, 0, handle_sys_open, NULL, NULL, NULL);
-	bt_ctf_iter_add_callback(iter,
-			g_quark_from_static_string("syscall_entry_open"),
-			NULL, 0, handle_sys_open, NULL, NULL, NULL);
 
-	bt_ctf_iter_add_callback(iter,
-			g_quark_from_static_string("sys_socket"),
-			NULL, 0, handle_sys_socket, NULL, NULL, NULL);
-	bt_ctf_iter_add_callback(iter,
-			g_quark_from_static_string("syscall_entry_socket"),
-			NULL, 0, handle_sys_socket, NULL, NULL, NULL);
+	while ((event = bt_ctf_iter_read_event(iter)) != NULL) {
+		timestamp = bt_ctf_get_timestamp(event);
+		if (!first)
+			first = timestamp;
+		if (statedump_done || timestamp >= begin)
+			break;
+		if (!statedump_started && timestamp - first >= refresh_display)
+			break;
+		ret = bt_iter_next(bt_ctf_get_iter(iter));
+		if (ret < 0)
+			break;
+	}
+	bt_ctf_iter_destroy(iter);
 
-	bt_ctf_iter_add_callback(iter,
-			g_quark_from_static_string("sys_close"),
-			NULL, 0, handle_sys_close, NULL, NULL, NULL);
-	bt_ctf_iter_add_callback(iter,
-			g_quark_from_static_string("syscall_entry_close"),
-			NULL, 0, handle_sys_close, NULL, NULL, NULL);
+	return 0;
+}
 
-	bt_ctf_iter_add_callback(iter,
-			g_quark_from_static_string("exit_syscall"),
-			NULL, 0, handle_exit_syscall, NULL, NULL, NULL);
-	bt_ctf_iter_add_callback(iter,
-			g_quark_from_static_string("syscall_exit_open"),
-			NULL, 0, handle_exit_syscall, NULL, NULL, NULL);
-	bt_ctf_iter_add_callback(iter,
-			g_quark_from_static_string("syscall_exit_socket"),
-			NULL, 0, handle_exit_syscall, NULL, NULL, NULL);
-	bt_ctf_iter_add_callback(iter,
-			g_quark_from_static_string("syscall_exit_close"),
-			NULL, 0, handle_exit_syscall, NULL, NULL, NULL);
-	if (opt_textdump) {
-		bt_ctf_iter_add_callback(iter, 0, NULL, 0,
-				textdump,
-				NULL, NULL, NULL);
-	} else {
-		/* at each event check if we need to refresh */
-		bt_ctf_iter_add_callback(iter, 0, NULL, 0,
-				check_timestamp,
-				NULL, NULL, NULL);
-		/* to handle the scheduling events */
-		bt_ctf_iter_add_callback(iter,
-				g_quark_from_static_string("sched_switch"),
-				NULL, 0, handle_sched_switch, NULL, NULL, NULL);
-		/* for IO top */
-		bt_ctf_iter_add_callback(iter,
-				g_quark_from_static_string("sys_write"),
-				NULL, 0, handle_sys_write, NULL, NULL, NULL);
-		bt_ctf_iter_add_callback(iter,
-				g_quark_from_static_string("syscall_entry_write"),
-				NULL, 0, handle_sys_write, NULL, NULL, NULL);
-		bt_ctf_iter_add_callback(iter,
-				g_quark_from_static_string("syscall_exit_write"),
-				NULL, 0, handle_exit_syscall, NULL, NULL, NULL);
-
-		bt_ctf_iter_add_callback(iter,
-				g_quark_from_static_string("sys_read"),
-				NULL, 0, handle_sys_read, NULL, NULL, NULL);
-		bt_ctf_iter_add_callback(iter,
-				g_quark_from_static_string("syscall_entry_read"),
-				NULL, 0, handle_sys_read, NULL, NULL, NULL);
-		bt_ctf_iter_add_callback(iter,
-				g_quark_from_static_string("syscall_exit_read"),
-				NULL, 0, handle_exit_syscall, NULL, NULL, NULL);
-
-		/* for kprobes */
-		if (lttngtop.kprobes_table) {
-			for (i = 0; i < lttngtop.kprobes_table->len; i++) {
-				kprobe = g_ptr_array_index(lttngtop.kprobes_table, i);
-				bt_ctf_iter_add_callback(iter,
-						g_quark_from_static_string(
-							kprobe->probe_name),
-						NULL, 0, handle_kprobes,
-						NULL, NULL, NULL);
-			}
+/*
+ * Iterator from one refresh interval before begin, to know the current
+ * task of each cpu and the pending syscalls at begin, from the beginning
+ * of the trace if begin is 0.
+ */
+static struct analysis_iter *seek_analysis_iter(struct bt_context *bt_ctx,
+		uint64_t begin)
+{
+	return seek_analysis_from(bt_ctx, begin - MIN(refresh_display, begin));
+}
+
+/* how far a jump replays the trace after a snapshot of the history */
+#define JUMP_MAX_REPLAY_INTERVALS	60
+
+/*
+ * Rebuild the state at begin and give the time to read the trace from.
+ * The snapshot of the history ending the closest before the refresh
+ * interval preceding begin has the state at its end, the trace is
+ * replayed from there if it is not too far. Otherwise the state comes
+ * from the statedump and only the refresh interval before begin is read.
+ */
+static int restore_state(struct bt_context *bt_ctx, uint64_t begin,
+		uint64_t *from)
+{
+	struct lttngtop *checkpoint = NULL;
+	unsigned int index;
+
+	*from = begin - MIN(refresh_display, begin);
+	if (find_history_before(*from, &index) == 0 &&
+			select_history(&checkpoint, index) == 0) {
+		if (*from - checkpoint->end <=
+				JUMP_MAX_REPLAY_INTERVALS * refresh_display) {
+			restore_live_state(checkpoint);
+			*from = checkpoint->end;
+			release_history(&checkpoint);
+			return 0;
 		}
+		release_history(&checkpoint);
+	}
+
+	reset_live_state();
+	if (begin && bootstrap_state(bt_ctx, begin) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Restart the analysis at the time requested from the display. The state
+ * computed at the previous position is dropped, it is rebuilt from the
+ * history or the statedump, the trace read before the new position gives
+ * the current task of each cpu again.
+ */
+static struct analysis_iter *jump_analysis(struct bt_context *bt_ctx)
+{
+	uint64_t from;
+
+	g_atomic_int_set(&jump_requested, 0);
+	/* the request woke up the end of the trace */
+	while (sem_trywait(&end_trace_sem) == 0)
+		;
+	if (restore_state(bt_ctx, jump_target, &from) < 0)
+		return NULL;
+	window_begin = jump_target;
+	window_done = 0;
+	last_display_update = 0;
+	last_event_ts = 0;
+
+	return seek_analysis_from(bt_ctx, from);
+}
+
+void iter_trace(struct bt_context *bt_ctx)
+{
+	struct analysis_iter *iter;
+	const struct bt_ctf_event *event;
+	int ret = 0;
+
+	if (window_begin && bootstrap_state(bt_ctx, window_begin) < 0) {
+		fprintf(stderr, "[error] Reading the statedump\n");
+		return;
+	}
+	iter = seek_analysis_iter(bt_ctx, window_begin);
+	if (!iter) {
+		fprintf(stderr, "[error] Creating the trace iterator\n");
+		return;
 	}
 
 	if (opt_exec_name) {
@@ -1046,19 +1641,138 @@ void iter_trace(struct bt_context *bt_ctx)
 		}
 	}
 
-	while ((event = bt_ctf_iter_read_event(iter)) != NULL) {
-		if (quit || reload_trace)
+	while (1) {
+		while ((event = read_analysis_event(iter)) != NULL) {
+			if (quit || reload_trace)
+				goto end_iter;
+			if (window_done || g_atomic_int_get(&jump_requested))
+				break;
+			ret = next_analysis_event(iter);
+			if (ret < 0)
+				goto end_iter;
+		}
+
+		if (opt_batch) {
+			/* the last interval is shorter than the refresh period */
+			if (!window_done && last_event_ts > last_display_update &&
+					last_event_ts >= window_begin)
+				add_snapshot(get_copy_lttngtop(last_display_update,
+							last_event_ts));
 			goto end_iter;
-		ret = bt_iter_next(bt_ctf_get_iter(iter));
-		if (ret < 0)
+		}
+
+		/*
+		 * block until quit or a jump, we reached the end of the trace
+		 * or of the window
+		 */
+		if (!quit && !g_atomic_int_get(&jump_requested))
+			sem_wait(&end_trace_sem);
+		if (quit || !g_atomic_int_get(&jump_requested))
 			goto end_iter;
+
+		destroy_analysis_iter(iter);
+		iter = jump_analysis(bt_ctx);
+		if (!iter) {
+			fprintf(stderr, "[error] Seeking in the trace\n");
+			return;
+		}
 	}
 
+end_iter:
+	destroy_analysis_iter(iter);
+}
+
+/*
+ * Worker process of a shard: the analysis of the window of the shard. The
+ * state at the beginning of the window comes from the previous shard when
+ * the snapshots are merged, only the first shard rebuilds it.
+ */
+static int analyse_shard(struct shard *shard, void *priv)
+{
+	struct bt_context *bt_ctx = priv;
+	struct analysis_iter *iter;
+	const struct bt_ctf_event *event;
+	uint64_t begin = 0;
+	int ret;
+
+	current_shard = shard;
+	if (shard->index > 0) {
+		begin = shard->begin;
+		carried_state = 1;
+	} else if (window_begin) {
+		begin = shard->begin;
+		ret = bootstrap_state(bt_ctx, begin);
+		if (ret < 0)
+			goto error;
+	}
+	window_begin = shard->begin;
+	window_end = shard->end;
+	publish_interval = write_shard_interval;
+
+	iter = seek_analysis_iter(bt_ctx, begin);
+	if (!iter)
+		goto error;
+	while ((event = read_analysis_event(iter)) != NULL) {
+		if (quit || window_done)
+			break;
+		ret = next_analysis_event(iter);
+		if (ret < 0)
+			break;
+	}
+	/* in batch, the end of the trace is summarized too */
+	if (opt_batch && !quit && !window_done &&
+			last_event_ts > last_display_update &&
+			last_event_ts >= window_begin) {
+		if (write_shard_interval(last_display_update, last_event_ts) < 0)
+			publish_error = 1;
+	}
+	destroy_analysis_iter(iter);
+
+	return publish_error ? -1 : 0;
+
+error:
+	fprintf(stderr, "[error] Creating the iterator of the shard %u\n",
+			shard->index);
+	return -1;
+}
+
+/* the snapshots of the workers are displayed in the order of the trace */
+static void merge_trace(GArray *shards)
+{
+	int ret;
+
+	ret = merge_shards(shards, add_snapshot, &quit);
+	if (ret < 0 && !quit)
+		fprintf(stderr, "[error] Merging the shards\n");
+	if (opt_batch)
+		return;
+
 	/* block until quit, we reached the end of the trace */
 	sem_wait(&end_trace_sem);
+}
 
-end_iter:
-	bt_ctf_iter_destroy(iter);
+/* the window of --begin-time and --end-time, found with the packet indexes */
+static int set_time_window(struct bt_context *bt_ctx)
+{
+	uint64_t end;
+
+	if (get_trace_range(bt_ctx, &trace_begin, &end) < 0) {
+		if (!opt_begin_time.set && !opt_end_time.set)
+			return 0;
+		fprintf(stderr, "[error] The trace has no packet index to "
+				"seek in\n");
+		return -1;
+	}
+	if (opt_begin_time.set)
+		window_begin = resolve_time(&opt_begin_time);
+	if (opt_end_time.set)
+		window_end = resolve_time(&opt_end_time);
+	if (window_begin >= window_end || window_begin > end) {
+		fprintf(stderr, "[error] No event in the time window\n");
+		return -1;
+	}
+
+	return 0;
 }
 
 /*
@@ -1170,7 +1884,6 @@ static int check_field_requirements(const struct bt_ctf_field_decl *const * fiel
 		int *procname_check, int *ppid_check)
 {
 	int j;
-	struct perfcounter *global;
 	const char *name;
 
 	for (j = 0; j < field_cnt; j++) {
@@ -1191,17 +1904,8 @@ static int check_field_requirements(const struct bt_ctf_field_decl *const * fiel
 			if (strncmp(name, "procname", 8) == 0)
 				(*procname_check)++;
 		}
-		if (strncmp(name, "perf_", 5) == 0) {
-			global = g_hash_table_lookup(global_perf_liszt, (gpointer) name);
-			if (!global) {
-				global = g_new0(struct perfcounter, 1);
-				/* by default, sort on the first perf context */
-				if (g_hash_table_size(global_perf_liszt) == 0)
-					global->sort = 1;
-				global->visible = 1;
-				g_hash_table_insert(global_perf_liszt, (gpointer) strdup(name), global);
-			}
-		}
+		if (strncmp(name, "perf_", 5) == 0)
+			register_perf_counter(name);
 	}
 
 	if (*tid_check == 1 && *pid_check == 1 && *ppid_check == 1 &&
@@ -1289,6 +1993,7 @@ int main(int argc, char **argv, char **envp)
 	int ret;
 	struct bt_context *bt_ctx = NULL;
 	char *live_session_name = NULL;
+	GArray *shards = NULL;
 
 	init_lttngtop();
 	ret = parse_options(argc, argv);
@@ -1300,6 +2005,12 @@ int main(int argc, char **argv, char **envp)
 		exit(EXIT_SUCCESS);
 	}
 
+	ret = init_history(opt_history_size, opt_history_mem);
+	if (ret < 0)
+		exit(EXIT_FAILURE);
+	/* the snapshots are published from this thread */
+	register_history_thread();
+
 	if (opt_exec_name) {
 		opt_exec_env = envp;
 		signal(SIGCHLD, handle_sigchild);
@@ -1324,7 +2035,8 @@ int main(int argc, char **argv, char **envp)
 		}
 	} else {
 		bt_ctx = bt_context_create();
-		ret = bt_context_add_traces_recursive(bt_ctx, opt_input_path, "ctf", NULL);
+		ret = bt_context_add_traces_recursive(bt_ctx, opt_input_path, "ctf",
+				NULL);
 		if (ret < 0) {
 			fprintf(stderr, "[error] Opening the trace\n");
 			goto end;
@@ -1337,8 +2049,25 @@ int main(int argc, char **argv, char **envp)
 			//goto end;
 		}
 
-		if (!opt_textdump) {
+		ret = set_time_window(bt_ctx);
+		if (ret < 0)
+			goto end;
+
+		/* the workers are forked before starting any thread */
+		if (opt_jobs > 1 && opt_input_path && !opt_textdump &&
+				!opt_exec_name) {
+			shards = split_trace(bt_ctx, opt_jobs, refresh_display,
+					window_begin, window_end);
+			ret = start_shards(shards, analyse_shard, bt_ctx);
+			if (ret < 0)
+				goto end;
+			merged_shards = shards;
+		}
+
+		if (!opt_textdump && !opt_batch) {
 #ifdef HAVE_LIBNCURSES
+			/* the live traces cannot wait for the display */
+			pace_snapshots = opt_input_path && !opt_exec_name;
 			pthread_create(&display_thread, NULL, ncurses_display,
 					(void *) NULL);
 			pthread_create(&timer_thread, NULL, refresh_thread,
@@ -1350,17 +2079,28 @@ int main(int argc, char **argv, char **envp)
 #endif
 		}
 
-		iter_trace(bt_ctx);
+		if (shards) {
+			merge_trace(shards);
+		} else {
+			jump_allowed = opt_input_path && !opt_exec_name &&
+				!opt_batch;
+			iter_trace(bt_ctx);
+		}
 	}
 
 
-	pthread_join(display_thread, NULL);
-	quit = 1;
-	pthread_join(timer_thread, NULL);
+	if (!opt_batch) {
+		pthread_join(display_thread, NULL);
+		quit = 1;
+		pthread_join(timer_thread, NULL);
+	}
 
 	ret = 0;
 
 end:
+	free_shards(shards);
+	close_decoders(decoders);
+	unregister_history_thread();
 	if (bt_ctx)
 		bt_context_put(bt_ctx);
 
@@ -24,6 +24,14 @@ extern int opt_child;
 extern int opt_begin;
 extern int valid_trace;
 
+/* see packet-pool.h */
+extern unsigned long opt_live_buffer_mem;
+extern int opt_live_hugepages;
+/* see network-live.h */
+extern int opt_live_connections;
+/* see live-record.h */
+extern const char *opt_live_record;
+
 extern pthread_t display_thread;
 extern pthread_t timer_thread;
 void *ncurses_display(void *p);
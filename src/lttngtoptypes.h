@@ -18,8 +18,17 @@
 #ifndef LTTNGTOPTYPES_H
 #define LTTNGTOPTYPES_H
 
+#include <stdint.h>
 #include <glib.h>
 
+struct arena;
+
+/* perf counter values indexed by the slot of the counter */
+struct perf_values {
+	uint64_t *count;
+	unsigned int len;
+};
+
 struct lttngtop {
 	GHashTable *process_hash_table;	/* struct processtop */
 	GPtrArray *process_table;	/* struct processtop */
@@ -37,8 +46,23 @@ struct lttngtop {
 	unsigned int nbfiles;
 	unsigned int nbnewfiles;
 	unsigned int nbclosedfiles;
+	/* snapshots only: references from the history and the display */
+	int refcount;
+	/* snapshots only: estimated memory used by the copies made for it */
+	unsigned long mem_size;
+	/* snapshots only: holds the snapshot, its cpus and kprobes */
+	struct arena *arena;
 } lttngtop;
 
+struct syscalls {
+	unsigned int id;
+	unsigned long count;
+	uint64_t cpu_id;
+	unsigned int type;
+	unsigned int tid;
+	unsigned int fd;
+};
+
 struct processtop {
 	unsigned int puuid;
 	int pid;
@@ -55,30 +79,42 @@ struct processtop {
 	GPtrArray *process_files_table;
 	struct file_history *files_history;
 	GPtrArray *threads;
-	GHashTable *perf;
+	struct perf_values perf;
 	struct processtop *threadparent;
 	/* IO calculting */
 	unsigned long totalfileread;
 	unsigned long totalfilewrite;
 	unsigned long fileread;
 	unsigned long filewrite;
-	struct syscalls *syscall_info;
+	/* read/write/open waiting for its exit, valid if syscall_pending */
+	struct syscalls syscall_info;
+	int syscall_pending;
 	unsigned long totalcpunsec;
 	unsigned long threadstotalcpunsec;
+	/* modified since the last snapshot copy */
+	int dirty;
+	/* last snapshot copy, shared by the snapshots while not dirty */
+	struct processtop *snapshot;
+	/* copies only: references from the snapshots and the live process */
+	int refcount;
 };
 
+/* perf counter found in the trace, see register_perf_counter() */
 struct perfcounter
 {
 	unsigned long count;
 	int visible;
 	int sort;
+	unsigned int slot;
 };
 
 struct cputime {
 	guint id;
 	struct processtop *current_task;
 	unsigned long task_start;
-	GHashTable *perf;
+	/* time running a task during the period */
+	unsigned long busy_nsec;
+	struct perf_values perf;
 	struct syscall *current_syscall;
 };
 
@@ -159,15 +195,6 @@ struct syscall {
 	uint64_t cpu_id;
 };
 
-struct syscalls {
-	unsigned int id;
-	unsigned long count;
-	uint64_t cpu_id;
-	unsigned int type;
-	unsigned int tid;
-	unsigned int fd;
-};
-
 struct signals {
 	int dest_pid;
 	int id;
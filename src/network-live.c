@@ -182,7 +182,8 @@ int parse_url(const char *path, struct lttng_live_ctx *ctx)
 		ret = 0;
 		goto end;
 	}
-	ret = sscanf(remain[2], "host/%[a-zA-Z.0-9%-]/%s",
+	/* the hostname and session name can be glob patterns */
+	ret = sscanf(remain[2], "host/%[a-zA-Z.0-9%*?-]/%s",
 			ctx->traced_hostname, ctx->session_name);
 	if (ret != 2) {
 		fprintf(stderr, "[error] Format : "
@@ -207,16 +208,13 @@ static int lttng_live_open_trace_read(const char *path)
 	struct lttng_live_ctx *ctx;
 
 	ctx = g_new0(struct lttng_live_ctx, 1);
-	ctx->session = g_new0(struct lttng_live_session, 1);
-
-	/* We need a pointer to the context from the packet_seek function. */
-	ctx->session->ctx = ctx;
-
-	/* HT to store the CTF traces. */
-	ctx->session->ctf_traces = g_hash_table_new(g_direct_hash,
-			g_direct_equal);
+	/* filled when the sessions are listed */
+	ctx->sessions = g_ptr_array_new_with_free_func(
+			(GDestroyNotify) lttng_live_session_free);
 	ctx->port = -1;
-	ctx->session_ids = g_array_new(FALSE, TRUE, sizeof(uint64_t));
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+	ctx->metadata_streams = g_ptr_array_new();
 
 	ret = parse_url(path, ctx);
 	if (ret < 0) {
@@ -245,14 +243,15 @@ static int lttng_live_open_trace_read(const char *path)
 		goto end_free;
 	}
 
-	if (ctx->session_ids->len > 0) {
+	if (ctx->sessions->len > 0) {
 		ret = lttng_live_read(ctx);
 	}
 
 end_free:
-	g_hash_table_destroy(ctx->session->ctf_traces);
-	g_free(ctx->session);
-	g_free(ctx->session->streams);
+	g_ptr_array_free(ctx->sessions, TRUE);
+	g_ptr_array_free(ctx->metadata_streams, TRUE);
+	pthread_cond_destroy(&ctx->cond);
+	pthread_mutex_destroy(&ctx->lock);
 	g_free(ctx);
 
 	if (lttng_live_should_quit()) {
@@ -23,6 +23,10 @@
 #include <lib/babeltrace/clock-internal.h>
 #include <lib/babeltrace/ctf/ctf-index.h>
 
+/* --live-connections */
+#define DEFAULT_LIVE_CONNECTIONS	1
+#define MAX_LIVE_CONNECTIONS		16
+
 /* Copied from babeltrace/formats/ctf/events-private.h */
 static inline
 uint64_t ctf_get_real_timestamp(struct ctf_stream_definition *stream,
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <glib.h>
+#include <babeltrace/mmap-align.h>
+
+#include "packet-pool.h"
+
+/* size classes from 4k to 64MB, the bigger packets are not kept */
+#define PACKET_POOL_MIN_SHIFT	12
+#define PACKET_POOL_CLASSES	15
+#define HUGE_PAGE_SIZE		(2UL * 1024 * 1024)
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+/* struct mmap_align, the idle buffers of each size class */
+static GPtrArray *free_buffers[PACKET_POOL_CLASSES];
+/* mapped by the pool, borrowed or idle */
+static size_t pool_mem;
+static size_t borrowed_mem;
+static size_t pool_max_mem;
+static int pool_hugepages;
+
+void packet_pool_init(size_t max_mem, int hugepages)
+{
+	int i;
+
+	pthread_mutex_lock(&pool_lock);
+	for (i = 0; i < PACKET_POOL_CLASSES; i++) {
+		if (!free_buffers[i])
+			free_buffers[i] = g_ptr_array_new();
+	}
+	pool_max_mem = max_mem;
+	pool_hugepages = hugepages;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+static int size_class(size_t size)
+{
+	int class = 0;
+
+	while (class < PACKET_POOL_CLASSES &&
+			((size_t) 1 << (PACKET_POOL_MIN_SHIFT + class)) < size)
+		class++;
+	return class;
+}
+
+static size_t class_size(int class)
+{
+	return (size_t) 1 << (PACKET_POOL_MIN_SHIFT + class);
+}
+
+/*
+ * Must be called with pool_lock held, unmap the idle buffers, the biggest
+ * first, until size more bytes fit under the limit.
+ */
+static void trim_pool(size_t size)
+{
+	struct mmap_align *mma;
+	int class;
+
+	for (class = PACKET_POOL_CLASSES - 1; class >= 0; class--) {
+		while (pool_mem + size > pool_max_mem &&
+				free_buffers[class]->len > 0) {
+			mma = g_ptr_array_remove_index_fast(free_buffers[class],
+					free_buffers[class]->len - 1);
+			pool_mem -= mma->page_aligned_length;
+			munmap_align(mma);
+		}
+	}
+}
+
+static struct mmap_align *map_buffer(size_t size)
+{
+	struct mmap_align *mma = MAP_FAILED;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+
+	if (pool_hugepages && size >= HUGE_PAGE_SIZE)
+		mma = mmap_align(size, PROT_READ | PROT_WRITE,
+				flags | MAP_HUGETLB, -1, 0);
+	/* no huge page available */
+	if (mma == MAP_FAILED)
+		mma = mmap_align(size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (mma == MAP_FAILED) {
+		perror("[error] mmap error");
+		return NULL;
+	}
+	return mma;
+}
+
+struct mmap_align *packet_pool_get(size_t len)
+{
+	struct mmap_align *mma = NULL;
+	size_t size;
+	int class;
+
+	class = size_class(len);
+	size = class < PACKET_POOL_CLASSES ? class_size(class) : len;
+
+	pthread_mutex_lock(&pool_lock);
+	if (class < PACKET_POOL_CLASSES && free_buffers[class]->len > 0) {
+		mma = g_ptr_array_remove_index_fast(free_buffers[class],
+				free_buffers[class]->len - 1);
+		goto end;
+	}
+	if (pool_max_mem)
+		trim_pool(size);
+	/* the limit is enforced by the readers with packet_pool_full() */
+	mma = map_buffer(size);
+	if (!mma)
+		goto error;
+	pool_mem += mma->page_aligned_length;
+
+end:
+	mma->length = len;
+	borrowed_mem += mma->page_aligned_length;
+error:
+	pthread_mutex_unlock(&pool_lock);
+	return mma;
+}
+
+void packet_pool_put(struct mmap_align *mma)
+{
+	int class;
+
+	class = size_class(mma->page_aligned_length);
+
+	pthread_mutex_lock(&pool_lock);
+	borrowed_mem -= mma->page_aligned_length;
+	if (class < PACKET_POOL_CLASSES &&
+			class_size(class) == mma->page_aligned_length &&
+			(!pool_max_mem || pool_mem <= pool_max_mem)) {
+		g_ptr_array_add(free_buffers[class], mma);
+	} else {
+		pool_mem -= mma->page_aligned_length;
+		munmap_align(mma);
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+int packet_pool_full(void)
+{
+	int full;
+
+	pthread_mutex_lock(&pool_lock);
+	full = pool_max_mem && borrowed_mem >= pool_max_mem;
+	pthread_mutex_unlock(&pool_lock);
+
+	return full;
+}
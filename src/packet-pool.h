@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _PACKET_POOL_H
+#define _PACKET_POOL_H
+
+#include <stddef.h>
+
+#define DEFAULT_LIVE_BUFFER_MEM	(256UL * 1024 * 1024)
+
+struct mmap_align;
+
+/*
+ * Buffers of the live data packets, shared by all the streams. The
+ * buffers are anonymous mappings of a power of two size, prefaulted when
+ * they are created and kept for reuse once they are returned. Above
+ * max_mem (0 for unlimited), the idle buffers are unmapped instead of
+ * being kept and packet_pool_full() tells the readers to stop reading
+ * ahead. With hugepages, the buffers of at least 2MB are backed by huge
+ * pages when the system has some available. Thread-safe.
+ */
+void packet_pool_init(size_t max_mem, int hugepages);
+/* NULL on error */
+struct mmap_align *packet_pool_get(size_t len);
+void packet_pool_put(struct mmap_align *mma);
+/* the borrowed buffers reached max_mem */
+int packet_pool_full(void);
+
+#endif /* _PACKET_POOL_H */
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "pool.h"
+
+/* objects allocated at once when the pool is empty */
+#define POOL_BATCH	64
+
+static void refill_pool(struct pool *pool)
+{
+	char *objects;
+	int i;
+
+	/* new objects are zeroed */
+	objects = g_malloc0(pool->size * POOL_BATCH);
+	for (i = POOL_BATCH - 1; i >= 0; i--)
+		g_ptr_array_add(pool->free_objects, objects + i * pool->size);
+}
+
+void *pool_alloc(struct pool *pool)
+{
+	if (!pool->free_objects)
+		pool->free_objects = g_ptr_array_sized_new(POOL_BATCH);
+	if (pool->free_objects->len == 0)
+		refill_pool(pool);
+
+	return g_ptr_array_remove_index_fast(pool->free_objects,
+			pool->free_objects->len - 1);
+}
+
+void *pool_alloc0(struct pool *pool)
+{
+	void *object;
+
+	object = pool_alloc(pool);
+	memset(object, 0, pool->size);
+
+	return object;
+}
+
+void pool_free(struct pool *pool, void *object)
+{
+	if (object)
+		g_ptr_array_add(pool->free_objects, object);
+}
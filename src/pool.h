@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <stddef.h>
+#include <glib.h>
+
+/*
+ * Free-list of objects of the same type for the live state. The objects
+ * are allocated by batches and the released ones are reused, the memory
+ * is never given back to the system. Not thread-safe.
+ */
+struct pool {
+	size_t size;
+	GPtrArray *free_objects;
+};
+
+#define POOL_INIT(type)		{ .size = sizeof(type) }
+
+/*
+ * A reused object keeps the content it had when it was released, which
+ * lets the caller recycle the containers it points to.
+ */
+void *pool_alloc(struct pool *pool);
+/* zeroed object */
+void *pool_alloc0(struct pool *pool);
+void pool_free(struct pool *pool, void *object);
+
+#endif /* _POOL_H */
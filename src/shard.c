@@ -0,0 +1,655 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <babeltrace/babeltrace.h>
+#include <babeltrace/babeltrace-internal.h>
+#include <babeltrace/context-internal.h>
+#include <babeltrace/ctf/types.h>
+#include <babeltrace/ctf/metadata.h>
+#include <linux/unistd.h>
+
+#include "common.h"
+#include "compact-history.h"
+#include "shard.h"
+
+/*
+ * State at the end of the previous shard. A worker only knows what the
+ * events of its window tell, its snapshots are completed with the carried
+ * processes and files so they are the same as with a single process.
+ */
+struct shard_carry {
+	/*
+	 * tid -> private process copy, the counters of the period at 0, its
+	 * snapshot is the copy shared by the snapshots while it is unchanged
+	 */
+	GHashTable *procs;
+	/* carried processes and files the worker counted as new ones */
+	GHashTable *counted;
+	unsigned int nbproc, nbthreads, nbfiles;
+	/* added to the totals of the worker */
+	int adjust_threads, adjust_files;
+};
+
+struct packet_range {
+	uint64_t begin;
+	uint64_t end;
+	uint64_t size;
+};
+
+static gint compare_packet_begin(gconstpointer a, gconstpointer b)
+{
+	const struct packet_range *pa = a, *pb = b;
+
+	return (pa->begin > pb->begin) - (pa->begin < pb->begin);
+}
+
+/* struct packet_range of all the streams of all the traces */
+static GArray *collect_packets(struct bt_context *bt_ctx)
+{
+	struct ctf_stream_declaration *stream_class;
+	struct ctf_stream_definition *stream;
+	struct ctf_file_stream *file_stream;
+	struct bt_trace_descriptor *td;
+	struct packet_index *index;
+	struct packet_range range;
+	struct ctf_trace *trace;
+	GArray *packets;
+	int i, j, k, l;
+
+	packets = g_array_new(FALSE, FALSE, sizeof(struct packet_range));
+	for (i = 0; i < bt_ctx->tc->array->len; i++) {
+		td = g_ptr_array_index(bt_ctx->tc->array, i);
+		trace = container_of(td, struct ctf_trace, parent);
+		for (j = 0; j < trace->streams->len; j++) {
+			stream_class = g_ptr_array_index(trace->streams, j);
+			if (!stream_class)
+				continue;
+			for (k = 0; k < stream_class->streams->len; k++) {
+				stream = g_ptr_array_index(stream_class->streams, k);
+				if (!stream)
+					continue;
+				file_stream = container_of(stream,
+						struct ctf_file_stream, parent);
+				if (!file_stream->pos.packet_index)
+					continue;
+				for (l = 0; l < file_stream->pos.packet_index->len; l++) {
+					index = &g_array_index(
+						file_stream->pos.packet_index,
+						struct packet_index, l);
+					range.begin = index->ts_real.timestamp_begin;
+					range.end = index->ts_real.timestamp_end;
+					range.size = index->content_size / CHAR_BIT;
+					g_array_append_val(packets, range);
+				}
+			}
+		}
+	}
+	g_array_sort(packets, compare_packet_begin);
+
+	return packets;
+}
+
+static void add_shard(GArray *shards, uint64_t begin)
+{
+	struct shard shard = {
+		.index = shards->len,
+		.begin = begin,
+		.end = -1ULL,
+		.pid = -1,
+	};
+
+	if (shards->len)
+		g_array_index(shards, struct shard, shards->len - 1).end = begin;
+	g_array_append_val(shards, shard);
+}
+
+int get_trace_range(struct bt_context *bt_ctx, uint64_t *begin,
+		uint64_t *end)
+{
+	struct packet_range *packet;
+	GArray *packets;
+	int i, ret = -1;
+
+	packets = collect_packets(bt_ctx);
+	if (!packets->len)
+		goto end;
+
+	*begin = g_array_index(packets, struct packet_range, 0).begin;
+	*end = 0;
+	for (i = 0; i < packets->len; i++) {
+		packet = &g_array_index(packets, struct packet_range, i);
+		*end = MAX(*end, packet->end);
+	}
+	ret = 0;
+
+end:
+	g_array_free(packets, TRUE);
+	return ret;
+}
+
+GArray *split_trace(struct bt_context *bt_ctx, unsigned int nr_shards,
+		uint64_t interval, uint64_t begin, uint64_t end)
+{
+	struct packet_range *packet;
+	uint64_t first, cut, total = 0, size = 0;
+	GArray *packets, *shards;
+	unsigned int next = 1, kept = 0;
+	int i;
+
+	shards = g_array_new(FALSE, TRUE, sizeof(struct shard));
+	packets = collect_packets(bt_ctx);
+	/* only the packets in the window are balanced */
+	for (i = 0; i < packets->len; i++) {
+		packet = &g_array_index(packets, struct packet_range, i);
+		if (packet->end < begin || packet->begin >= end)
+			continue;
+		g_array_index(packets, struct packet_range, kept++) = *packet;
+		total += packet->size;
+	}
+	g_array_set_size(packets, kept);
+	if (!packets->len) {
+		add_shard(shards, begin);
+		goto end;
+	}
+
+	first = MAX(begin, g_array_index(packets, struct packet_range, 0).begin);
+	add_shard(shards, first);
+	for (i = 0; i < packets->len && next < nr_shards; i++) {
+		packet = &g_array_index(packets, struct packet_range, i);
+		if (size >= total / nr_shards * next) {
+			next++;
+			cut = first + (packet->begin - first) / interval * interval;
+			if (cut > g_array_index(shards, struct shard,
+						shards->len - 1).begin)
+				add_shard(shards, cut);
+		}
+		size += packet->size;
+	}
+
+end:
+	g_array_index(shards, struct shard, shards->len - 1).end = end;
+	g_array_free(packets, TRUE);
+	return shards;
+}
+
+int start_shards(GArray *shards,
+		int (*worker)(struct shard *shard, void *priv), void *priv)
+{
+	struct shard *shard;
+	int i, ret;
+
+	for (i = 0; i < shards->len; i++) {
+		shard = &g_array_index(shards, struct shard, i);
+		shard->fp = tmpfile();
+		if (!shard->fp) {
+			perror("[error] Creating the shard output");
+			goto error;
+		}
+		/* nothing buffered would be written twice */
+		fflush(NULL);
+		shard->pid = fork();
+		if (shard->pid < 0) {
+			perror("[error] Starting the shard worker");
+			goto error;
+		}
+		if (shard->pid == 0) {
+			ret = worker(shard, priv);
+			if (fflush(shard->fp) != 0)
+				ret = -1;
+			_exit(ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+		}
+	}
+	return 0;
+
+error:
+	return -1;
+}
+
+int write_shard_snapshot(struct shard *shard, struct lttngtop *snapshot)
+{
+	GByteArray *buf;
+	uint64_t len;
+	int ret = 0;
+
+	buf = g_byte_array_new();
+	export_snapshot(buf, snapshot);
+	len = buf->len;
+	if (fwrite(&len, sizeof(len), 1, shard->fp) != 1 ||
+			fwrite(buf->data, buf->len, 1, shard->fp) != 1) {
+		perror("[error] Writing the shard snapshot");
+		ret = -1;
+	}
+	g_byte_array_free(buf, TRUE);
+
+	return ret;
+}
+
+/*
+ * The worker stays a zombie until it is reaped here, so stop_shards() can
+ * still signal it to make the wait return when quitting.
+ */
+static int wait_shard(struct shard *shard, int *quit)
+{
+	siginfo_t info;
+	int status, ret;
+	pid_t pid;
+
+	do {
+		ret = waitid(P_PID, shard->pid, &info, WEXITED | WNOWAIT);
+	} while (ret < 0 && errno == EINTR && !*quit);
+	if (ret < 0) {
+		if (!*quit)
+			perror("[error] Waiting for the shard worker");
+		return -1;
+	}
+	pid = shard->pid;
+	shard->pid = -1;
+	if (waitpid(pid, &status, 0) < 0 || *quit)
+		return -1;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+		fprintf(stderr, "[error] The worker of the shard %u failed\n",
+				shard->index);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void put_carried_process(gpointer data)
+{
+	struct processtop *old = data;
+
+	put_processtop_copy(old->snapshot);
+	put_processtop_copy(old);
+}
+
+static void init_carry(struct shard_carry *carry)
+{
+	memset(carry, 0, sizeof(*carry));
+	carry->procs = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, put_carried_process);
+	carry->counted = g_hash_table_new(g_direct_hash, g_direct_equal);
+}
+
+static void fini_carry(struct shard_carry *carry)
+{
+	g_hash_table_destroy(carry->counted);
+	g_hash_table_destroy(carry->procs);
+}
+
+static struct files *carry_file(struct files *file, struct processtop *ref)
+{
+	struct files *new;
+
+	new = g_new(struct files, 1);
+	memcpy(new, file, sizeof(struct files));
+	get_name(new->name);
+	new->ref = ref;
+	new->read = 0;
+	new->write = 0;
+
+	return new;
+}
+
+/* copy of a process with the counters of the period at 0 */
+static struct processtop *carry_process(struct processtop *proc)
+{
+	struct processtop *new;
+	struct files *file;
+	gint i;
+
+	new = g_new(struct processtop, 1);
+	memcpy(new, proc, sizeof(struct processtop));
+	new->refcount = 1;
+	new->snapshot = NULL;
+	get_name(new->comm);
+	new->fileread = 0;
+	new->filewrite = 0;
+	new->totalcpunsec = 0;
+	new->threadstotalcpunsec = 0;
+	new->perf.count = g_new0(uint64_t, new->perf.len);
+	new->process_files_table = g_ptr_array_sized_new(
+			proc->process_files_table->len);
+	for (i = 0; i < proc->process_files_table->len; i++) {
+		file = g_ptr_array_index(proc->process_files_table, i);
+		if (file && file->flag != __NR_close)
+			file = carry_file(file, new);
+		else
+			file = NULL;
+		g_ptr_array_add(new->process_files_table, file);
+	}
+
+	return new;
+}
+
+static void drop_file(struct processtop *proc, gint fd)
+{
+	struct files *file;
+
+	file = g_ptr_array_index(proc->process_files_table, fd);
+	g_ptr_array_index(proc->process_files_table, fd) = NULL;
+	put_name(file->name);
+	g_free(file);
+}
+
+static void drop_carried_file(struct shard_carry *carry,
+		struct processtop *old, gint fd)
+{
+	g_hash_table_remove(carry->counted,
+			g_ptr_array_index(old->process_files_table, fd));
+	drop_file(old, fd);
+	put_processtop_copy(old->snapshot);
+	old->snapshot = NULL;
+}
+
+/*
+ * The files the worker does not know get no name, old is the carried
+ * process of proc, NULL if it started in the window.
+ */
+static void complete_files(struct shard_carry *carry,
+		struct lttngtop *snapshot, struct processtop *proc,
+		struct processtop *old)
+{
+	struct files *file, *oldfile;
+	gint fd;
+
+	for (fd = 0; fd < proc->process_files_table->len; fd++) {
+		file = g_ptr_array_index(proc->process_files_table, fd);
+		oldfile = NULL;
+		if (old && fd < old->process_files_table->len)
+			oldfile = g_ptr_array_index(old->process_files_table, fd);
+		if (!file)
+			continue;
+		if (file->name) {
+			/* opened in the window, the carried file was replaced */
+			if (oldfile)
+				drop_carried_file(carry, old, fd);
+			continue;
+		}
+		if (!oldfile) {
+			/* a close alone is not seen without the carried file */
+			if (file->flag == __NR_close && !file->read &&
+					!file->write) {
+				drop_file(proc, fd);
+				snapshot->nbnewfiles--;
+			}
+			continue;
+		}
+		file->name = get_name(oldfile->name);
+		file->device = oldfile->device;
+		file->openmode = oldfile->openmode;
+		file->openedat = oldfile->openedat;
+		if (!g_hash_table_lookup(carry->counted, oldfile)) {
+			g_hash_table_insert(carry->counted, oldfile, oldfile);
+			carry->adjust_files--;
+			snapshot->nbnewfiles--;
+		}
+		if (file->flag == __NR_close)
+			drop_carried_file(carry, old, fd);
+	}
+	if (!old)
+		return;
+
+	/* the carried files not used in the window */
+	for (fd = 0; fd < old->process_files_table->len; fd++) {
+		oldfile = g_ptr_array_index(old->process_files_table, fd);
+		if (!oldfile)
+			continue;
+		if (fd >= proc->process_files_table->len)
+			g_ptr_array_set_size(proc->process_files_table, fd + 1);
+		if (!g_ptr_array_index(proc->process_files_table, fd))
+			g_ptr_array_index(proc->process_files_table, fd) =
+				carry_file(oldfile, proc);
+	}
+}
+
+static void complete_process(struct processtop *proc, struct processtop *old)
+{
+	proc->birth = old->birth;
+	if (!proc->comm)
+		proc->comm = get_name(old->comm);
+	if (!proc->host)
+		proc->host = old->host;
+	if (!proc->puuid)
+		proc->puuid = old->puuid;
+	if (!proc->pid)
+		proc->pid = old->pid;
+	if (!proc->ppid)
+		proc->ppid = old->ppid;
+	if (!proc->vpid)
+		proc->vpid = old->vpid;
+	if (!proc->vtid)
+		proc->vtid = old->vtid;
+	if (!proc->vppid)
+		proc->vppid = old->vppid;
+	proc->totalfileread += old->totalfileread;
+	proc->totalfilewrite += old->totalfilewrite;
+}
+
+static void forget_carried_process(struct shard_carry *carry,
+		struct processtop *old)
+{
+	gint fd;
+
+	for (fd = 0; fd < old->process_files_table->len; fd++)
+		g_hash_table_remove(carry->counted,
+				g_ptr_array_index(old->process_files_table, fd));
+	g_hash_table_remove(carry->counted, old);
+	g_hash_table_remove(carry->procs, (gpointer) (unsigned long) old->tid);
+}
+
+/*
+ * The worker counted the carried processes and files as new ones the
+ * first time it saw them, and the deaths of processes it never saw as
+ * processes born at their death.
+ */
+static void complete_snapshot(struct shard_carry *carry,
+		struct lttngtop *snapshot)
+{
+	struct processtop *proc, *old;
+	GHashTableIter iter;
+	GHashTable *seen;
+	gpointer value;
+	gint i;
+
+	seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (i = snapshot->process_table->len - 1; i >= 0; i--) {
+		proc = g_ptr_array_index(snapshot->process_table, i);
+		old = g_hash_table_lookup(carry->procs,
+				(gpointer) (unsigned long) proc->tid);
+		if (!old && proc->death && proc->death == proc->birth) {
+			g_ptr_array_remove_index(snapshot->process_table, i);
+			put_processtop_copy(proc);
+			snapshot->nbnewthreads--;
+			snapshot->nbdeadthreads--;
+			continue;
+		}
+		g_hash_table_insert(seen, (gpointer) (unsigned long) proc->tid,
+				proc);
+		complete_files(carry, snapshot, proc, old);
+		if (!old)
+			continue;
+		complete_process(proc, old);
+		if (!g_hash_table_lookup(carry->counted, old)) {
+			g_hash_table_insert(carry->counted, old, old);
+			carry->adjust_threads--;
+			snapshot->nbnewthreads--;
+		}
+		if (proc->death)
+			forget_carried_process(carry, old);
+	}
+
+	/* the carried processes without event in the window */
+	g_hash_table_iter_init(&iter, carry->procs);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		old = value;
+		if (g_hash_table_lookup(seen,
+					(gpointer) (unsigned long) old->tid))
+			continue;
+		if (!old->snapshot)
+			old->snapshot = carry_process(old);
+		proc = old->snapshot;
+		get_processtop_copy(proc);
+		snapshot->mem_size += processtop_copy_mem_size(proc);
+		g_ptr_array_add(snapshot->process_table, proc);
+	}
+	g_hash_table_destroy(seen);
+
+	snapshot->nbproc += carry->nbproc;
+	snapshot->nbthreads += carry->nbthreads + carry->adjust_threads;
+	snapshot->nbfiles += carry->nbfiles + carry->adjust_files;
+	index_snapshot(snapshot);
+}
+
+/* the processes alive at the end of a shard are carried to the next one */
+static void carry_snapshot(struct shard_carry *carry,
+		struct lttngtop *snapshot)
+{
+	struct processtop *proc;
+	gint i;
+
+	g_hash_table_remove_all(carry->counted);
+	g_hash_table_remove_all(carry->procs);
+	for (i = 0; i < snapshot->process_table->len; i++) {
+		proc = g_ptr_array_index(snapshot->process_table, i);
+		if (proc->death)
+			continue;
+		g_hash_table_insert(carry->procs,
+				(gpointer) (unsigned long) proc->tid,
+				carry_process(proc));
+	}
+	carry->nbproc = snapshot->nbproc;
+	carry->nbthreads = snapshot->nbthreads;
+	carry->nbfiles = snapshot->nbfiles;
+	carry->adjust_threads = 0;
+	carry->adjust_files = 0;
+}
+
+/*
+ * The names are only sent with the first snapshot using them, so one
+ * import state is used for all the snapshots of a worker. A snapshot is
+ * given to add() once the next one is read, the last one is carried to
+ * the next shard first.
+ */
+static int read_shard(struct shard *shard, struct shard_carry *carry,
+		void (*add)(struct lttngtop *snapshot), int *quit)
+{
+	struct snapshot_import *import;
+	struct lttngtop *snapshot, *last = NULL;
+	GByteArray *buf;
+	uint64_t len;
+	int ret = 0;
+
+	rewind(shard->fp);
+	import = new_snapshot_import();
+	buf = g_byte_array_new();
+	while (!*quit && fread(&len, sizeof(len), 1, shard->fp) == 1) {
+		g_byte_array_set_size(buf, len);
+		if (fread(buf->data, len, 1, shard->fp) != 1) {
+			ret = -1;
+			break;
+		}
+		snapshot = import_snapshot(import, buf->data, len);
+		if (!snapshot) {
+			ret = -1;
+			break;
+		}
+		if (shard->index > 0)
+			complete_snapshot(carry, snapshot);
+		if (last)
+			add(last);
+		last = snapshot;
+	}
+	if (last) {
+		carry_snapshot(carry, last);
+		add(last);
+	}
+	if (ret < 0)
+		fprintf(stderr, "[error] Truncated snapshots in the shard "
+				"%u\n", shard->index);
+	g_byte_array_free(buf, TRUE);
+	free_snapshot_import(import);
+	fclose(shard->fp);
+	shard->fp = NULL;
+
+	return ret;
+}
+
+int merge_shards(GArray *shards, void (*add)(struct lttngtop *snapshot),
+		int *quit)
+{
+	struct shard_carry carry;
+	struct shard *shard;
+	int i, ret;
+
+	init_carry(&carry);
+	for (i = 0; i < shards->len; i++) {
+		shard = &g_array_index(shards, struct shard, i);
+		ret = wait_shard(shard, quit);
+		if (ret < 0)
+			goto end;
+		ret = read_shard(shard, &carry, add, quit);
+		if (ret < 0)
+			goto end;
+	}
+	ret = 0;
+
+end:
+	fini_carry(&carry);
+	return ret;
+}
+
+void stop_shards(GArray *shards)
+{
+	struct shard *shard;
+	pid_t pid;
+	int i;
+
+	for (i = 0; i < shards->len; i++) {
+		shard = &g_array_index(shards, struct shard, i);
+		/* reaped concurrently by wait_shard() */
+		pid = shard->pid;
+		if (pid > 0)
+			kill(pid, SIGTERM);
+	}
+}
+
+void free_shards(GArray *shards)
+{
+	struct shard *shard;
+	int i;
+
+	if (!shards)
+		return;
+	for (i = 0; i < shards->len; i++) {
+		shard = &g_array_index(shards, struct shard, i);
+		if (shard->pid > 0) {
+			kill(shard->pid, SIGTERM);
+			waitpid(shard->pid, NULL, 0);
+		}
+		if (shard->fp)
+			fclose(shard->fp);
+	}
+	g_array_free(shards, TRUE);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2026 Julien Desfossez
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _SHARD_H
+#define _SHARD_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <glib.h>
+#include <babeltrace/babeltrace.h>
+
+#include "lttngtoptypes.h"
+
+#define DEFAULT_JOBS	1
+#define MAX_JOBS	256
+
+/*
+ * Time range of an offline trace analysed by a worker process with its
+ * own copy of the analysis state, the snapshots of its refresh intervals
+ * are merged in order by the parent.
+ */
+struct shard {
+	unsigned int index;
+	uint64_t begin;
+	/* begin of the next shard, end of the window for the last one */
+	uint64_t end;
+	pid_t pid;
+	/* snapshots written by the worker */
+	FILE *fp;
+};
+
+/*
+ * Time of the first and the last events of the trace according to the
+ * packet indexes, -1 if the trace has no packet.
+ */
+int get_trace_range(struct bt_context *bt_ctx, uint64_t *begin,
+		uint64_t *end);
+
+/*
+ * Split the window [begin, end[ of the trace in at most nr_shards ranges
+ * holding about the same amount of data according to the packet indexes,
+ * the boundaries are on a multiple of interval from the beginning of the
+ * window. Returns an array of struct shard, with a single shard when the
+ * window is too small.
+ */
+GArray *split_trace(struct bt_context *bt_ctx, unsigned int nr_shards,
+		uint64_t interval, uint64_t begin, uint64_t end);
+
+/*
+ * Fork a worker process per shard, it calls worker() and exits with
+ * EXIT_FAILURE if it returns a negative value. Must be called before any
+ * other thread is started.
+ */
+int start_shards(GArray *shards,
+		int (*worker)(struct shard *shard, void *priv), void *priv);
+
+/* from a worker, in the order of the intervals */
+int write_shard_snapshot(struct shard *shard, struct lttngtop *snapshot);
+
+/*
+ * Give the snapshots of the shards in order to add(), waiting for each
+ * worker as needed. Stops when *quit is set, returns -1 if a worker
+ * failed.
+ */
+int merge_shards(GArray *shards, void (*add)(struct lttngtop *snapshot),
+		int *quit);
+
+/* make the workers still running exit, merge_shards() returns */
+void stop_shards(GArray *shards);
+
+/* kill the workers still running and release the shards */
+void free_shards(GArray *shards);
+
+#endif /* _SHARD_H */